@@ -0,0 +1,62 @@
+# Compare the dump files of two runs, e.g. a mixed precision build (`make mixed`) against the
+# normal all-double build on the same config, and print how far apart each property is.
+#
+# Usage: python3 accuracy_report.py REFERENCE_DUMPS TEST_DUMPS [DUMP NUMBERS...]
+# e.g.   python3 accuracy_report.py ./dumps_double ./dumps_mixed 0 100 200
+#
+# Only alive particles are compared, matched up by their IDs. Note that the dump files are only
+# written to 3 decimal places (5 for h), so differences smaller than that won't show up.
+
+import math
+import sys
+
+dumpfile_cols = ["Smoothing length", "Density", "Pressure", "Acceleration", "Velocity", "Position", "Thermal energy"]
+
+def read_dump(filepath):
+    particles = {}
+    time = None
+
+    with open(filepath) as f:
+        for line in f:
+            if line.startswith("# This file was dumped at t = "):
+                time = float(line.split("=")[1])
+            if line.startswith("#"):
+                continue
+
+            fields = line.split()
+            if fields[1] == "Alive":
+                particles[int(fields[0])] = [float(x) for x in fields[2:]]
+
+    return time, particles
+
+def compare(ref_dir, test_dir, n):
+    time, ref = read_dump(f"{ref_dir}/{n}.txt")
+    _, test = read_dump(f"{test_dir}/{n}.txt")
+
+    if ref.keys() != test.keys():
+        print(f"Dump {n}: the runs have different alive particles, can't compare")
+        return
+
+    print(f"Dump {n} (t = {time}), {len(ref)} particles")
+    print(f"    {'Property':<20}{'Max abs diff':>15}{'RMS diff':>15}{'Max rel diff':>15}")
+
+    for c, name in enumerate(dumpfile_cols):
+        diffs = [abs(ref[i][c] - test[i][c]) for i in ref]
+        scale = max(abs(ref[i][c]) for i in ref)
+
+        max_diff = max(diffs)
+        rms_diff = math.sqrt(sum(d ** 2 for d in diffs) / len(diffs))
+        # Relative to the largest value of the property, as a lot of the values are close to 0
+        rel_diff = max_diff / scale if scale > 0 else 0
+
+        print(f"    {name:<20}{max_diff:>15.3g}{rms_diff:>15.3g}{rel_diff:>15.3g}")
+
+if len(sys.argv) < 3:
+    print("Usage: python3 accuracy_report.py REFERENCE_DUMPS TEST_DUMPS [DUMP NUMBERS...]")
+    sys.exit(1)
+
+# By default, the start, middle and end of the standard shock tube run (200 steps)
+dump_numbers = sys.argv[3:] if len(sys.argv) > 3 else ["0", "100", "200"]
+
+for n in dump_numbers:
+    compare(sys.argv[1], sys.argv[2], n)
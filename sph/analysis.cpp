@@ -0,0 +1,292 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * analysis.cpp implements the Analysis class from analysis.hpp.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <numeric>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include "analysis.hpp"
+#include "define.hpp"
+#include "log.hpp"
+#include "neighbour_list.hpp"
+
+Analysis::Analysis(const Config &config, int n_bins)
+    : limit(config.limit), n_bins(n_bins), bin_width(2 * config.limit / n_bins),
+      deterministic(config.deterministic != 0) {}
+
+AnalysisResult Analysis::reduce(const Particle* particles, int n, Executor &executor) const {
+    if (deterministic) {
+        AnalysisResult result;
+        sum_ordered(particles, n, result);
+        find_shocks(result);
+        return result;
+    }
+
+    // A fixed number of parts (rather than one per thread) keeps the order of the sums the same
+    // however many threads there are
+    int n_parts = std::max(1, std::min(ANALYSIS_PARTS, (n + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE));
+    int part_size = (n + n_parts - 1) / n_parts;
+
+    std::vector<AnalysisTotals> part_totals(n_parts);
+    std::vector<ProfileBin> part_bins(n_parts * n_bins);
+    std::vector<double> part_peak_density(n_parts, 0), part_peak_position(n_parts, 0);
+
+    TaskGraph graph;
+    for (int k = 0; k < n_parts; k++) {
+        graph.add([&, k] {
+            int first = std::min(k * part_size, n);
+            int last = std::min(first + part_size, n);
+            sum_part(particles, first, last, part_totals[k], &part_bins[k * n_bins],
+                     part_peak_density[k], part_peak_position[k]);
+        });
+    }
+    executor.run(graph);
+
+    AnalysisResult result;
+    result.bins.resize(n_bins);
+
+    for (int k = 0; k < n_parts; k++) {
+        result.totals.mass += part_totals[k].mass;
+        result.totals.momentum += part_totals[k].momentum;
+        result.totals.kinetic_energy += part_totals[k].kinetic_energy;
+        result.totals.thermal_energy += part_totals[k].thermal_energy;
+
+        for (int b = 0; b < n_bins; b++) {
+            const ProfileBin &part_bin = part_bins[k * n_bins + b];
+            ProfileBin &bin = result.bins[b];
+            bin.count += part_bin.count;
+            bin.mass += part_bin.mass;
+            bin.momentum += part_bin.momentum;
+            bin.thermal_energy += part_bin.thermal_energy;
+            bin.density += part_bin.density;
+        }
+
+        if (part_peak_density[k] > result.peak_density) {
+            result.peak_density = part_peak_density[k];
+            result.peak_position = part_peak_position[k];
+        }
+    }
+
+    #ifdef USE_MPI
+    const int n_totals = sizeof(AnalysisTotals) / sizeof(double);
+    const int n_bin_values = n_bins * sizeof(ProfileBin) / sizeof(double);
+    MPI_Allreduce(MPI_IN_PLACE, &result.totals, n_totals, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, result.bins.data(), n_bin_values, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    // The peak position comes from whichever rank has the highest peak
+    struct { double density; int rank; } peak, global_peak;
+    MPI_Comm_rank(MPI_COMM_WORLD, &peak.rank);
+    peak.density = result.peak_density;
+    MPI_Allreduce(&peak, &global_peak, 1, MPI_DOUBLE_INT, MPI_MAXLOC, MPI_COMM_WORLD);
+
+    result.peak_density = global_peak.density;
+    MPI_Bcast(&result.peak_position, 1, MPI_DOUBLE, global_peak.rank, MPI_COMM_WORLD);
+    #endif
+
+    find_shocks(result);
+    return result;
+}
+
+void Analysis::sum_part(const Particle* particles, int first, int last, AnalysisTotals &totals,
+                        ProfileBin* bins, double &peak_density, double &peak_position) const {
+    for (int i = first; i < last; i++) {
+        const Particle &p = particles[i];
+        double pos = p.pos;
+        double vel = p.vel;
+
+        totals.mass += p.mass;
+        totals.momentum += p.mass * vel;
+        totals.kinetic_energy += 0.5 * p.mass * vel * vel;
+        totals.thermal_energy += p.mass * p.u;
+
+        // Particles exactly on (or, in a broken run, past) the boundaries go in the end bins
+        int b = std::clamp((int)std::floor((pos + limit) / bin_width), 0, n_bins - 1);
+        ProfileBin &bin = bins[b];
+        bin.count++;
+        bin.mass += p.mass;
+        bin.momentum += p.mass * vel;
+        bin.thermal_energy += p.mass * p.u;
+        bin.density += p.density;
+
+        if (p.density > peak_density) {
+            peak_density = p.density;
+            peak_position = pos;
+        }
+    }
+}
+
+void Analysis::sum_ordered(const Particle* particles, int n, AnalysisResult &result) const {
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [particles](int a, int b) {
+        return position_order(particles[a], particles[b]);
+    });
+
+    // Everything being summed, as in the MPI reduction of reduce(): the totals then the bins. Each
+    // has a running sum and the rounding error lost from it so far.
+    const int n_totals = sizeof(AnalysisTotals) / sizeof(double);
+    const int n_values = n_totals + n_bins * sizeof(ProfileBin) / sizeof(double);
+
+    // The sums and errors, then the peak density and its position
+    std::vector<double> state(2 * n_values + 2, 0);
+    double* sums = state.data();
+    double* errors = sums + n_values;
+    double &peak_density = state[2 * n_values];
+    double &peak_position = state[2 * n_values + 1];
+
+    #ifdef USE_MPI
+    // The slabs are in order of rank, so the ranks carry on from where the one before left off
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (rank > 0)
+        MPI_Recv(state.data(), state.size(), MPI_DOUBLE, rank - 1, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    #endif
+
+    auto add = [sums, errors](int k, double x) {
+        double t = sums[k] + x;
+        errors[k] += std::abs(sums[k]) >= std::abs(x) ? (sums[k] - t) + x : (x - t) + sums[k];
+        sums[k] = t;
+    };
+
+    for (int i : order) {
+        const Particle &p = particles[i];
+        double pos = p.pos;
+        double vel = p.vel;
+
+        add(0, p.mass);
+        add(1, p.mass * vel);
+        add(2, 0.5 * p.mass * vel * vel);
+        add(3, p.mass * p.u);
+
+        int b = std::clamp((int)std::floor((pos + limit) / bin_width), 0, n_bins - 1);
+        int bin = n_totals + b * sizeof(ProfileBin) / sizeof(double);
+        add(bin, 1);
+        add(bin + 1, p.mass);
+        add(bin + 2, p.mass * vel);
+        add(bin + 3, p.mass * p.u);
+        add(bin + 4, p.density);
+
+        if (p.density > peak_density) {
+            peak_density = p.density;
+            peak_position = pos;
+        }
+    }
+
+    #ifdef USE_MPI
+    if (rank + 1 < size)
+        MPI_Send(state.data(), state.size(), MPI_DOUBLE, rank + 1, 0, MPI_COMM_WORLD);
+    MPI_Bcast(state.data(), state.size(), MPI_DOUBLE, size - 1, MPI_COMM_WORLD);
+    #endif
+
+    result.bins.resize(n_bins);
+    double* totals = (double*)&result.totals;
+    double* bins = (double*)result.bins.data();
+    for (int k = 0; k < n_values; k++) {
+        double value = sums[k] + errors[k];
+        if (k < n_totals)
+            totals[k] = value;
+        else
+            bins[k - n_totals] = value;
+    }
+
+    result.peak_density = peak_density;
+    result.peak_position = peak_position;
+}
+
+void Analysis::find_shocks(AnalysisResult &result) const {
+    result.shock_left = NAN;
+    result.shock_right = NAN;
+
+    // Mean SPH density in each bin, which is already smoothed so is much less noisy than the mass
+    // in each bin when there are only a few particles per bin. Empty bins take the value of the
+    // last bin that wasn't, or the first one that isn't at the start, so that particles moving
+    // away from a boundary don't look like a jump up from 0.
+    std::vector<double> density(n_bins, 0);
+    double last_density = 0;
+    for (int b = n_bins - 1; b >= 0; b--) {
+        if (result.bins[b].count > 0)
+            last_density = result.bins[b].density / result.bins[b].count;
+    }
+
+    for (int b = 0; b < n_bins; b++) {
+        if (result.bins[b].count > 0)
+            last_density = result.bins[b].density / result.bins[b].count;
+        density[b] = last_density;
+    }
+
+    int peak_bin = std::clamp((int)std::floor((result.peak_position + limit) / bin_width), 0, n_bins - 1);
+    double min_jump = ANALYSIS_SHOCK_JUMP * result.peak_density;
+
+    // Steepest rise towards the peak from the left, i.e. the left-moving shock front
+    double max_jump = min_jump;
+    for (int b = 1; b <= peak_bin; b++) {
+        if (density[b] - density[b - 1] > max_jump) {
+            max_jump = density[b] - density[b - 1];
+            result.shock_left = -limit + b * bin_width;
+        }
+    }
+
+    // And falling away from it to the right
+    max_jump = min_jump;
+    for (int b = peak_bin + 1; b < n_bins; b++) {
+        if (density[b - 1] - density[b] > max_jump) {
+            max_jump = density[b - 1] - density[b];
+            result.shock_right = -limit + b * bin_width;
+        }
+    }
+}
+
+void Analysis::open(const std::string &dir) {
+    series_stream.open(dir + "/analysis.txt");
+    profile_stream.open(dir + "/profiles.txt");
+
+    if (!series_stream || !profile_stream) {
+        LOG_ERROR("Could not open the analysis files in " << dir << " for writing.");
+        exit(1);
+    }
+
+    series_stream << "# In-situ analysis of the alive particles" << std::endl;
+    series_stream << "# Column definitions:" << std::endl;
+    series_stream << "# Time / Mass / Momentum / Kinetic energy / Thermal energy / Total energy / Peak density / Peak density position / Left shock position / Right shock position" << std::endl;
+
+    profile_stream << "# Binned profiles of the alive particles, in blocks starting with '# t = ...' with a line per bin" << std::endl;
+    profile_stream << "# Column definitions:" << std::endl;
+    profile_stream << "# Bin centre / Particle count / Binned density (mass / bin width) / Mean SPH density / Velocity (mass-weighted) / Thermal energy (mass-weighted)" << std::endl;
+}
+
+void Analysis::write(const AnalysisResult &result, double time) {
+    const AnalysisTotals &totals = result.totals;
+    char buffer[512];
+
+    snprintf(buffer, sizeof(buffer),
+             "%.6f    %.8e    %+.8e    %.8e    %.8e    %.8e    %.6e    %+.6f    %+.6f    %+.6f\n",
+             time, totals.mass, totals.momentum, totals.kinetic_energy, totals.thermal_energy,
+             totals.kinetic_energy + totals.thermal_energy, result.peak_density,
+             result.peak_position, result.shock_left, result.shock_right);
+    series_stream << buffer << std::flush;
+
+    profile_stream << "# t = " << time << std::endl;
+    for (int b = 0; b < n_bins; b++) {
+        const ProfileBin &bin = result.bins[b];
+        // Means of empty bins are written as 0
+        double n = std::max(bin.count, 1.0);
+        double m = bin.mass > 0 ? bin.mass : 1;
+
+        snprintf(buffer, sizeof(buffer), "%+.6f    %6d    %.6e    %.6e    %+.6e    %.6e\n",
+                 -limit + (b + 0.5) * bin_width, (int)bin.count, bin.mass / bin_width,
+                 bin.density / n, bin.momentum / m, bin.thermal_energy / m);
+        profile_stream << buffer;
+    }
+    // Blank line between blocks, which is also what gnuplot expects
+    profile_stream << std::endl;
+}
@@ -0,0 +1,97 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * analysis.hpp defines the Analysis class, which reduces the particles down to the handful of
+ * quantities that are actually looked at after a run while the simulation is still going: binned
+ * profiles of density, velocity and thermal energy, totals of the conserved quantities, the peak
+ * density and the positions of the shock fronts. These are appended to two small text files in the
+ * output directory every analysis_interval steps, so the full dump files (which dominate the time
+ * spent writing output) can be written much less often, see dump_interval in config.txt.
+ *
+ *  - analysis.txt: one line per analysis, with the totals, peak density and shock positions
+ *  - profiles.txt: one block per analysis, with a line for each bin
+ */
+
+#ifndef analysis_hpp
+#define analysis_hpp
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "basictypes.hpp"
+#include "task_graph.hpp"
+
+// Sums over the alive particles in one bin of the profiles. Only doubles, so that an array of them
+// can be summed over MPI ranks as if it were an array of doubles.
+struct ProfileBin {
+    double count = 0;
+    double mass = 0;
+    double momentum = 0;
+    double thermal_energy = 0; // Sum of m * u
+    double density = 0; // Sum of the SPH densities, for the mean
+};
+
+// Sums over all of the alive particles. Only doubles, as above.
+struct AnalysisTotals {
+    double mass = 0;
+    double momentum = 0;
+    double kinetic_energy = 0;
+    double thermal_energy = 0;
+};
+
+struct AnalysisResult {
+    AnalysisTotals totals;
+    std::vector<ProfileBin> bins;
+
+    double peak_density = 0;
+    double peak_position = 0;
+
+    // Positions of the steepest rise in density on either side of the peak, or NAN if there isn't
+    // one big enough to count as a shock (see ANALYSIS_SHOCK_JUMP)
+    double shock_left;
+    double shock_right;
+};
+
+class Analysis {
+    public:
+        // ctor. The profiles have n_bins equal bins across [-limit, limit].
+        Analysis(const Config &config, int n_bins);
+
+        // Calculate the totals, profiles, peak and shock fronts of the first n particles, which
+        // should be the alive ones. The particles are split into parts which are summed in parallel
+        // on the executor, and then combined in order, so the result doesn't depend on the number of
+        // threads. With MPI, the result is combined over every rank, and every rank gets it.
+        // With deterministic set, the particles are summed one at a time in order of position
+        // instead (carrying on from one rank to the next), so it doesn't depend on the ranks either.
+        AnalysisResult reduce(const Particle* particles, int n, Executor &executor) const;
+
+        // Make analysis.txt and profiles.txt in dir (replacing any from an earlier run) and write
+        // their headers
+        void open(const std::string &dir);
+
+        // Append a result to the files made by open()
+        void write(const AnalysisResult &result, double time);
+
+    private:
+        double limit;
+        int n_bins;
+        double bin_width;
+        bool deterministic;
+
+        std::ofstream series_stream;
+        std::ofstream profile_stream;
+
+        // Sum particles [first, last) into the given totals and bins, and find their peak density
+        void sum_part(const Particle* particles, int first, int last, AnalysisTotals &totals,
+                      ProfileBin* bins, double &peak_density, double &peak_position) const;
+
+        // Sum the particles in order of position, with compensated (Neumaier) sums so that the
+        // rounding errors don't build up over a long run of them
+        void sum_ordered(const Particle* particles, int n, AnalysisResult &result) const;
+
+        // Find the shock fronts from the (combined) profiles
+        void find_shocks(AnalysisResult &result) const;
+};
+
+#endif
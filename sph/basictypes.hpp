@@ -8,9 +8,14 @@
 #ifndef basictypes_hpp // Include guard
 #define basictypes_hpp
 
+#include <atomic>
+#include <cmath>
+#include <cstdint>
 #include <memory>
 #include <iostream>
 
+#include "define.hpp"
+
 // ===== CONFIG =====
 
 enum PressureCalc {
@@ -18,6 +23,18 @@ enum PressureCalc {
     Adiabatic
 };
 
+enum DumpFormat {
+    TextDump,
+    CompressedDump,
+    FullPrecisionTextDump // Same columns as TextDump, with every digit needed to read the values back exactly
+};
+
+enum HugePages {
+    NoHugePages,
+    TransparentHugePages, // madvise(MADV_HUGEPAGE), which the kernel may or may not act on
+    ExplicitHugePages // mmap(MAP_HUGETLB), which needs pages reserved in /proc/sys/vm/nr_hugepages
+};
+
 struct Config {
     int n_part;
     double mass;
@@ -26,54 +43,133 @@ struct Config {
     double v_0;
     double h_factor;
     double t_i;
+    int n_threads; // Number of worker threads to use (0: one per hardware thread)
+    int log_level; // Lowest level of message to show (0: debug, 1: info, 2: warnings, 3: errors)
+    double h_activity_tol; // Relative neighbour displacement allowed before h is solved for again (0: always)
+    int density_sum_interval; // Number of steps between summing the densities (in between, integrated from drho/dt)
+    int dump_interval; // Number of steps between dump files (0: only the first and last)
+    DumpFormat dump_format;
+    int analysis_interval; // Number of steps between in-situ analyses (0: none)
+    int analysis_bins; // Number of bins in the analysis profiles
+    int live_interval; // Number of steps between frames of the live stream, if there is one
+    int profile; // Measure each phase of the timestep with hardware counters, see profiler.hpp (0: off)
+    int trace; // Record a timeline of each thread's work, see trace.hpp (0: off)
+    int trace_interval; // Number of steps between writing the recorded timeline to the trace file
+    int refine_interval; // Number of steps between splitting and merging particles, see refinement.hpp (0: off)
+    double refine_threshold; // Resolution indicator above which particles are split
+    int refine_max_level; // Number of times a particle can be split in half
+    int deterministic; // Sum in an order that doesn't depend on the MPI ranks, see neighbour_list.hpp (0: off)
+    int huge_pages; // Back the particle array with huge pages, see particle_array.hpp (HugePages)
+    int pin_threads; // Pin worker threads to cores, see task_graph.hpp (ThreadPinning)
+    int out_of_core_window; // Number of particles in each window of the out-of-core mode, see out_of_core.hpp
     // Runtime properties; not set from ConfigReader
     int n_ghost; // Number of ghost particles
+    int n_halo; // Number of halo particles (copies of particles owned by other MPI ranks)
+    int n_alloc; // Number of particles there is room for in the particle array
 };
 
+// ===== PRECISION =====
+
+#ifdef USE_MIXED_PRECISION
+// Position stored as the index of a bin of width POSITION_BIN_WIDTH plus a float offset from the
+// centre of the bin, which is much more precise than a float of the whole position (the offset is
+// always small), while taking the same space as a double. Behaves like a double everywhere else: it
+// converts to one when read, and can be assigned or added to from one.
+struct BinnedPosition {
+    int32_t bin;
+    float offset;
+
+    BinnedPosition() = default;
+    BinnedPosition(double x) { *this = x; }
+
+    operator double() const {
+        return bin * POSITION_BIN_WIDTH + (double)offset;
+    }
+
+    BinnedPosition& operator =(double x) {
+        // Nearest bin rather than floor, so that tiny positions keep their sign (the setup gives
+        // particles either side of 0 opposite velocities)
+        double b = std::round(x / POSITION_BIN_WIDTH);
+        bin = (int32_t)b;
+        offset = (float)(x - b * POSITION_BIN_WIDTH);
+        return *this;
+    }
+
+    // Done in double and then split up again, rather than added to the offset, so that the
+    // particle can move into another bin
+    BinnedPosition& operator +=(double dx) {
+        return *this = (double)*this + dx;
+    }
+};
+
+// Type that particle properties are stored as. Sums over neighbours are still done in double.
+typedef float real_t;
+typedef BinnedPosition position_t;
+#else
+typedef double real_t;
+typedef double position_t;
+#endif
+
 // ===== PARTICLES ===== 
 
 enum ParticleType {
     Alive,
-    Ghost
+    Ghost,
+    Halo
 };
 
 // Used to display particle type as a string, rather than number, in dump files
-const char* const ParticleTypeNames[2] = {
+const char* const ParticleTypeNames[3] = {
     "Alive",
-    "Ghost"
+    "Ghost",
+    "Halo"
 };
 
-// 'global' particle counter, so creator of Particle doesn't have to keep track
-static int _particle_counter = 0;
+// 'global' particle counter, so creator of Particle doesn't have to keep track. Atomic, since
+// several simulations can be setting up particle arrays at once in ensemble mode.
+static std::atomic<int> _particle_counter(0);
 
 struct Particle {
     const int id; // Unique numerical identifier
-    double mass; // Should be const, but can't be if not given in constructor :(
+    real_t mass; // Should be const, but can't be if not given in constructor :(
 
-    double pos;
-    double vel;
-    double acc;
+    position_t pos;
+    real_t vel;
+    real_t acc;
 
-    double h; // Smoothing length
+    real_t h; // Smoothing length
 
-    double du_dt; // Thermal energy derivative w.r.t time
-    double u; // Thermal energy
-    double density;
-    double pressure;
+    real_t du_dt; // Thermal energy derivative w.r.t time
+    real_t u; // Thermal energy
+    real_t density;
+    real_t pressure;
+    real_t omega; // Variable smoothing length correction term, calculated along with the density
+    real_t drho_dt; // Density derivative w.r.t. time (continuity equation), calculated along with the forces
 
     ParticleType type;
 
+    // Activity tracking (see DensityCalculator): the number of neighbours inside the kernel when h
+    // was last solved for (0 if it never has been), the derivative of the density sum w.r.t. h at
+    // that point, and the displacement of the neighbours relative to this particle since then
+    int n_solve_neighbours;
+    real_t drho_dh;
+    real_t activity;
+
     // Full initializer for unit tests
     Particle(double pos, double vel, double mass)
-        : id(_particle_counter), mass(mass), pos(pos), vel(vel), acc(0), u(0), density(0), pressure(0), type(Alive)
+        : id(_particle_counter++), mass(mass), pos(pos), vel(vel), acc(0), u(0), density(0), pressure(0), omega(1), drho_dt(0),
+          type(Alive), n_solve_neighbours(0), drho_dh(0), activity(0)
     {
-        _particle_counter++;
     }
 
     // Default initializer for creating arrays
-    Particle() : id(_particle_counter), type(Alive)
+    Particle() : id(_particle_counter++), drho_dt(0), type(Alive), n_solve_neighbours(0), drho_dh(0), activity(0)
+    {
+    }
+
+    // Initializer for arrays that are constructed in parallel, which take a block of ids up front
+    explicit Particle(int id) : id(id), drho_dt(0), type(Alive), n_solve_neighbours(0), drho_dh(0), activity(0)
     {
-        _particle_counter++;
     }
     
     // Assignment operator
@@ -88,7 +184,12 @@ struct Particle {
         du_dt = p.du_dt;
         density = p.density;
         pressure = p.pressure;
+        omega = p.omega;
+        drho_dt = p.drho_dt;
         type = p.type;
+        n_solve_neighbours = p.n_solve_neighbours;
+        drho_dh = p.drho_dh;
+        activity = p.activity;
 
         return *this;
     }
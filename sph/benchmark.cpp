@@ -0,0 +1,318 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * benchmark.cpp implements the Benchmark class from benchmark.hpp.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <sys/resource.h>
+
+#include "benchmark.hpp"
+#include "define.hpp"
+#include "particle_array.hpp"
+#include "setup.hpp"
+#include "sph_simulation.hpp"
+#include "log.hpp"
+
+#ifdef USE_MPI
+#error "The benchmarks sweep thread counts in one process, and can't be combined with MPI"
+#endif
+
+// The canned setup: the same domain, velocities and total mass as config.txt
+static const double BENCHMARK_LIMIT = 2;
+static const double BENCHMARK_V_0 = 1;
+static const double BENCHMARK_H_FACTOR = 2;
+static const double BENCHMARK_TOTAL_MASS = 0.04 * 101;
+
+static const char* const SetupNames[2] = {
+    "isothermal",
+    "adiabatic"
+};
+
+static const char* const ScalingNames[2] = {
+    "strong",
+    "weak"
+};
+
+static const char* const ReductionNames[2] = {
+    "fast",
+    "deterministic"
+};
+
+#pragma region PeakMemory
+
+// Reset the peak resident set size of the process, so that it can be measured for each case. Needs
+// Linux 4.0 or later; returns false if it isn't possible.
+static bool reset_peak_rss() {
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    clear_refs.flush();
+    return clear_refs.good();
+}
+
+// Peak resident set size of the process (since the last reset_peak_rss), in bytes
+static uint64_t peak_rss() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+
+    while (std::getline(status, line)) {
+        // e.g. "VmHWM:    123456 kB"
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::stoull(line.substr(6)) * 1024;
+    }
+
+    // Not Linux: peak over the whole program, which can't be reset
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    #ifdef __APPLE__
+    return usage.ru_maxrss;
+    #else
+    return (uint64_t)usage.ru_maxrss * 1024;
+    #endif
+}
+
+#pragma endregion
+
+Benchmark::Benchmark(BenchmarkOptions options) : options(options) {
+    if (this->options.threads.empty()) {
+        int n_hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (int t = 1; t < n_hardware; t *= 2)
+            this->options.threads.push_back(t);
+        this->options.threads.push_back(n_hardware);
+    }
+
+    per_case_rss = reset_peak_rss();
+    if (!per_case_rss)
+        LOG_WARN("Can't reset the peak memory use between cases, so each case will report the "
+                 << "peak of the whole benchmark so far.");
+}
+
+// Format a value for a ConfigMap without losing precision (std::to_string only keeps 6 decimal
+// places, which isn't enough for the mass or timestep with millions of particles)
+static std::string config_value(double value) {
+    std::ostringstream s;
+    s.precision(17);
+    s << value;
+    return s.str();
+}
+
+Config Benchmark::make_config(PressureCalc setup, int n_part) {
+    // Built as if it was read from a config file, so that everything else has its usual default
+    double spacing = 2 * BENCHMARK_LIMIT / (n_part - 1);
+
+    ConfigMap config_map = {
+        { "n_part", std::to_string(n_part) },
+        { "mass", config_value(BENCHMARK_TOTAL_MASS / n_part) },
+        { "pressure_calc", std::to_string((int)setup) },
+        { "limit", config_value(BENCHMARK_LIMIT) },
+        { "v_0", config_value(BENCHMARK_V_0) },
+        { "h_factor", config_value(BENCHMARK_H_FACTOR) },
+        // The timestep has to shrink with the smoothing length to stay stable
+        { "t_i", config_value(BENCHMARK_COURANT * BENCHMARK_H_FACTOR * spacing) },
+        { "profile", "1" }
+    };
+
+    return ConfigReader(config_map).GetConfig();
+}
+
+void Benchmark::run() {
+    // Setting up the particles is serial and the same for any number of threads, so for strong
+    // scaling it is only done once per size
+    struct Case {
+        BenchmarkScaling scaling;
+        int n_part;
+        std::vector<int> threads;
+    };
+
+    std::vector<Case> cases;
+    for (BenchmarkScaling scaling : options.scalings) {
+        for (int size : options.sizes) {
+            if (scaling == StrongScaling) {
+                cases.push_back({ scaling, size, options.threads });
+            } else {
+                for (int t : options.threads)
+                    cases.push_back({ scaling, size * t, { t } });
+            }
+        }
+    }
+
+    for (PressureCalc setup : options.setups) {
+        for (const Case &c : cases) {
+            Config config = make_config(setup, c.n_part);
+            auto start = std::chrono::steady_clock::now();
+
+            ParticleArrayPtr initial = allocate_particles(config.n_part);
+            config.n_alloc = config.n_part;
+            init_particles(config, initial);
+
+            std::chrono::duration<double> setup_time = std::chrono::steady_clock::now() - start;
+
+            for (int t : c.threads) {
+                // Result of the same case with fast reductions, to compare the deterministic one to
+                int fast = -1;
+
+                for (BenchmarkReductions reductions : options.reductions) {
+                    // The peak of each run, which includes the set up particles it is copied from
+                    if (per_case_rss)
+                        reset_peak_rss();
+
+                    BenchmarkResult result = run_case(config, initial, c.scaling, reductions, t);
+                    result.setup_seconds = setup_time.count();
+
+                    std::ostringstream overhead;
+                    if (reductions == FastReductions) {
+                        fast = results.size();
+                    } else if (fast >= 0) {
+                        result.fast_run_seconds = results[fast].run_seconds;
+                        overhead << " (" << 100 * (result.run_seconds / result.fast_run_seconds - 1)
+                                 << "% slower than fast)";
+                    }
+                    results.push_back(result);
+
+                    LOG_INFO("Benchmark " << SetupNames[setup] << " / " << ScalingNames[c.scaling]
+                             << " / " << ReductionNames[reductions] << ": " << result.n_part
+                             << " particles on " << t << " threads, "
+                             << result.particle_steps_per_second << " particle-steps/s"
+                             << overhead.str());
+                }
+            }
+        }
+    }
+}
+
+BenchmarkResult Benchmark::run_case(const Config &config, const ParticleArrayPtr &initial,
+                                    BenchmarkScaling scaling, BenchmarkReductions reductions,
+                                    int n_threads) {
+    Config c = config;
+    c.n_threads = n_threads;
+    c.deterministic = reductions == DeterministicReductions;
+
+    // The simulation changes its particles, so each run starts from a fresh copy
+    ParticleArrayPtr p_arr = allocate_particles(c.n_alloc);
+    std::copy(initial.get(), initial.get() + c.n_part, p_arr.get());
+
+    BenchmarkResult result;
+    result.setup = c.pressure_calc;
+    result.scaling = scaling;
+    result.reductions = reductions;
+    result.n_part = c.n_part - c.n_ghost;
+    result.n_threads = n_threads;
+
+    SPHSimulation sim(c, p_arr);
+    sim.set_show_progress(false);
+    sim.set_write_output(false);
+
+    auto start = std::chrono::steady_clock::now();
+    sim.start(options.n_steps * c.t_i);
+    std::chrono::duration<double> run_time = std::chrono::steady_clock::now() - start;
+
+    result.n_steps = sim.steps_taken();
+    result.run_seconds = run_time.count();
+    result.particle_steps_per_second = (double)result.n_part * result.n_steps / result.run_seconds;
+    result.fast_run_seconds = 0;
+    result.peak_rss = peak_rss();
+
+    for (int phase = 0; phase < N_PROFILE_PHASES; phase++)
+        result.phases[phase] = sim.get_profiler().phase_totals((ProfilePhase)phase);
+
+    return result;
+}
+
+// Names as JSON keys, e.g. "L1 misses" -> "l1_misses"
+static std::string json_key(std::string name) {
+    for (char &ch : name)
+        ch = ch == ' ' ? '_' : std::tolower(ch);
+    return name;
+}
+
+void Benchmark::write_json(std::ostream &out) const {
+    // Written by hand, as it's simple enough not to need a JSON library
+    auto list = [](const std::vector<int> &values) {
+        std::ostringstream s;
+        for (size_t i = 0; i < values.size(); i++)
+            s << (i ? ", " : "") << values[i];
+        return "[" + s.str() + "]";
+    };
+
+    // Labels are given on the command line, so could contain anything
+    std::string label;
+    for (char ch : options.label) {
+        if (ch == '"' || ch == '\\')
+            label += '\\';
+        if ((unsigned char)ch >= 0x20)
+            label += ch;
+    }
+
+    std::time_t now = std::time(nullptr);
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out.precision(6);
+    out << "{\n";
+    out << "  \"label\": \"" << label << "\",\n";
+    out << "  \"date\": \"" << date << "\",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    #ifdef USE_MIXED_PRECISION
+    out << "  \"precision\": \"mixed\",\n";
+    #else
+    out << "  \"precision\": \"double\",\n";
+    #endif
+    out << "  \"steps\": " << options.n_steps << ",\n";
+    out << "  \"sizes\": " << list(options.sizes) << ",\n";
+    out << "  \"threads\": " << list(options.threads) << ",\n";
+    out << "  \"per_case_peak_rss\": " << (per_case_rss ? "true" : "false") << ",\n";
+    out << "  \"results\": [";
+
+    for (size_t r = 0; r < results.size(); r++) {
+        const BenchmarkResult &result = results[r];
+
+        out << (r ? "," : "") << "\n    {\n";
+        out << "      \"setup\": \"" << SetupNames[result.setup] << "\",\n";
+        out << "      \"scaling\": \"" << ScalingNames[result.scaling] << "\",\n";
+        out << "      \"reductions\": \"" << ReductionNames[result.reductions] << "\",\n";
+        out << "      \"n_part\": " << result.n_part << ",\n";
+        out << "      \"threads\": " << result.n_threads << ",\n";
+        out << "      \"steps\": " << result.n_steps << ",\n";
+        out << "      \"setup_seconds\": " << result.setup_seconds << ",\n";
+        out << "      \"run_seconds\": " << result.run_seconds << ",\n";
+        out << "      \"particle_steps_per_second\": " << result.particle_steps_per_second << ",\n";
+        out << "      \"deterministic_overhead\": ";
+        if (result.fast_run_seconds > 0)
+            out << result.run_seconds / result.fast_run_seconds - 1;
+        else
+            out << "null";
+        out << ",\n";
+        out << "      \"peak_rss_bytes\": " << result.peak_rss << ",\n";
+        out << "      \"phases\": {";
+
+        for (int phase = 0; phase < N_PROFILE_PHASES; phase++) {
+            const PhaseCounts &p = result.phases[phase];
+
+            out << (phase ? "," : "") << "\n        \"" << json_key(PhaseProfiler::phase_name((ProfilePhase)phase)) << "\": {";
+            out << "\"seconds\": " << p.seconds << ", \"particles\": " << p.n_particles
+                << ", \"pairs\": " << p.n_pairs;
+
+            // null rather than 0 for counters that weren't counted
+            for (int c = 0; c < N_PERF_COUNTERS; c++) {
+                std::string name = json_key(PhaseProfiler::counter_name((PerfCounter)c));
+                out << ", \"" << name << "\": ";
+                if (PhaseProfiler::counter_available((PerfCounter)c))
+                    out << p.counts[c];
+                else
+                    out << "null";
+            }
+            out << "}";
+        }
+
+        out << "\n      }\n    }";
+    }
+
+    out << "\n  ]\n}\n";
+}
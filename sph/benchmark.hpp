@@ -0,0 +1,102 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * benchmark.hpp defines the Benchmark class, which times whole simulations (rather than single
+ * functions) in a reproducible way, so that the performance of different commits can be compared.
+ * It is built as its own program with `make benchmark`; see benchmark_main.cpp for the options.
+ *
+ * The configs are built in the program rather than read from a file, so a benchmark always means
+ * the same thing: the two colliding streams from init_particles, isothermal or adiabatic, with the
+ * same total mass and domain as config.txt and a timestep proportional to the particle spacing. Each
+ * case is run for a fixed number of steps with no output, over a sweep of thread counts:
+ *
+ *  - strong scaling: the same number of particles on each number of threads
+ *  - weak scaling: the same number of particles per thread
+ *
+ * and with both fast and deterministic reductions (deterministic in config.txt), to measure what
+ * the bitwise reproducibility of deterministic mode costs.
+ *
+ * For each case the throughput (particle-steps per second), the time and counters of each phase of
+ * the timestep (see profiler.hpp) and the peak memory use are written to a JSON file, along with
+ * the overhead of the deterministic cases over the same case with fast reductions.
+ */
+
+#ifndef benchmark_hpp
+#define benchmark_hpp
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "basictypes.hpp"
+#include "profiler.hpp"
+
+enum BenchmarkScaling {
+    StrongScaling,
+    WeakScaling
+};
+
+enum BenchmarkReductions {
+    FastReductions,
+    DeterministicReductions
+};
+
+struct BenchmarkOptions {
+    std::vector<PressureCalc> setups = { Isothermal, Adiabatic };
+    std::vector<BenchmarkScaling> scalings = { StrongScaling, WeakScaling };
+    std::vector<BenchmarkReductions> reductions = { FastReductions, DeterministicReductions };
+    // Number of particles for strong scaling, and per thread for weak scaling
+    std::vector<int> sizes = { 1000, 10000, 100000, 1000000 };
+    // Empty: powers of two up to the number of hardware threads
+    std::vector<int> threads;
+    int n_steps = BENCHMARK_STEPS;
+    // Written to the JSON to say what was benchmarked, e.g. a commit hash
+    std::string label;
+};
+
+struct BenchmarkResult {
+    PressureCalc setup;
+    BenchmarkScaling scaling;
+    BenchmarkReductions reductions;
+    int n_part; // Alive particles
+    int n_threads;
+    int n_steps;
+    double setup_seconds; // Setting up the particles (serial); not included in the throughput
+    double run_seconds;
+    double particle_steps_per_second;
+    // run_seconds of the same case with fast reductions, to give the overhead of deterministic
+    // mode. 0 if this is a fast case, or the fast case wasn't run.
+    double fast_run_seconds;
+    uint64_t peak_rss; // Bytes
+    PhaseCounts phases[N_PROFILE_PHASES];
+};
+
+class Benchmark {
+    public:
+        explicit Benchmark(BenchmarkOptions options);
+
+        // Run every case, logging each result as it finishes
+        void run();
+
+        // Write the options and results as JSON
+        void write_json(std::ostream &out) const;
+
+    private:
+        BenchmarkOptions options;
+        std::vector<BenchmarkResult> results;
+
+        // Whether the peak memory use can be reset between cases. If not, the peak of each case is
+        // the peak of the whole program so far.
+        bool per_case_rss;
+
+        // Config of the canned two stream setup with n_part particles
+        static Config make_config(PressureCalc setup, int n_part);
+
+        // Run a simulation from a copy of the given (already set up) particles
+        BenchmarkResult run_case(const Config &config, const ParticleArrayPtr &initial,
+                                 BenchmarkScaling scaling, BenchmarkReductions reductions,
+                                 int n_threads);
+};
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * benchmark_main.cpp contains the entrypoint for the benchmarks (built with `make benchmark`), which
+ * run the canned setups from benchmark.hpp and write the results to a JSON file. Unlike the main
+ * program, everything is given on the command line, since the point is that there is nothing to
+ * configure beyond what to sweep over:
+ *
+ *   ./sph_benchmark [--setup isothermal|adiabatic|all] [--scaling strong|weak|all]
+ *                   [--reductions fast|deterministic|all] [--sizes 1000,10000,...]
+ *                   [--threads 1,2,4,...] [--steps N] [--label TEXT] [--output FILE]
+ *
+ * e.g. ./sph_benchmark --sizes 1000,10000,100000,1000000,10000000 --label $(git rev-parse --short HEAD)
+ *
+ * The defaults are both setups, both scalings, both kinds of reductions, 10^3 to 10^6 particles,
+ * powers of two threads up to the number of hardware threads, BENCHMARK_STEPS steps and
+ * ./benchmark.json.
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "log.hpp"
+
+// Parse a comma-separated list of positive integers. Returns false if it isn't one.
+static bool parse_list(const std::string &list, std::vector<int> &values) {
+    values.clear();
+    size_t start = 0;
+
+    while (start <= list.length()) {
+        size_t end = std::min(list.find(',', start), list.length());
+
+        try {
+            size_t n_read;
+            int value = std::stoi(list.substr(start, end - start), &n_read);
+            if (value < 1 || n_read != end - start)
+                return false;
+            values.push_back(value);
+        } catch (const std::exception &e) {
+            return false;
+        }
+
+        start = end + 1;
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkOptions options;
+    std::string output_file = "benchmark.json";
+
+    // Options all take a value
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            LOG_ERROR("No value given for " << option << ".");
+            return 1;
+        }
+        std::string value = argv[++i];
+        bool valid = true;
+
+        if (option == "--setup") {
+            if (value == "isothermal")
+                options.setups = { Isothermal };
+            else if (value == "adiabatic")
+                options.setups = { Adiabatic };
+            else
+                valid = value == "all";
+        } else if (option == "--scaling") {
+            if (value == "strong")
+                options.scalings = { StrongScaling };
+            else if (value == "weak")
+                options.scalings = { WeakScaling };
+            else
+                valid = value == "all";
+        } else if (option == "--reductions") {
+            if (value == "fast")
+                options.reductions = { FastReductions };
+            else if (value == "deterministic")
+                options.reductions = { DeterministicReductions };
+            else
+                valid = value == "all";
+        } else if (option == "--sizes") {
+            // The particles are on a lattice between the boundaries, so there need to be at least 2
+            valid = parse_list(value, options.sizes);
+            for (int size : options.sizes)
+                valid = valid && size >= 2;
+        } else if (option == "--threads") {
+            valid = parse_list(value, options.threads);
+        } else if (option == "--steps") {
+            std::vector<int> steps;
+            valid = parse_list(value, steps) && steps.size() == 1;
+            if (valid)
+                options.n_steps = steps[0];
+        } else if (option == "--label") {
+            options.label = value;
+        } else if (option == "--output") {
+            output_file = value;
+        } else {
+            LOG_ERROR("Unknown option " << option << ".");
+            return 1;
+        }
+
+        if (!valid) {
+            LOG_ERROR("Invalid value '" << value << "' for " << option << ".");
+            return 1;
+        }
+    }
+
+    // Opened first, so that a bad filename doesn't waste the whole run
+    std::ofstream out(output_file);
+    if (!out) {
+        LOG_ERROR("Could not open " << output_file << " to write the results to.");
+        return 1;
+    }
+
+    Benchmark benchmark(options);
+    benchmark.run();
+    benchmark.write_json(out);
+
+    LOG_INFO("Wrote the results to " << output_file);
+    return 0;
+}
@@ -7,12 +7,13 @@
 
 #include <cmath>
 #include <exception>
-#include <iostream>
 
 #include "define.hpp"
 #include "calculators.hpp"
 #include "kernel.hpp"
 #include "smoothing_length.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
 
 double Calculator::grad_W(const Particle &p_i, const Particle &p_j, double h) {
     double r_ij = p_i.pos - p_j.pos;
@@ -31,26 +32,88 @@ double Calculator::grad_W(const Particle &p_i, const Particle &p_j, double h) {
 #ifdef USE_VARIABLE_H
 // Variable smoothing length implementation
 void DensityCalculator::operator()(Particle &p) {
-    double h = rootfind_h(p, p_arr, config);
-
-    // This used to happen sometimes before I changed the algorithm to be more sensible,
-    // but I don't see any reason to remove it!
-    if (h < 0) {
-        std::cerr << "[ERROR] Smoothing length root-finding for particle id: " << p.id
-                  << " returned negative smoothing length: " << h << std::endl;
-        throw new std::logic_error("Root-finding returned negative smoothing length");
+    int i = index_of(p);
+
+    if (config.h_activity_tol > 0 && update_quiescent(p, i)) {
+        solver_counters().quiescent.add(1);
+        return;
+    }
+
+    double h = rootfind_h(p, p_arr, config, nlist->neighbours(i));
+
+    // The smoothing length can change by more than the neighbour list skin allows for (mostly
+    // during setup), in which case the density sums were missing neighbours. Rebuild the lists
+    // around the new smoothing length and solve again, using the new h as the initial guess.
+    while (rebuild_lists && !nlist->covers(i, h)) {
+        p.h = h;
+        nlist->build(p_arr, config);
+        h = rootfind_h(p, p_arr, config, nlist->neighbours(i));
     }
 
+    if (!nlist->covers(i, h))
+        h = nlist->max_h(i);
+
+    // A negative h used to be checked for here, from before I changed the algorithm to be more
+    // sensible. The checked build still catches it, see validation.hpp.
+
     p.h = h;
-    p.density = calc_density(p, p.h, p_arr.get(), config.n_part);
+    p.density = calc_density(p, p.h, p_arr.get(), nlist->neighbours(i));
+    // Needs the final h and density. Stored, rather than calculated when needed, as the acceleration
+    // needs it for every neighbour, and halo particles don't have their own neighbours available.
+    if (config.h_activity_tol > 0) {
+        // Keep what update_quiescent needs to carry this solution forward
+        int n_inside;
+        double max_dv;
+        calc_density_activity(p, p_arr.get(), nlist->neighbours(i), n_inside, max_dv);
+
+        p.drho_dh = calc_density_dh(p, p.h, p_arr.get(), nlist->neighbours(i));
+        p.omega = calc_omega(p, p.drho_dh);
+        p.n_solve_neighbours = n_inside;
+        p.activity = 0;
+    } else {
+        p.omega = calc_omega(p, p_arr, nlist->neighbours(i));
+    }
+}
+
+bool DensityCalculator::update_quiescent(Particle &p, int i) {
+    // Never been solved for, e.g. during setup
+    if (p.n_solve_neighbours == 0)
+        return false;
+
+    int n_inside;
+    double max_dv;
+    double density_sum = calc_density_activity(p, p_arr.get(), nlist->neighbours(i), n_inside, max_dv);
+
+    // Bound on how far any neighbour has moved relative to p since h was last solved for
+    double activity = p.activity + max_dv * config.t_i;
+    if (n_inside != p.n_solve_neighbours || activity > config.h_activity_tol * p.h)
+        return false;
+
+    // h is still close to the root, so a single Newton step from it (Price 2018 eqs. 9 and 12),
+    // using the derivative stored at the last solve rather than summing it again, is enough
+    double density_exp = p.mass * config.h_factor / p.h;
+    double f = density_sum - density_exp;
+    double df = p.drho_dh + density_exp / p.h;
+    double h = p.h - f / df;
+
+    if (!(h > 0) || !nlist->covers(i, h))
+        return false;
+
+    // First order correction of the summation to the new h
+    p.density = density_sum + p.drho_dh * (h - p.h);
+    p.h = h;
+    p.omega = calc_omega(p, p.drho_dh);
+    p.activity = activity;
+    return true;
 }
 #endif
 
 #ifndef USE_VARIABLE_H
 // Simplified density calculation method; does not call into root-finding
 void DensityCalculator::operator()(Particle &p) {
-    double d_sum = calc_density(p, p.h, p_arr.get(), config.n_part);
+    double d_sum = calc_density(p, p.h, p_arr.get(), nlist->neighbours(index_of(p)));
     p.density = d_sum;
+    p.omega = 1;
 }
 #endif
 
@@ -58,45 +121,32 @@ void DensityCalculator::operator()(Particle &p) {
 #pragma region AccelerationCalculator
 
 // Version of acceleration calculation that accounts for variable smoothing length, by adding in
-// 'omega terms' (Rosswog eqns. 118-121). If USE_VARIABLE_H isn't defined then calc_omega() just
-// returns 1, simplifying it to the standard SPH expression.
+// 'omega terms' (Rosswog eqns. 118-121), which are stored on each particle by DensityCalculator.
+// If USE_VARIABLE_H isn't defined then omega is just 1, simplifying it to the standard SPH
+// expression.
 void AccelerationCalculator::operator()(Particle &p_i) {
     if (p_i.type == Ghost)
         return;
 
     // I have tried to use variable names that correspond to how this equation is typeset in the
     // Bate thesis. Pr = pressure, p = particle, rho = density, W = weight function
-    double c_s;
-    double Pr_i;
+    double c_s = update_pressure(p_i);
+    double Pr_i = p_i.pressure;
 
-    // Annoyingly, in the isothermal case pressure is dependent on sound speed, but in the adiabatic
-    // case, sound speed is dependent on pressure. So the order switches based on which one is used.
-    if (config.pressure_calc == Isothermal) {
-        c_s = sound_speed(p_i);
-        Pr_i = pressure_isothermal(p_i, c_s);
-    } else if (config.pressure_calc == Adiabatic) {
-        Pr_i = pressure_adiabatic(p_i);
-        c_s = sound_speed(p_i);
-    } else {
-        throw std::logic_error("Unknown pressure calculation mode!");
-    }
-
-    // Keep track of pressures as they can be used to verify the analytical solution
-    p_i.pressure = Pr_i;
-
-    double omega_i = calc_omega(p_i, p_arr, config);
-    double Pr_rho_i = Pr_i / std::pow(p_i.density, 2) / omega_i;
+    int i = index_of(p_i);
+    double Pr_rho_i = Pr_i / std::pow(p_i.density, 2) / p_i.omega;
 
     double acc = 0;
 
-    // Density = 0 will cause div by zero and screw everything up. Should never really happen
-    ensure_nonzero_density(p_i);
+    // Density = 0 would cause a division by zero and screw everything up. It should never happen,
+    // so rather than checking every neighbour here, the checked build sweeps the densities once
+    // they have all been calculated, see validation.hpp.
+    bool isothermal = config.pressure_calc == Isothermal;
 
-    for (int i = 0; i < config.n_part; i++) {
-        Particle &p_j = p_arr[i];
+    for (int j : nlist->neighbours(i)) {
+        Particle &p_j = p_arr[j];
 
-        if (p_j != p_i) {
-            ensure_nonzero_density(p_j);
+        if (j != i) {
             double r_ij = p_i.pos - p_j.pos;
             double h_ij = (p_i.h + p_j.h) / 2;
 
@@ -106,16 +156,10 @@ void AccelerationCalculator::operator()(Particle &p_i) {
             // Symmetrized smoothing length
             double grad_W_ij = grad_W(p_i, p_j, h_ij);
 
-            double Pr_j;
-            if (config.pressure_calc == Isothermal)
-                Pr_j = pressure_isothermal(p_j, c_s);
-            else if (config.pressure_calc == Adiabatic)
-                Pr_j = pressure_adiabatic(p_j);
-            else
-                throw std::logic_error("Unknown pressure calculation mode!");
+            // The mode has already been checked for p_i
+            double Pr_j = isothermal ? pressure_isothermal(p_j, c_s) : pressure_adiabatic(p_j);
 
-            double omega_j = calc_omega(p_j, p_arr, config);
-            double Pr_rho_j = Pr_j / std::pow(p_j.density, 2) / omega_j;
+            double Pr_rho_j = Pr_j / std::pow(p_j.density, 2) / p_j.omega;
 
             double visc_ij = artificial_viscosity(p_i, p_j, r_ij, h_ij, c_s);
 
@@ -128,6 +172,23 @@ void AccelerationCalculator::operator()(Particle &p_i) {
     p_i.acc = acc;
 }
 
+double AccelerationCalculator::update_pressure(Particle &p) {
+    // Annoyingly, in the isothermal case pressure is dependent on sound speed, but in the adiabatic
+    // case, sound speed is dependent on pressure. So the order switches based on which one is used.
+    if (config.pressure_calc == Isothermal) {
+        double c_s = sound_speed(p);
+        // Keep track of pressures as they can be used to verify the analytical solution
+        p.pressure = pressure_isothermal(p, c_s);
+        return c_s;
+    } else if (config.pressure_calc == Adiabatic) {
+        // Stored first, as the sound speed is taken from the pressure on the particle
+        p.pressure = pressure_adiabatic(p);
+        return sound_speed(p);
+    } else {
+        throw std::logic_error("Unknown pressure calculation mode!");
+    }
+}
+
 double AccelerationCalculator::pressure_isothermal(const Particle &p, double c_s) {
     return std::pow(c_s, 2) * p.density;
 }
@@ -136,7 +197,7 @@ double AccelerationCalculator::pressure_adiabatic(const Particle &p) {
     return (GAMMA - 1) * p.u * p.density;
 }
 
-double AccelerationCalculator::sound_speed(Particle p) {
+double AccelerationCalculator::sound_speed(const Particle &p) {
     if (config.pressure_calc == Isothermal)
         return 1;
     else if (config.pressure_calc == Adiabatic)
@@ -171,32 +232,18 @@ double AccelerationCalculator::artificial_viscosity(
     return result;
 }
 
-void AccelerationCalculator::ensure_nonzero_density(const Particle &p) {
-    // This method is something of an artefact from when I was forgetting to include self-density,
-    // and a particle without neighbours would have zero density and start introducing NaNs into
-    // the data. That said, it's been helpful to keep around even if zero density can never 
-    // occur in theory, because it does a good job of catching memory errors -- an uninitialized
-    // particle's position double is often something like 2.41255152E-315 which trips this detection
-    if (p.density < CALC_EPSILON) {
-        std::cerr << "[ERROR] Particle had density less than epsilon " << CALC_EPSILON << std::endl;
-        std::cerr << "[ERROR] Particle id: " << p.id << " has density: " << p.density << std::endl;
-
-        throw new std::logic_error("Particle had density less than epsilon!");
-    }
-}
-
 #pragma endregion
 
 #pragma region EnergyCalculator
 
 void EnergyCalculator::operator()(Particle &p) {
     // Bate eq. 2.37, with omega parameters shoved in...probably not correct
-    double omega = calc_omega(p, p_arr, config);
-    double Pr_rho = p.pressure / (omega * std::pow(p.density, 2));
+    int i = index_of(p);
+    double Pr_rho = p.pressure / (p.omega * std::pow(p.density, 2));
 
     double sum = 0;
-    for (int i = 0; i < config.n_part; i++) {
-        Particle p_j = p_arr[i];
+    for (int j : nlist->neighbours(i)) {
+        const Particle &p_j = p_arr[j];
 
         double r_ij = p.pos - p_j.pos;
         double v_ij = p.vel - p_j.vel;
@@ -212,4 +259,53 @@ void EnergyCalculator::operator()(Particle &p) {
     p.du_dt = sum;
 }
 
-#pragma endregion
\ No newline at end of file
+#pragma endregion
+
+#pragma region ForceCalculator
+
+void ForceCalculator::operator()(Particle &p_i) {
+    if (p_i.type == Ghost)
+        return;
+
+    double c_s = update_pressure(p_i);
+
+    int i = index_of(p_i);
+    // Shared by both equations: Rosswog 2009 eqn 120 and Bate eq. 2.37
+    double Pr_rho_i = p_i.pressure / std::pow(p_i.density, 2) / p_i.omega;
+    bool isothermal = config.pressure_calc == Isothermal;
+
+    double acc = 0;
+    double du_dt = 0;
+    double drho_dt = 0;
+
+    for (int j : nlist->neighbours(i)) {
+        if (j == i)
+            continue;
+
+        const Particle &p_j = p_arr[j];
+
+        double r_ij = p_i.pos - p_j.pos;
+        double v_ij = p_i.vel - p_j.vel;
+        double h_ij = (p_i.h + p_j.h) / 2;
+
+        double grad_W_i = grad_W(p_i, p_j, p_i.h);
+        double grad_W_j = grad_W(p_i, p_j, p_j.h);
+        double grad_W_ij = grad_W(p_i, p_j, h_ij);
+
+        double Pr_j = isothermal ? pressure_isothermal(p_j, c_s) : pressure_adiabatic(p_j);
+        double Pr_rho_j = Pr_j / std::pow(p_j.density, 2) / p_j.omega;
+
+        double visc_ij = artificial_viscosity(p_i, p_j, r_ij, h_ij, c_s);
+
+        acc += -p_j.mass * ((grad_W_i * Pr_rho_i) + (grad_W_j * Pr_rho_j) + (grad_W_ij * visc_ij));
+        du_dt += p_j.mass * v_ij * grad_W_ij * (Pr_rho_i + 0.5 * visc_ij);
+        drho_dt += p_j.mass * v_ij * grad_W_i;
+    }
+
+    p_i.acc = acc;
+    p_i.du_dt = du_dt;
+    // Continuity equation with variable smoothing lengths (Price 2012 eq. 39), for predicting h
+    p_i.drho_dt = drho_dt / p_i.omega;
+}
+
+#pragma endregion
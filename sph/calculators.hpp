@@ -10,18 +10,19 @@
 #define calculators_hpp
 
 #include "basictypes.hpp"
+#include "neighbour_list.hpp"
 
 // Calculators adopt a visitor design pattern. This is so that they can be instantiated and store
 // certain information that would otherwise be needed for every function call e.g. particle array
 // pointer, Config data, etc. 
 
-// Base type of calculator. Defines constructor (storing config and particle array) and an
-// override-able operator method
+// Base type of calculator. Defines constructor (storing config, particle array and neighbour lists)
+// and an override-able operator method
 class Calculator {
     public:
         // ctor
-        Calculator(const Config c, const ParticleArrayPtr p_arr_ptr) 
-            : config(c), p_arr(p_arr_ptr) {}
+        Calculator(const Config c, const ParticleArrayPtr p_arr_ptr, NeighbourList &nl) 
+            : config(c), p_arr(p_arr_ptr), nlist(&nl) {}
         // Calculation function
         virtual void operator()(Particle &p) {
             throw new std::logic_error("Attempt to call un-implemented operator() function!");
@@ -35,6 +36,13 @@ class Calculator {
     protected:
         Config config;
         ParticleArrayPtr p_arr;
+        // Not owned by the calculator; shared between all the calculators of a simulation
+        NeighbourList* nlist;
+
+        // Index of p in the particle array, for looking up its neighbours
+        int index_of(const Particle &p) const {
+            return &p - p_arr.get();
+        }
 
         // Calculate the gradient of W between p_i, p_j with respect to the coordinates of p_i.
         // Used in acceleration and energy calculators.
@@ -45,19 +53,39 @@ class Calculator {
 class DensityCalculator : public Calculator {
     public:
         // ctor -- just call base class
-        DensityCalculator(const Config &c, ParticleArrayPtr p_arr_ptr) 
-            : Calculator(c, p_arr_ptr) {};
+        DensityCalculator(const Config &c, ParticleArrayPtr p_arr_ptr, NeighbourList &nl) 
+            : Calculator(c, p_arr_ptr, nl) {};
         
         // Calculate the smoothing length for a particle and then the density. This void method sets
-        // the properties on p.
+        // the properties on p. If the new smoothing length is no longer covered by the neighbour
+        // lists, they are rebuilt and the calculation is repeated.
+        // If config.h_activity_tol is set, particles whose surroundings have hardly changed skip the
+        // root-finding (see update_quiescent).
         void operator()(Particle &p) override;
+
+        // Rebuilding the neighbour lists isn't safe while other particles are being calculated in
+        // parallel. With rebuilding turned off, a smoothing length that outgrows the lists is instead
+        // capped at the largest one they cover, and the lists go stale so they are rebuilt before the
+        // next timestep, where h can carry on growing.
+        void set_rebuild_lists(bool rebuild) {
+            rebuild_lists = rebuild;
+        }
+
+    private:
+        bool rebuild_lists = true;
+
+        // If the particle's neighbours have barely moved relative to it since its smoothing length
+        // was last solved for (by less than config.h_activity_tol * h in total) and none have
+        // entered or left its kernel, update h and the density from a single density summation
+        // instead of solving again. Returns false if the full solve is needed.
+        bool update_quiescent(Particle &p, int i);
 };
 
 class AccelerationCalculator : public Calculator {
     public:
         // ctor
-        AccelerationCalculator(const Config &c, ParticleArrayPtr p_arr_ptr) 
-            : Calculator(c, p_arr_ptr) {};
+        AccelerationCalculator(const Config &c, ParticleArrayPtr p_arr_ptr, NeighbourList &nl) 
+            : Calculator(c, p_arr_ptr, nl) {};
         // Artificial viscosity params
         const double alpha = 1;
         const double beta = 2;
@@ -70,9 +98,13 @@ class AccelerationCalculator : public Calculator {
         // Public as it's used to set initial velocities in setup.cpp for the adiabatic test.
         // If isothermal pressure calculation is enabled, then this just returns 1. If
         // adiabatic pressure calculation is enabled, it uses sqrt(gamma * pressure / density)
-        double sound_speed(Particle p);
+        double sound_speed(const Particle &p);
 
     protected:
+        // Calculate the pressure of p from its density (and thermal energy, if adiabatic), store it
+        // on p, and return the sound speed at p
+        double update_pressure(Particle &p);
+
         /* Calculate pressure using isothermal equation of state (Bate thesis 2.22)
          * Parameters:
          *      p: calculate the pressure using the density estimate at this particle
@@ -108,9 +140,6 @@ class AccelerationCalculator : public Calculator {
             double h,
             double c_s
         );
-
-        // Check that p's density is not less than epsilon, and throw an error if it is.
-        void ensure_nonzero_density(const Particle &p);
 };
 
 // Inherit from AccelerationCalculator instead of base Calculator, as we require use of artificial
@@ -118,11 +147,27 @@ class AccelerationCalculator : public Calculator {
 class EnergyCalculator : public AccelerationCalculator {
     public:
         // ctor -- just call base class
-        EnergyCalculator(const Config &c, ParticleArrayPtr p_arr_ptr) 
-            : AccelerationCalculator(c, p_arr_ptr) {};
+        EnergyCalculator(const Config &c, ParticleArrayPtr p_arr_ptr, NeighbourList &nl) 
+            : AccelerationCalculator(c, p_arr_ptr, nl) {};
             
         // Calculate du/dt for a particle and set it as a property
         void operator()(Particle &p) override;
 };
 
+// Calculates the acceleration and du/dt of a particle together, in a single sweep over its
+// neighbours. This is what the integrator uses: the two equations need the same kernel gradient
+// and artificial viscosity for each pair, which are only worked out once here. The results are the
+// same as calling AccelerationCalculator then EnergyCalculator, up to rounding. The rate of change
+// of the density from the continuity equation comes out of the same sweep, which the integrator
+// predicts the next smoothing lengths from (see predict_h_factor).
+class ForceCalculator : public AccelerationCalculator {
+    public:
+        // ctor -- just call base class
+        ForceCalculator(const Config &c, ParticleArrayPtr p_arr_ptr, NeighbourList &nl)
+            : AccelerationCalculator(c, p_arr_ptr, nl) {};
+
+        // Calculate the pressure, acceleration, du/dt and drho/dt of p and set them as properties
+        void operator()(Particle &p_i) override;
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,118 @@
+# Turn a compressed snapshot stream (written with dump_format 1 in config.txt) back into the usual
+# text dump files, so that plot.py and accuracy_report.py can be used on it. See snapshot_codec.hpp
+# for the format.
+#
+# Usage: python3 decode_snapshots.py SNAPSHOT_FILE OUTPUT_DIR
+# e.g.   python3 decode_snapshots.py ./dumps/snapshots.sph ./dumps
+#
+# The files are named after the step they were written at, the same as the text dumps, and are
+# identical to what the program would have written as text.
+
+import os
+import struct
+import sys
+
+MAGIC = b"SPH-SNP1"
+FRAME_HEADER = struct.Struct("=IIQdQ") # type, step, n_part, time, payload_size
+KEY_FRAME = 0
+DELTA_FRAME = 1
+
+TYPE_NAMES = ["Alive", "Ghost", "Halo"]
+N_COLUMNS = 7 # h, density, pressure, acc, vel, pos, u
+
+def read_varint(data, pos):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+def decompress_zero_runs(data):
+    out = bytearray()
+    pos = 0
+    while pos < len(data):
+        tag = data[pos]
+        length, pos = read_varint(data, pos + 1)
+        if tag == 0:
+            out += data[pos:pos + length]
+            pos += length
+        else:
+            out += bytes(length)
+    return out
+
+def decode_column(raw, offset, n, width, previous):
+    # Undo the byte shuffle, then the XOR with the reference
+    shuffled = raw[offset:offset + n * width]
+    values = bytearray(n * width)
+    for b in range(width):
+        values[b::width] = shuffled[b * n:(b + 1) * n]
+
+    if previous is not None:
+        x = int.from_bytes(values, "little") ^ int.from_bytes(previous, "little")
+        values = bytearray(x.to_bytes(n * width, "little"))
+    else:
+        # Each value is XORed with the one before, which has already been decoded
+        for i in range(width, n * width):
+            values[i] ^= values[i - width]
+
+    return bytes(values), offset + n * width
+
+def read_frames(filename):
+    with open(filename, "rb") as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            sys.exit(f"{filename} is not a snapshot file")
+
+        previous = None
+        while True:
+            header = f.read(FRAME_HEADER.size)
+            if not header:
+                return
+
+            frame_type, step, n, time, payload_size = FRAME_HEADER.unpack(header)
+            raw = decompress_zero_runs(f.read(payload_size))
+
+            widths = [4, 1] + [8] * N_COLUMNS
+            columns = []
+            offset = 0
+            for c, width in enumerate(widths):
+                ref = previous[c] if frame_type == DELTA_FRAME else None
+                column, offset = decode_column(raw, offset, n, width, ref)
+                columns.append(column)
+
+            previous = columns
+            yield step, time, n, columns
+
+def write_dump(filename, time, n, columns):
+    ids = struct.unpack(f"={n}i", columns[0])
+    types = columns[1]
+    values = [struct.unpack(f"={n}d", columns[2 + c]) for c in range(N_COLUMNS)]
+
+    with open(filename, "w") as f:
+        # Same as format_dump_header and format_dump_line in dump_writer.cpp
+        f.write(f"# This file was dumped at t = {time:g}\n")
+        f.write("# Column definitions:\n")
+        f.write("# Particle ID / Type / Smoothing length / Density / Pressure / Acceleration / Velocity / Position / Thermal energy\n")
+        f.write("# Aligned definition 'tags' for easier reading:\n")
+        f.write("# ID    TYPE     H          DENSITY  PRESS    ACCEL     VEL       POS       U\n")
+
+        for i in range(n):
+            h, density, pressure, acc, vel, pos, u = (v[i] for v in values)
+            f.write("%4d    %s    %3.5f    %3.3f    %3.3f    %+3.3f    %+3.3f    %+3.3f    %3.3f\n" %
+                    (ids[i], TYPE_NAMES[types[i]], h, density, pressure, acc, vel, pos, u))
+
+if len(sys.argv) != 3:
+    print("Usage: python3 decode_snapshots.py SNAPSHOT_FILE OUTPUT_DIR")
+    sys.exit(1)
+
+os.makedirs(sys.argv[2], exist_ok=True)
+
+n_frames = 0
+for step, time, n, columns in read_frames(sys.argv[1]):
+    write_dump(f"{sys.argv[2]}/{step}.txt", time, n, columns)
+    n_frames += 1
+
+print(f"Decoded {n_frames} snapshots into {sys.argv[2]}")
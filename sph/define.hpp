@@ -19,6 +19,16 @@
 #ifndef define_hpp // Include guard
 #define define_hpp
 
+// === basictypes.hpp ===
+
+// Store the particle properties as floats rather than doubles, which halves the size of the
+// particles and so the memory traffic of the neighbour sweeps. Sums over neighbours are still done
+// in double. Can also be enabled with `make mixed`.
+// #define USE_MIXED_PRECISION
+// In mixed precision, positions are stored as a float offset from the start of a bin of this width,
+// so they don't lose precision away from the origin. A power of 2 so that the bin edges are exact.
+const double POSITION_BIN_WIDTH = 1.0 / 16;
+
 // === calculators.cpp ===
 
 // Epsilon value -- when checking if a floating point is 0, check if it's less than this instead
@@ -45,6 +55,137 @@ const double GAMMA = 5.0/3.0;
 // Show root-finding warnings (i.e. when fallback bisection method is used)
 #define H_WARNINGS
 
+// Predict each smoothing length at the drift from the continuity equation, so that root-finding
+// starts from close to where h will be rather than where it was the step before
+#define PREDICT_H
+// Most a predicted smoothing length can grow (or shrink, by its inverse) in one step. Anything
+// more than this means the prediction can't be trusted, and the root-finding starts from it anyway.
+const double H_PREDICT_MAX_FACTOR = 2.0;
+
+// === neighbour_list.cpp ===
+
+// Fraction by which the neighbour search radius is extended beyond the kernel radius. A larger skin
+// means the neighbour lists have to be rebuilt less often, but each list is longer to iterate over.
+const double NEIGHBOUR_SKIN = 0.2;
+
+// === domain_decomposition.cpp ===
+
+// USE_MPI is not set here, but by building with `make mpi`, as it also needs the MPI compiler.
+
+// Number of timesteps between moving the slab edges to even out the number of particles per rank
+#define MPI_REBALANCE_INTERVAL 10
+
+// === task_graph.cpp ===
+
+// Number of particles per task when a timestep is split up between worker threads. Smaller chunks
+// balance better between threads, but each task has some scheduling overhead.
+#define TASK_CHUNK_SIZE 128
+
+// === validation.cpp ===
+
+// USE_CHECKED is not set here, but by building with `make checked`, which sweeps the particles for
+// NaNs and non-positive densities and smoothing lengths after every phase, see validation.hpp.
+
+// Number of failing particles to log for each property that fails validation
+#define VALIDATION_MAX_REPORTED 10
+
+// === particle_array.cpp ===
+
+// Alignment of the particle array, i.e. a cache line, so that no particle straddles two more than it
+// has to, and chunks of particles line up with cache lines
+#define PARTICLE_ALIGNMENT 64
+
+// Size of a (transparent or explicit) huge page, which is 2 MB on x86-64 and most ARM systems
+#define HUGE_PAGE_SIZE (2 << 20)
+
+// === ensemble.cpp ===
+
+// Default number of ensemble members to run at once, per worker thread. Members with few particles
+// only have a few tasks per phase, so there need to be more members than threads to keep them busy.
+#define ENSEMBLE_MEMBERS_PER_THREAD 2
+
+// === analysis.cpp ===
+
+// Maximum number of parts the particles are split into to be summed in parallel. Each part has its
+// own copy of the profile bins.
+#define ANALYSIS_PARTS 64
+
+// Smallest jump in the mean density between neighbouring bins that counts as a shock front, as a
+// fraction of the peak density
+const double ANALYSIS_SHOCK_JUMP = 0.1;
+
+// === snapshot_codec.cpp ===
+
+// Maximum number of frames between keyframes in the compressed snapshot stream. Decoding a frame
+// needs every frame back to the last keyframe, so this limits how much of a damaged file is lost.
+#define SNAPSHOT_KEYFRAME_INTERVAL 50
+
+// === dump_writer.cpp ===
+
+// Number of particles formatted by each task when writing a text dump file. Each task formats its
+// particles into its own buffer, which are joined once they are all done.
+#define DUMP_CHUNK_SIZE 4096
+
+// === live_stream.cpp ===
+
+// Number of frames in the live stream's ring. A reader has this many frames' time to use a frame
+// before it is overwritten.
+#define LIVE_STREAM_SLOTS 8
+
+// === metrics.cpp ===
+
+// Number of shards in each MetricCounter. Threads beyond this many share shards, which still works,
+// but they then contend for the cache line.
+#define METRICS_SHARDS 64
+
+// Number of timesteps between the sums of the total energy and momentum for the metrics. Counted in
+// steps rather than seconds, so that every MPI rank takes part in the same sums.
+#define METRICS_CONSERVATION_INTERVAL 10
+
+// Steps per second are measured over at least this many seconds of wall-clock time
+const double METRICS_RATE_SECONDS = 1.0;
+
+// Longest the metrics server waits for anything, in milliseconds, so it stops this soon after the
+// simulation asks it to, and a client that never sends a request only holds it up this long
+#define METRICS_POLL_MS 100
+
+// === trace.cpp ===
+
+// Number of spans in each block of a thread's trace buffer. A block is freed once every span in it
+// has been written to the trace file.
+#define TRACE_BLOCK_EVENTS 4096
+
+// Longest line of the trace file, i.e. one span as JSON
+#define TRACE_EVENT_MAX 512
+
+// === refinement.cpp ===
+
+// Particles are only merged where their resolution indicators are below this fraction of
+// refine_threshold, so that particles that have just been split aren't merged straight back
+const double REFINE_MERGE_FRACTION = 0.25;
+
+// Largest refine_max_level allowed in config.txt. Each level can double the number of particles.
+#define REFINE_MAX_LEVEL 8
+
+// === log.cpp ===
+
+// Number of log messages that can be waiting to be written at once. Any more are dropped (apart
+// from errors) rather than holding up the simulation.
+#define LOG_BUFFER_SIZE 4096
+
+// Number of messages tallied under the same summary (e.g. root-finding warnings) that are written
+// in full each step, before the rest are only counted
+#define LOG_TALLY_DETAIL 3
+
+// === benchmark.cpp ===
+
+// Default number of timesteps to run each benchmark case for
+#define BENCHMARK_STEPS 20
+
+// Timestep of the benchmark setups, as a fraction of the initial smoothing length. The same as in
+// config.txt (t_i 0.005 with h = 0.08), which is stable for any number of particles.
+const double BENCHMARK_COURANT = 0.0625;
+
 // === sph.cpp ===
 
 // Don't start the evolution and only generate initial conditions. Useful when debugging setup or
@@ -0,0 +1,304 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * domain_decomposition.cpp implements the SlabDecomposition class from domain_decomposition.hpp.
+ */
+
+#ifdef USE_MPI
+
+#include <algorithm>
+#include <iostream>
+
+#include "domain_decomposition.hpp"
+#include "define.hpp"
+#include "ghost_particles.hpp"
+#include "kernel.hpp"
+#include "particle_array.hpp"
+
+static PackedParticle pack(const Particle &p) {
+    return PackedParticle {
+        p.mass, p.pos, p.vel, p.acc, p.h, p.du_dt, p.u, p.density, p.pressure, p.omega, p.drho_dt, p.type,
+        p.n_solve_neighbours, p.drho_dh, p.activity
+    };
+}
+
+static void unpack(const PackedParticle &pp, Particle &p) {
+    p.mass = pp.mass;
+    p.pos = pp.pos;
+    p.vel = pp.vel;
+    p.acc = pp.acc;
+    p.h = pp.h;
+    p.du_dt = pp.du_dt;
+    p.u = pp.u;
+    p.density = pp.density;
+    p.pressure = pp.pressure;
+    p.omega = pp.omega;
+    p.drho_dt = pp.drho_dt;
+    p.type = (ParticleType)pp.type;
+    p.n_solve_neighbours = pp.n_solve_neighbours;
+    p.drho_dh = pp.drho_dh;
+    p.activity = pp.activity;
+}
+
+SlabDecomposition::SlabDecomposition(const Config &config, MPI_Comm comm) : comm(comm) {
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    double width = 2 * config.limit / size;
+    edges.resize(size + 1);
+    for (int r = 0; r <= size; r++)
+        edges[r] = -config.limit + r * width;
+    edges[size] = config.limit;
+
+    halo_send.resize(size);
+    halo_recv_counts.assign(size, 0);
+}
+
+int SlabDecomposition::owner(double pos) const {
+    // Number of interior edges at or below pos
+    return std::upper_bound(edges.begin() + 1, edges.end() - 1, pos) - (edges.begin() + 1);
+}
+
+std::vector<PackedParticle> SlabDecomposition::exchange(
+    const std::vector<std::vector<PackedParticle>> &send,
+    std::vector<int> &recv_counts
+) {
+    const int item = sizeof(PackedParticle);
+
+    std::vector<int> send_counts(size);
+    for (int r = 0; r < size; r++)
+        send_counts[r] = send[r].size();
+
+    recv_counts.assign(size, 0);
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+
+    // Flatten the send buffers, and work out where everything goes (in bytes)
+    std::vector<PackedParticle> send_buf;
+    std::vector<int> send_bytes(size), send_displs(size), recv_bytes(size), recv_displs(size);
+    int n_recv = 0;
+
+    for (int r = 0; r < size; r++) {
+        send_displs[r] = send_buf.size() * item;
+        send_bytes[r] = send_counts[r] * item;
+        send_buf.insert(send_buf.end(), send[r].begin(), send[r].end());
+
+        recv_displs[r] = n_recv * item;
+        recv_bytes[r] = recv_counts[r] * item;
+        n_recv += recv_counts[r];
+    }
+
+    std::vector<PackedParticle> recv_buf(n_recv);
+    MPI_Alltoallv(
+        send_buf.data(), send_bytes.data(), send_displs.data(), MPI_BYTE,
+        recv_buf.data(), recv_bytes.data(), recv_displs.data(), MPI_BYTE,
+        comm
+    );
+
+    return recv_buf;
+}
+
+void SlabDecomposition::distribute(ParticleArrayPtr &p_arr, Config &config) {
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+
+    // Compact the particles in our slab to the start of the array
+    int n_own = 0;
+    for (int i = 0; i < n_alive; i++) {
+        if (owner(p_arr[i].pos) == rank) {
+            if (n_own != i)
+                p_arr[n_own] = p_arr[i];
+            n_own++;
+        }
+    }
+
+    config.n_part = n_own;
+    config.n_ghost = 0;
+    config.n_halo = 0;
+
+    if (is_boundary_rank())
+        setup_ghost_particles(p_arr, config);
+    exchange_halos(p_arr, config);
+}
+
+void SlabDecomposition::migrate(ParticleArrayPtr &p_arr, Config &config) {
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+
+    std::vector<std::vector<PackedParticle>> send(size);
+    int n_keep = 0;
+
+    for (int i = 0; i < n_alive; i++) {
+        int r = owner(p_arr[i].pos);
+        if (r == rank) {
+            if (n_keep != i)
+                p_arr[n_keep] = p_arr[i];
+            n_keep++;
+        } else {
+            send[r].push_back(pack(p_arr[i]));
+        }
+    }
+
+    std::vector<int> recv_counts;
+    std::vector<PackedParticle> recv = exchange(send, recv_counts);
+
+    int n_recv = recv.size();
+    reserve_particles(p_arr, config, n_keep, n_keep + n_recv);
+    for (int k = 0; k < n_recv; k++)
+        unpack(recv[k], p_arr[n_keep + k]);
+
+    config.n_part = n_keep + n_recv;
+    config.n_ghost = 0;
+    config.n_halo = 0;
+}
+
+void SlabDecomposition::rebalance(const ParticleArrayPtr &p_arr, const Config &config) {
+    if (size == 1)
+        return;
+
+    // Histogram of particle positions across the whole domain, summed over all ranks. The new edges
+    // are then placed where the cumulative count crosses each multiple of n_total / size.
+    const int n_bins = 64 * size;
+    const double bin_width = 2 * config.limit / n_bins;
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+
+    std::vector<long long> local_hist(n_bins, 0), hist(n_bins);
+    double local_h_max = 0;
+    for (int i = 0; i < n_alive; i++) {
+        int bin = (p_arr[i].pos + config.limit) / bin_width;
+        bin = std::min(std::max(bin, 0), n_bins - 1);
+        local_hist[bin]++;
+        local_h_max = std::max(local_h_max, (double)p_arr[i].h);
+    }
+
+    double h_max;
+    MPI_Allreduce(local_hist.data(), hist.data(), n_bins, MPI_LONG_LONG, MPI_SUM, comm);
+    MPI_Allreduce(&local_h_max, &h_max, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+    long long n_total = 0;
+    for (long long count : hist)
+        n_total += count;
+
+    long long cumulative = 0;
+    int r = 1;
+    for (int bin = 0; bin < n_bins && r < size; bin++) {
+        while (r < size && cumulative + hist[bin] >= n_total * r / size) {
+            // Interpolate within the bin, assuming particles are evenly spread across it
+            double fraction = (hist[bin] > 0)
+                ? (double)(n_total * r / size - cumulative) / hist[bin]
+                : 0;
+            edges[r] = -config.limit + (bin + fraction) * bin_width;
+            r++;
+        }
+        cumulative += hist[bin];
+    }
+
+    // The boundary ranks only mirror their own particles to make ghost particles, so their slabs
+    // must be at least as wide as the interaction radius
+    double min_width = KERNEL_RADIUS * (1 + NEIGHBOUR_SKIN) * h_max;
+    edges[1] = std::max(edges[1], -config.limit + min_width);
+    edges[size - 1] = std::min(edges[size - 1], config.limit - min_width);
+    for (int e = 2; e < size; e++)
+        edges[e] = std::max(edges[e], edges[e - 1]);
+}
+
+void SlabDecomposition::exchange_halos(ParticleArrayPtr &p_arr, Config &config) {
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+
+    // Halo width: the furthest any particle can interact, plus the margin the neighbour lists
+    // allow the smoothing lengths to grow by before being rebuilt
+    double local_h_max = 0;
+    for (int i = 0; i < n_alive; i++)
+        local_h_max = std::max(local_h_max, (double)p_arr[i].h);
+
+    double h_max;
+    MPI_Allreduce(&local_h_max, &h_max, 1, MPI_DOUBLE, MPI_MAX, comm);
+    double width = KERNEL_RADIUS * (1 + NEIGHBOUR_SKIN) * h_max;
+
+    std::vector<std::vector<PackedParticle>> send(size);
+    for (int r = 0; r < size; r++)
+        halo_send[r].clear();
+
+    for (int i = 0; i < n_alive; i++) {
+        double pos = p_arr[i].pos;
+
+        // Slabs to the left, for as long as they're within range
+        for (int r = rank - 1; r >= 0 && pos - width < edges[r + 1]; r--) {
+            halo_send[r].push_back(i);
+            send[r].push_back(pack(p_arr[i]));
+        }
+
+        // Slabs to the right
+        for (int r = rank + 1; r < size && pos + width >= edges[r]; r++) {
+            halo_send[r].push_back(i);
+            send[r].push_back(pack(p_arr[i]));
+        }
+    }
+
+    std::vector<PackedParticle> recv = exchange(send, halo_recv_counts);
+
+    int n_base = config.n_part - config.n_halo;
+    int n_recv = recv.size();
+    reserve_particles(p_arr, config, n_base, n_base + n_recv);
+
+    for (int k = 0; k < n_recv; k++) {
+        unpack(recv[k], p_arr[n_base + k]);
+        p_arr[n_base + k].type = Halo;
+    }
+
+    config.n_halo = n_recv;
+    config.n_part = n_base + n_recv;
+}
+
+void SlabDecomposition::refresh_halos(ParticleArrayPtr &p_arr, const Config &config) {
+    std::vector<std::vector<PackedParticle>> send(size);
+    for (int r = 0; r < size; r++) {
+        for (int i : halo_send[r])
+            send[r].push_back(pack(p_arr[i]));
+    }
+
+    std::vector<int> recv_counts;
+    std::vector<PackedParticle> recv = exchange(send, recv_counts);
+
+    // Every rank sends the same particles, in the same order, as in the last exchange_halos, so the
+    // halo particles can just be overwritten in order
+    int n_base = config.n_part - config.n_halo;
+    for (int k = 0; k < config.n_halo; k++) {
+        unpack(recv[k], p_arr[n_base + k]);
+        p_arr[n_base + k].type = Halo;
+    }
+}
+
+int SlabDecomposition::gather(const ParticleArrayPtr &p_arr, const Config &config, ParticleArrayPtr &out) {
+    const int item = sizeof(PackedParticle);
+
+    int n_local = config.n_part - config.n_halo;
+    std::vector<PackedParticle> send(n_local);
+    for (int i = 0; i < n_local; i++)
+        send[i] = pack(p_arr[i]);
+
+    std::vector<int> counts(size), bytes(size), displs(size);
+    MPI_Gather(&n_local, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+
+    int n_total = 0;
+    for (int r = 0; r < size; r++) {
+        bytes[r] = counts[r] * item;
+        displs[r] = n_total * item;
+        n_total += counts[r];
+    }
+
+    std::vector<PackedParticle> recv(rank == 0 ? n_total : 0);
+    MPI_Gatherv(
+        send.data(), n_local * item, MPI_BYTE,
+        recv.data(), bytes.data(), displs.data(), MPI_BYTE,
+        0, comm
+    );
+
+    if (rank != 0)
+        return 0;
+
+    out = allocate_particles(n_total);
+    for (int i = 0; i < n_total; i++)
+        unpack(recv[i], out[i]);
+
+    return n_total;
+}
+
+#endif
@@ -0,0 +1,109 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * domain_decomposition.hpp defines the SlabDecomposition class, which splits the simulation over
+ * several MPI processes (ranks) by cutting the domain [-limit, limit] into contiguous slabs, one per
+ * rank. Each rank owns (i.e. evolves) the alive particles within its slab, and receives copies of
+ * the particles near its slab edges from the neighbouring ranks ('halo' particles) so that the
+ * neighbour sums of its own particles are complete.
+ *
+ * Only compiled when USE_MPI is defined, which is done by building with `make mpi` rather than in
+ * define.hpp, as it also needs the MPI compiler wrapper.
+ */
+
+#ifndef domain_decomposition_hpp
+#define domain_decomposition_hpp
+
+#ifdef USE_MPI
+
+#include <vector>
+#include <mpi.h>
+
+#include "basictypes.hpp"
+
+// Plain copy of the data of a Particle, which can be sent between ranks as raw bytes (Particle itself
+// can't be, because of its const id).
+// Uses the same types as Particle, so is half the size in mixed precision.
+struct PackedParticle {
+    real_t mass;
+    position_t pos;
+    real_t vel;
+    real_t acc;
+    real_t h;
+    real_t du_dt;
+    real_t u;
+    real_t density;
+    real_t pressure;
+    real_t omega;
+    real_t drho_dt;
+    int type;
+    int n_solve_neighbours;
+    real_t drho_dh;
+    real_t activity;
+};
+
+class SlabDecomposition {
+    public:
+        // ctor. Initially the slabs are all the same width; they are moved by rebalance() later on.
+        SlabDecomposition(const Config &config, MPI_Comm comm = MPI_COMM_WORLD);
+
+        // Take a particle array set up for the whole domain (identically on every rank) by
+        // init_particles, and only keep the alive particles within this rank's slab. Ghost and halo
+        // particles are then set up as they would be in a timestep.
+        void distribute(ParticleArrayPtr &p_arr, Config &config);
+
+        // Remove the ghost and halo particles, and send the alive particles that have moved out of
+        // this rank's slab to the rank whose slab they are now in.
+        void migrate(ParticleArrayPtr &p_arr, Config &config);
+
+        // Move the slab edges so that every rank has roughly the same number of alive particles.
+        // Must be followed by migrate() to actually move the particles to their new owners.
+        void rebalance(const ParticleArrayPtr &p_arr, const Config &config);
+
+        // Append copies of the alive particles of other ranks that are within KERNEL_RADIUS * max h
+        // (plus the neighbour list skin) of this rank's slab, as Halo type particles after the ghost
+        // particles. Must be called after the ghost particles have been set up.
+        void exchange_halos(ParticleArrayPtr &p_arr, Config &config);
+
+        // Update the halo particles with the quantities their owners have calculated since
+        // exchange_halos (density, smoothing length, omega), in place.
+        void refresh_halos(ParticleArrayPtr &p_arr, const Config &config);
+
+        // Collect the alive and ghost particles of every rank on rank 0 (e.g. for file output).
+        // Returns the number of particles in out on rank 0, and 0 on every other rank.
+        int gather(const ParticleArrayPtr &p_arr, const Config &config, ParticleArrayPtr &out);
+
+        int get_rank() const { return rank; }
+        int get_size() const { return size; }
+
+        // Ranks at the physical boundaries of the domain are the only ones that need ghost particles
+        bool is_boundary_rank() const { return rank == 0 || rank == size - 1; }
+
+    private:
+        MPI_Comm comm;
+        int rank;
+        int size;
+
+        // Slab of rank r is [edges[r], edges[r + 1]). Has size + 1 entries.
+        std::vector<double> edges;
+
+        // Indices of the particles sent to each rank in the last halo exchange, and the number of
+        // halo particles received from each rank, so that refresh_halos can resend them in the same
+        // order.
+        std::vector<std::vector<int>> halo_send;
+        std::vector<int> halo_recv_counts;
+
+        // Rank whose slab contains pos. Particles outside the domain belong to the edge ranks.
+        int owner(double pos) const;
+
+        // Send send[r] to every rank r, and return everything received (in order of rank).
+        // recv_counts is set to the number of particles received from each rank.
+        std::vector<PackedParticle> exchange(
+            const std::vector<std::vector<PackedParticle>> &send,
+            std::vector<int> &recv_counts
+        );
+};
+
+#endif
+
+#endif
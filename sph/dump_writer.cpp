@@ -0,0 +1,173 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * dump_writer.cpp implements the functions from dump_writer.hpp.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dump_writer.hpp"
+#include "trace.hpp"
+#include "define.hpp"
+#include "log.hpp"
+
+// Longest value put_value can write: DBL_MAX in fixed notation is 309 digits, plus the sign, point
+// and 5 decimal places
+static const int VALUE_MAX = 320;
+
+// Length of a line in the usual columns, roughly, for reserving the buffers
+static const int LINE_GUESS = 80;
+
+// Columns are separated by four spaces
+static char* put_separator(char* buf) {
+    std::memcpy(buf, "    ", 4);
+    return buf + 4;
+}
+
+// Same as printf's "%4d"
+static char* put_id(char* buf, int id) {
+    char digits[16];
+    char* end = std::to_chars(digits, digits + sizeof(digits), id).ptr;
+    int len = end - digits;
+
+    for (int pad = len; pad < 4; pad++)
+        *buf++ = ' ';
+    std::memcpy(buf, digits, len);
+    return buf + len;
+}
+
+// Whether the sign bit of value is set. Read from the bits, rather than with std::signbit, which
+// the fast-math build assumes can only be set for values below 0, while printf also writes the sign
+// of -0 and of NaNs.
+template <typename T>
+static bool sign_bit(T value) {
+    typedef typename std::conditional<sizeof(T) == 8, uint64_t, uint32_t>::type Bits;
+    Bits bits;
+    std::memcpy(&bits, &value, sizeof(T));
+    return bits >> (8 * sizeof(T) - 1);
+}
+
+// Same as printf's "%.{precision}f", or "%+.{precision}f" if plus is set. If precision is negative,
+// the value is written with the fewest digits that read back as exactly the same value instead.
+// The widths of the old format (3) are always less than the length of the number, so have no effect.
+template <typename T>
+static char* put_value(char* buf, T value, int precision, bool plus) {
+    if (plus && !sign_bit(value))
+        *buf++ = '+';
+
+    char* end = buf + VALUE_MAX;
+    if (precision < 0)
+        return std::to_chars(buf, end, value).ptr;
+    return std::to_chars(buf, end, value, std::chars_format::fixed, precision).ptr;
+}
+
+std::string format_dump_header(double time) {
+    // Through a stream, so that the time is written the same way as it always has been
+    std::ostringstream header;
+    header << "# This file was dumped at t = " << time << "\n";
+    header << "# Column definitions:\n";
+    header << "# Particle ID / Type / Smoothing length / Density / Pressure / Acceleration / Velocity / Position / Thermal energy\n";
+    header << "# Aligned definition 'tags' for easier reading:\n";
+    header << "# ID    TYPE     H          DENSITY  PRESS    ACCEL     VEL       POS       U\n";
+    return header.str();
+}
+
+int format_dump_line(char* buf, const Particle &p, bool full_precision) {
+    // Digits after the point of h, and of everything else
+    int h_digits = full_precision ? -1 : 5;
+    int digits = full_precision ? -1 : 3;
+
+    char* c = buf;
+    c = put_id(c, p.id);
+    c = put_separator(c);
+
+    const char* type = ParticleTypeNames[p.type];
+    size_t type_len = std::strlen(type);
+    std::memcpy(c, type, type_len);
+    c += type_len;
+
+    c = put_separator(put_value(put_separator(c), p.h, h_digits, false));
+    c = put_separator(put_value(c, p.density, digits, false));
+    c = put_separator(put_value(c, p.pressure, digits, false));
+    c = put_separator(put_value(c, p.acc, digits, true));
+    c = put_separator(put_value(c, p.vel, digits, true));
+    c = put_separator(put_value(c, (double)p.pos, digits, true));
+    c = put_value(c, p.u, digits, false);
+    *c++ = '\n';
+
+    return c - buf;
+}
+
+void format_dump_lines(const Particle* particles, int n, bool full_precision, Executor &executor,
+                       std::string &out) {
+    int n_chunks = (n + DUMP_CHUNK_SIZE - 1) / DUMP_CHUNK_SIZE;
+    std::vector<std::string> chunks(n_chunks);
+
+    TaskGraph graph;
+    for (int k = 0; k < n_chunks; k++) {
+        graph.add([&, k] {
+            TraceSpan span("Format dump", "chunk", k);
+            int first = k * DUMP_CHUNK_SIZE;
+            int last = std::min(first + DUMP_CHUNK_SIZE, n);
+
+            std::string &text = chunks[k];
+            text.reserve((last - first) * LINE_GUESS);
+
+            char line[DUMP_LINE_MAX];
+            for (int i = first; i < last; i++)
+                text.append(line, format_dump_line(line, particles[i], full_precision));
+        });
+    }
+    executor.run(graph);
+
+    size_t size = out.size();
+    for (const std::string &text : chunks)
+        size += text.size();
+    out.reserve(size);
+
+    for (const std::string &text : chunks)
+        out += text;
+}
+
+bool write_all(int fd, const std::string &text, const std::string &filename) {
+    const char* data = text.data();
+    size_t left = text.size();
+
+    // write() can stop short (e.g. if interrupted by a signal), in which case it's called again for
+    // the rest
+    while (left > 0) {
+        ssize_t written = write(fd, data, left);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("Could not write dump file " << filename << ": " << strerror(errno));
+            return false;
+        }
+        data += written;
+        left -= written;
+    }
+
+    return true;
+}
+
+bool write_dump_file(const std::string &filename, const std::string &text) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Could not open dump file " << filename << " for writing: " << strerror(errno));
+        return false;
+    }
+
+    bool ok = write_all(fd, text, filename);
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,47 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * dump_writer.hpp defines the writer of the text dump files: a header, then one line per particle
+ * with the columns lined up, which plot.py and accuracy_report.py read. The lines used to be made
+ * with sprintf one at a time, which took longer than the timesteps between dumps for large runs.
+ * They are now formatted with std::to_chars (which doesn't need the locale, or to parse a format
+ * string), in chunks of DUMP_CHUNK_SIZE particles in parallel on the worker threads, each chunk into
+ * its own buffer. The buffers are then joined and the whole file is written with one write().
+ *
+ * The output is byte for byte the same as the old sprintf format, "%4d    %s    %3.5f    %3.3f
+ * %3.3f    %+3.3f    %+3.3f    %+3.3f    %3.3f". With dump_format 2 in config.txt, the values are
+ * written with as many digits as it takes to read them back exactly instead, in the same columns.
+ */
+
+#ifndef dump_writer_hpp
+#define dump_writer_hpp
+
+#include <string>
+
+#include "basictypes.hpp"
+#include "task_graph.hpp"
+
+// Longest line that format_dump_line can write, including the newline. Nearly all of it is for
+// values as large as DBL_MAX, which still have to be written in full.
+#define DUMP_LINE_MAX 2400
+
+// Header of a dump file written at the given time
+std::string format_dump_header(double time);
+
+// Format p as a line of a dump file into buf, which must have room for DUMP_LINE_MAX chars, either
+// in the usual columns or at full precision. Returns the number of chars written.
+int format_dump_line(char* buf, const Particle &p, bool full_precision);
+
+// Format particles [0, n) as lines of a dump file, in parallel on executor, and append them to out
+void format_dump_lines(const Particle* particles, int n, bool full_precision, Executor &executor,
+                       std::string &out);
+
+// Write text to the file fd, carrying on after partial writes. Logs an error and returns false if
+// it can't.
+bool write_all(int fd, const std::string &text, const std::string &filename);
+
+// Write text to filename (replacing anything already there) with a single write call. Logs an
+// error and returns false if it can't.
+bool write_dump_file(const std::string &filename, const std::string &text);
+
+#endif
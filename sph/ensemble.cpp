@@ -0,0 +1,245 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * ensemble.cpp implements the Ensemble class from ensemble.hpp.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include "ensemble.hpp"
+#include "define.hpp"
+#include "kernel.hpp"
+#include "particle_array.hpp"
+#include "sph_simulation.hpp"
+#include "log.hpp"
+
+#ifdef USE_MPI
+#error "Ensemble mode runs every member in one process, and can't be combined with MPI"
+#endif
+
+// Spec properties starting with this are swept over, e.g. 'sweep_h_factor 1.5,2,2.5'
+static const std::string SWEEP_PREFIX = "sweep_";
+
+Ensemble::Ensemble(std::istream &spec_stream) {
+    ConfigMap spec = ConfigReader::parse_config(spec_stream);
+
+    ConfigReader::set_property(config_file, spec, "config");
+    ConfigReader::set_optional_property(end_time, spec, "end_time", 1.0);
+    ConfigReader::set_optional_property(output_dir, spec, "output_dir", std::string("ensemble"));
+    ConfigReader::set_optional_property(n_threads, spec, "n_threads", 0);
+    ConfigReader::set_optional_property(max_concurrent, spec, "max_concurrent", 0);
+
+    for (auto &[name, list] : spec) {
+        if (name.rfind(SWEEP_PREFIX, 0) != 0)
+            continue;
+
+        sweep_names.push_back(name.substr(SWEEP_PREFIX.length()));
+        sweep_values.push_back(split_values(list));
+    }
+
+    std::ifstream config_stream(config_file);
+    if (!config_stream) {
+        LOG_ERROR("Could not open base config file " << config_file << " for reading.");
+        exit(1);
+    }
+
+    build_members(ConfigReader::parse_config(config_stream));
+}
+
+std::vector<std::string> Ensemble::split_values(const std::string &list) {
+    std::vector<std::string> values;
+    size_t start = 0;
+
+    while (start <= list.length()) {
+        size_t end = std::min(list.find(',', start), list.length());
+
+        // Allow spaces after the commas
+        std::string value = list.substr(start, end - start);
+        value.erase(0, value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of(' ') + 1);
+
+        if (value.empty()) {
+            LOG_ERROR("Empty value in sweep list '" << list << "'.");
+            exit(1);
+        }
+
+        values.push_back(value);
+        start = end + 1;
+    }
+
+    return values;
+}
+
+void Ensemble::build_members(const ConfigMap &base_config) {
+    for (const std::string &name : sweep_names) {
+        // Otherwise a typo would silently run the same member over and over
+        if (!base_config.count(name)) {
+            LOG_ERROR("Can't sweep over property '" << name << "', as it isn't in the "
+                      << "base config file " << config_file << ".");
+            exit(1);
+        }
+    }
+
+    int n_members = 1;
+    for (const auto &values : sweep_values)
+        n_members *= values.size();
+
+    for (int k = 0; k < n_members; k++) {
+        EnsembleMember member;
+        member.index = k;
+
+        // Member k takes the values given by the digits of k, in a mixed radix where each swept
+        // property is a digit. The last property varies fastest.
+        ConfigMap config_map = base_config;
+        int rest = k;
+        for (int s = sweep_names.size() - 1; s >= 0; s--) {
+            const std::string &value = sweep_values[s][rest % sweep_values[s].size()];
+            rest /= sweep_values[s].size();
+
+            member.values[sweep_names[s]] = value;
+            config_map[sweep_names[s]] = value;
+        }
+
+        ConfigReader reader(config_map);
+        member.config = reader.GetConfig();
+
+        // The trace is one timeline for the whole program, which every member would try to write
+        if (member.config.trace) {
+            if (k == 0)
+                LOG_WARN("trace isn't supported in ensemble runs, so it is ignored.");
+            member.config.trace = 0;
+        }
+
+        member.ic_file = reader.GetICFile();
+        member.cost = estimate_cost(member.config);
+        members.push_back(member);
+    }
+
+    // Start the most expensive members first. Otherwise the longest member could start last and
+    // leave every other thread idle while it finishes.
+    std::stable_sort(members.begin(), members.end(), [](const EnsembleMember &a, const EnsembleMember &b) {
+        return a.cost > b.cost;
+    });
+}
+
+double Ensemble::estimate_cost(const Config &config) const {
+    double n_steps = std::ceil(end_time / config.t_i);
+    double n_neighbours = 2 * KERNEL_RADIUS * config.h_factor;
+    return config.n_part * n_neighbours * n_steps;
+}
+
+void Ensemble::write_index() const {
+    std::string filename = output_dir + "/index.txt";
+    std::ofstream outstream(filename);
+
+    if (!outstream) {
+        LOG_ERROR("Could not open " << filename << " for writing.");
+        exit(1);
+    }
+
+    outstream << "# Members of the ensemble run with base config " << config_file << std::endl;
+    outstream << "# The dump files of each member are in " << output_dir << "/{member}/" << std::endl;
+    outstream << "# member";
+    for (const std::string &name : sweep_names)
+        outstream << " " << name;
+    outstream << std::endl;
+
+    std::vector<const EnsembleMember*> by_index(members.size());
+    for (const EnsembleMember &member : members)
+        by_index[member.index] = &member;
+
+    for (const EnsembleMember* member : by_index) {
+        outstream << member->index;
+        for (const std::string &name : sweep_names)
+            outstream << " " << member->values.at(name);
+        outstream << std::endl;
+    }
+}
+
+int Ensemble::run() {
+    std::error_code dir_ec;
+    std::filesystem::create_directories(output_dir, dir_ec);
+
+    if (dir_ec.value() != 0) {
+        LOG_ERROR("Failed to make directory " << output_dir << " for the ensemble output.");
+        LOG_ERROR("Error code " << dir_ec.value() << " with message "
+                  << dir_ec.message());
+        exit(1);
+    }
+
+    write_index();
+
+    Executor executor(n_threads);
+
+    // Each member is driven by its own thread, which spends most of its time waiting for the tasks
+    // of its timesteps to be run by the shared workers
+    int n_drivers = max_concurrent > 0 ? max_concurrent : ENSEMBLE_MEMBERS_PER_THREAD * executor.n_threads();
+    n_drivers = std::min(n_drivers, n_members());
+
+    LOG_INFO("Running " << n_members() << " ensemble members, " << n_drivers
+             << " at a time on " << executor.n_threads() << " worker threads.");
+
+    std::atomic<int> next_member(0);
+    std::atomic<int> n_finished(0);
+    std::atomic<int> n_failed(0);
+
+    std::vector<std::thread> drivers;
+    for (int d = 0; d < n_drivers; d++) {
+        drivers.emplace_back([&] {
+            int k;
+            while ((k = next_member++) < n_members()) {
+                const EnsembleMember &member = members[k];
+                std::string error;
+
+                // Let the other members carry on if one fails. Some of the calculators throw
+                // pointers to exceptions, so catch those too.
+                try {
+                    run_member(member, executor);
+                } catch (const std::exception &e) {
+                    error = e.what();
+                } catch (const std::exception* e) {
+                    error = e->what();
+                    delete e;
+                }
+
+                bool failed = !error.empty();
+                if (failed) {
+                    LOG_ERROR("Ensemble member " << member.index << " failed: " << error);
+                    n_failed++;
+                }
+
+                LOG_INFO((failed ? "Stopped" : "Finished") << " ensemble member "
+                         << member.index << " (" << ++n_finished << " / " << n_members() << ")");
+            }
+        });
+    }
+
+    for (std::thread &t : drivers)
+        t.join();
+
+    return n_failed;
+}
+
+void Ensemble::run_member(const EnsembleMember &member, Executor &executor) const {
+    Config config = member.config;
+    ParticleArrayPtr p_arr;
+
+    if (member.ic_file.empty()) {
+        p_arr = allocate_particles(config.n_part);
+        config.n_alloc = config.n_part;
+        init_particles(config, p_arr);
+    } else {
+        load_particles(config, p_arr, member.ic_file);
+    }
+
+    SPHSimulation sim(config, p_arr, &executor);
+    sim.set_output_dir(output_dir + "/" + std::to_string(member.index));
+    sim.set_show_progress(false);
+    sim.start(end_time);
+}
@@ -0,0 +1,81 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * ensemble.hpp defines the Ensemble class, which runs a parameter sweep: many SPHSimulations with
+ * different config values, all in one process. Rather than each member being a separate run of the
+ * program, the members share one pool of worker threads, so the process startup and thread setup
+ * are only paid once and several small members can keep every core busy between them.
+ *
+ * The sweep is described by a spec file, in the same format as config.txt (see ensemble.txt). It
+ * names a base config file, and gives a list of values for each property that should be swept
+ * over; every combination of these values is one member of the ensemble. Each member writes its
+ * dump files into its own directory, {output_dir}/{member index}/, and {output_dir}/index.txt
+ * lists which values each member used.
+ */
+
+#ifndef ensemble_hpp
+#define ensemble_hpp
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "basictypes.hpp"
+#include "setup.hpp"
+#include "task_graph.hpp"
+
+struct EnsembleMember {
+    int index;
+    ConfigMap values; // Values of the swept properties, by property name
+    Config config; // Full config of the member, i.e. the base config with the values above
+    std::string ic_file; // Initial conditions file from the config, if any (see load_particles)
+    double cost; // Estimated run time, in arbitrary units; see Ensemble::estimate_cost
+};
+
+class Ensemble {
+    public:
+        // ctor. Reads the sweep spec, then the base config, and sets up the config of each member.
+        // Invalid values are reported here, before anything has been run.
+        Ensemble(std::istream &spec_stream);
+
+        // Run every member, and block until they have all finished. Returns the number of members
+        // that failed.
+        int run();
+
+        int n_members() const { return members.size(); }
+
+    private:
+        // Spec properties
+        std::string config_file;
+        double end_time;
+        std::string output_dir;
+        int n_threads; // Worker threads shared by all members (0: one per hardware thread)
+        int max_concurrent; // Members running at once (0: twice the number of worker threads)
+
+        // Swept properties (in alphabetical order) and their values
+        std::vector<std::string> sweep_names;
+        std::vector<std::vector<std::string>> sweep_values;
+
+        // In the order that they should be started, i.e. most expensive first
+        std::vector<EnsembleMember> members;
+
+        // Set up the members from the base config, one for each combination of swept values
+        void build_members(const ConfigMap &base_config);
+
+        // Write {output_dir}/index.txt
+        void write_index() const;
+
+        // Set up and run a single member to completion, on the calling thread (with its tasks
+        // running on executor)
+        void run_member(const EnsembleMember &member, Executor &executor) const;
+
+        // Rough cost of running a simulation: the number of particle-neighbour interactions per
+        // step, times the number of steps. The number of neighbours is about 2 * KERNEL_RADIUS *
+        // h_factor.
+        double estimate_cost(const Config &config) const;
+
+        // Split a comma-separated list of values
+        static std::vector<std::string> split_values(const std::string &list);
+};
+
+#endif
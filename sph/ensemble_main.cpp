@@ -0,0 +1,47 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * ensemble_main.cpp contains the entrypoint for the ensemble driver (built with `make ensemble`),
+ * which runs a parameter sweep described by a spec file rather than a single simulation. See
+ * ensemble.hpp and ensemble.txt.
+ */
+
+#include <string>
+#include <fstream>
+
+#include "ensemble.hpp"
+#include "log.hpp"
+
+int main(int argc, char* argv[]) {
+    std::string filename;
+
+    // Check if alternative filename argument was given
+    if (argc >= 2) {
+        filename = argv[1];
+    } else {
+        filename = "./ensemble.txt";
+    }
+
+    LOG_INFO("Using ensemble spec file " << filename);
+
+    std::ifstream spec_stream;
+    spec_stream.open(filename);
+
+    if (!spec_stream) {
+        LOG_ERROR("Could not open ensemble spec file " << filename << " for reading."
+                  " Perhaps the file could not be found, or you do not have permission to read it.");
+
+        return 1;
+    }
+
+    Ensemble ensemble(spec_stream);
+    int n_failed = ensemble.run();
+
+    if (n_failed > 0) {
+        LOG_ERROR(n_failed << " / " << ensemble.n_members()
+                  << " ensemble members failed.");
+        return 1;
+    }
+
+    return 0;
+}
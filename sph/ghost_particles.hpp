@@ -14,7 +14,15 @@
 // Setup ghost particles. To be done for initial conditions and after each timestep. Takes particle
 // array pointer and Config by reference, as the array must be reallocated and n_part must be
 // changed.
-// This assumes that smoothing lengths for each particle has already been set.
+// This assumes that smoothing lengths for each particle has already been set, and that there are no
+// halo particles in the array yet, as the ghost particles are placed directly after the alive ones.
 void setup_ghost_particles(ParticleArrayPtr &p_arr, Config &config);
 
+// Whether an alive particle at pos with smoothing length h is close enough to a boundary to need a
+// ghost particle
+bool needs_ghost(const Config &config, double pos, double h);
+
+// Position of the ghost of a particle at pos, mirrored about the nearest boundary
+double ghost_position(const Config &config, double pos);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,173 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * ic_file.cpp implements the functions from ic_file.hpp.
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ic_file.hpp"
+#include "particle_array.hpp"
+#include "log.hpp"
+
+// Number of columns in a file with the given flags
+static int n_columns(uint32_t flags) {
+    int n = 3; // pos, mass, u
+    if (flags & IC_HAS_VEL)
+        n++;
+    if (flags & IC_HAS_H)
+        n++;
+    return n;
+}
+
+uint32_t read_ic_file(const std::string &filename, Config &config, ParticleArrayPtr &p_arr) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        LOG_ERROR("Could not open initial conditions file " << filename << " for reading: "
+                  << strerror(errno));
+        exit(1);
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+    size_t file_size = st.st_size;
+
+    if (file_size < sizeof(ICFileHeader)) {
+        LOG_ERROR("Initial conditions file " << filename << " is too short to contain a "
+                  << "header.");
+        exit(1);
+    }
+
+    void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("Could not map initial conditions file " << filename << " into memory: "
+                  << strerror(errno));
+        exit(1);
+    }
+
+    // Each column is read from start to end once, so let the kernel read ahead as far as it likes
+    madvise(mapped, file_size, MADV_SEQUENTIAL);
+
+    ICFileHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+
+    if (std::memcmp(header.magic, IC_FILE_MAGIC, sizeof(IC_FILE_MAGIC)) != 0) {
+        LOG_ERROR(filename << " is not an initial conditions file, or was written "
+                  << "by a different version of the program.");
+        exit(1);
+    }
+
+    if (header.n_part < 2 || header.n_part > (uint64_t)std::numeric_limits<int>::max()) {
+        LOG_ERROR("Initial conditions file " << filename << " has an invalid number of "
+                  << "particles (" << header.n_part << ").");
+        exit(1);
+    }
+
+    int n = header.n_part;
+    size_t expected_size = sizeof(ICFileHeader) + (size_t)n_columns(header.flags) * n * sizeof(double);
+
+    if (file_size != expected_size) {
+        LOG_ERROR("Initial conditions file " << filename << " should be " << expected_size
+                  << " bytes long for " << n << " particles, but is " << file_size << " bytes.");
+        exit(1);
+    }
+
+    // Columns follow the header, in the order given in ic_file.hpp
+    const double* column = (const double*)((const char*)mapped + sizeof(ICFileHeader));
+    auto next_column = [&column, n]() {
+        const double* c = column;
+        column += n;
+        return c;
+    };
+
+    const double* pos = next_column();
+    const double* vel = (header.flags & IC_HAS_VEL) ? next_column() : nullptr;
+    const double* mass = next_column();
+    const double* u = next_column();
+    const double* h = (header.flags & IC_HAS_H) ? next_column() : nullptr;
+
+    p_arr = allocate_particles(n);
+    config.n_part = n;
+    config.n_alloc = n;
+
+    for (int i = 0; i < n; i++) {
+        Particle &p = p_arr[i];
+
+        p.pos = pos[i];
+        p.vel = vel ? vel[i] : 0;
+        p.mass = mass[i];
+        p.u = u[i];
+        p.h = h ? h[i] : 0;
+
+        p.acc = 0;
+        p.du_dt = 0;
+        p.density = 0;
+        p.pressure = 0;
+        p.omega = 1;
+        p.drho_dt = 0;
+
+        // Ghost particles are made by reflecting particles about the boundaries, so every particle
+        // has to start inside them
+        if (!(std::abs(p.pos) < config.limit)) {
+            LOG_ERROR("Particle " << i << " in initial conditions file " << filename
+                      << " is at x = " << p.pos << ", outside of the boundaries at +/-"
+                      << config.limit << ".");
+            exit(1);
+        }
+    }
+
+    munmap(mapped, file_size);
+
+    LOG_INFO("Loaded " << n << " particles from initial conditions file " << filename
+             << ".");
+
+    return header.flags;
+}
+
+void write_ic_file(const std::string &filename, const Particle* particles, int n, uint32_t flags) {
+    std::ofstream outstream(filename, std::ios::binary);
+
+    if (!outstream) {
+        LOG_ERROR("Could not open initial conditions file " << filename << " for writing.");
+        exit(1);
+    }
+
+    ICFileHeader header = {};
+    std::memcpy(header.magic, IC_FILE_MAGIC, sizeof(IC_FILE_MAGIC));
+    header.flags = flags;
+    header.n_part = n;
+    outstream.write((const char*)&header, sizeof(header));
+
+    // Write a column at a time, through a buffer since the particles are stored as structs
+    std::vector<double> column(n);
+    auto write_column = [&](auto prop) {
+        for (int i = 0; i < n; i++)
+            column[i] = particles[i].*prop;
+        outstream.write((const char*)column.data(), n * sizeof(double));
+    };
+
+    write_column(&Particle::pos);
+    if (flags & IC_HAS_VEL)
+        write_column(&Particle::vel);
+    write_column(&Particle::mass);
+    write_column(&Particle::u);
+    if (flags & IC_HAS_H)
+        write_column(&Particle::h);
+
+    if (!outstream) {
+        LOG_ERROR("Failed to write initial conditions file " << filename << ".");
+        exit(1);
+    }
+}
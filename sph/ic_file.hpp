@@ -0,0 +1,45 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * ic_file.hpp defines functions to read and write binary initial conditions files, which let a run
+ * start from an arbitrary set of particles rather than the two-stream lattice made by
+ * init_particles. They are meant for very large runs, so the file is memory-mapped and each
+ * property is copied straight out of it, rather than being parsed particle by particle.
+ *
+ * The format is an ICFileHeader followed by one column per property, each an array of n_part
+ * doubles in native byte order: pos, vel, mass, u, h. The vel and h columns are optional, and are
+ * only present if the matching flag is set in the header.
+ */
+
+#ifndef ic_file_hpp
+#define ic_file_hpp
+
+#include <cstdint>
+#include <string>
+
+#include "basictypes.hpp"
+
+// First bytes of every initial conditions file. The last character is the format version.
+const char IC_FILE_MAGIC[8] = { 'S', 'P', 'H', '-', 'I', 'C', '-', '1' };
+
+// Flags for the optional columns
+const uint32_t IC_HAS_VEL = 1;
+const uint32_t IC_HAS_H = 2;
+
+struct ICFileHeader {
+    char magic[8];
+    uint32_t flags;
+    uint32_t reserved; // Keeps the columns 8-byte aligned. Should be 0.
+    uint64_t n_part;
+};
+
+// Allocate p_arr and fill it with the particles in the file. config.n_part and config.n_alloc are
+// set to the number of particles in the file. Returns the flags from the header, so the caller
+// knows which properties still need to be set up. Exits the program if the file can't be read or
+// is invalid.
+uint32_t read_ic_file(const std::string &filename, Config &config, ParticleArrayPtr &p_arr);
+
+// Write n particles to an initial conditions file, including the optional columns given in flags
+void write_ic_file(const std::string &filename, const Particle* particles, int n, uint32_t flags);
+
+#endif
@@ -0,0 +1,121 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * live_stream.cpp implements the LiveStream from live_stream.hpp.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "live_stream.hpp"
+#include "define.hpp"
+#include "log.hpp"
+
+LiveStream::LiveStream(const std::string &name, int capacity) : name(name), capacity(capacity) {
+    // Columns of doubles then the ids, rounded up to a cache line so that every slot starts on one
+    slot_size = sizeof(LiveSlotHeader) + this->capacity * (LIVE_STREAM_N_COLUMNS * sizeof(double) + sizeof(int32_t));
+    slot_size = (slot_size + 63) / 64 * 64;
+    map_size = sizeof(LiveStreamHeader) + LIVE_STREAM_SLOTS * slot_size;
+
+    // Replace any old segment, rather than resize it under the feet of a reader that still has it
+    // mapped. Readers of the old one keep it until they unmap it.
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+
+    if (fd < 0 || ftruncate(fd, map_size) != 0) {
+        LOG_ERROR("Failed to create the shared memory segment " << name << " for the live stream: "
+                  << std::strerror(errno));
+        exit(1);
+    }
+
+    void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        LOG_ERROR("Failed to map the shared memory segment " << name << " for the live stream: "
+                  << std::strerror(errno));
+        exit(1);
+    }
+
+    // ftruncate fills the segment with zeros, so every seq and count starts at 0. The magic goes in
+    // last, so that a reader doesn't use the segment before the rest of the header is there.
+    header = new (map) LiveStreamHeader;
+    header->n_slots = LIVE_STREAM_SLOTS;
+    header->capacity = this->capacity;
+    header->slot_size = slot_size;
+    header->latest.store(0);
+    header->finished.store(0);
+
+    for (uint64_t i = 0; i < LIVE_STREAM_SLOTS; i++)
+        new (slot(i)) LiveSlotHeader;
+
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, LIVE_STREAM_MAGIC, sizeof(LIVE_STREAM_MAGIC));
+
+    LOG_INFO("Publishing the particles to shared memory segment " << name << " (" << map_size
+             << " bytes).");
+}
+
+LiveStream::~LiveStream() {
+    header->finished.store(1, std::memory_order_release);
+    munmap(header, map_size);
+}
+
+uint8_t* LiveStream::slot(uint64_t i) const {
+    return (uint8_t*)header + sizeof(LiveStreamHeader) + i * slot_size;
+}
+
+void LiveStream::publish(const Particle* particles, int n, int step, double time) {
+    uint64_t n_alive = 0;
+    for (int i = 0; i < n; i++)
+        n_alive += particles[i].type == Alive;
+
+    if (n_alive > capacity) {
+        LOG_TALLY(LogWarn, "Live stream frames skipped, as there were too many particles",
+                  "Skipping live stream frame at step " << step << ": " << n_alive
+                  << " particles, but only room for " << capacity << ".");
+        return;
+    }
+
+    uint8_t* s = slot(n_frames % LIVE_STREAM_SLOTS);
+    LiveSlotHeader* slot_header = (LiveSlotHeader*)s;
+    double* columns = (double*)(s + sizeof(LiveSlotHeader));
+    int32_t* ids = (int32_t*)(columns + LIVE_STREAM_N_COLUMNS * capacity);
+
+    // Odd while the slot is being written. The fence stops the writes below being seen before it.
+    uint64_t seq = slot_header->seq.load(std::memory_order_relaxed);
+    slot_header->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot_header->frame = n_frames;
+    slot_header->step = step;
+    slot_header->time = time;
+    slot_header->n_part = n_alive;
+
+    uint64_t k = 0;
+    for (int i = 0; i < n; i++) {
+        const Particle &p = particles[i];
+        if (p.type != Alive)
+            continue;
+
+        columns[0 * capacity + k] = p.pos;
+        columns[1 * capacity + k] = p.vel;
+        columns[2 * capacity + k] = p.acc;
+        columns[3 * capacity + k] = p.h;
+        columns[4 * capacity + k] = p.density;
+        columns[5 * capacity + k] = p.pressure;
+        columns[6 * capacity + k] = p.u;
+        ids[k] = p.id;
+        k++;
+    }
+
+    // Even again: the frame is complete, and is the latest one
+    slot_header->seq.store(seq + 2, std::memory_order_release);
+    n_frames++;
+    header->latest.store(n_frames, std::memory_order_release);
+}
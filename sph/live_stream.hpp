@@ -0,0 +1,96 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * live_stream.hpp defines the LiveStream, which publishes the alive particles into a POSIX shared
+ * memory segment every few steps (when live_stream is set in config.txt), so that another process
+ * can watch the run as it goes, e.g. live_view.py, rather than waiting for the dump files.
+ *
+ * The segment is a ring of LIVE_STREAM_SLOTS slots, each holding one frame. Frames are written to
+ * the slots in turn, so a reader has until the ring comes back round to use a frame. Each slot is
+ * guarded by a seqlock: its sequence number is odd while it is being written and is incremented
+ * again once it is done, so a reader checks that the sequence number was even and unchanged before
+ * and after it used the frame, and otherwise skips it. Readers only ever read, so however slow they
+ * are, they never hold up the simulation, and the columns are laid out so that they can be used
+ * straight from the mapped memory (e.g. with numpy.frombuffer) without copying.
+ *
+ * Layout (native byte order; every field is 8 bytes unless stated):
+ *
+ *   LiveStreamHeader (64 bytes): magic "SPH-LIV1", n_slots, capacity (particles per slot),
+ *     slot_size (bytes), latest (number of frames finished; the last one is in slot
+ *     (latest - 1) % n_slots), finished (1 once the simulation is over)
+ *   then n_slots slots of slot_size bytes, each:
+ *     LiveSlotHeader (64 bytes): seq, frame, step, time (double), n_part
+ *     capacity doubles for each of pos, vel, acc, h, density, pressure, u (in that order), then
+ *     capacity int32 ids. Only the first n_part of each column are part of the frame.
+ *
+ * The segment is left behind after the run so that the final state can still be looked at, and is
+ * replaced by the next run with the same name. It can be removed with `rm /dev/shm/{name}`.
+ */
+
+#ifndef live_stream_hpp
+#define live_stream_hpp
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "basictypes.hpp"
+
+// First bytes of the segment. The last character is the layout version.
+const char LIVE_STREAM_MAGIC[8] = { 'S', 'P', 'H', '-', 'L', 'I', 'V', '1' };
+
+const int LIVE_STREAM_N_COLUMNS = 7; // pos, vel, acc, h, density, pressure, u
+
+struct LiveStreamHeader {
+    char magic[8];
+    uint64_t n_slots;
+    uint64_t capacity;
+    uint64_t slot_size;
+    std::atomic<uint64_t> latest;
+    std::atomic<uint64_t> finished;
+    uint64_t reserved[2];
+};
+
+struct LiveSlotHeader {
+    std::atomic<uint64_t> seq;
+    uint64_t frame;
+    uint64_t step;
+    double time;
+    uint64_t n_part;
+    uint64_t reserved[3];
+};
+
+// The readers are other processes, so the atomics have to work without any help from this one
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory needs lock-free 64 bit atomics");
+static_assert(sizeof(LiveStreamHeader) == 64 && sizeof(LiveSlotHeader) == 64, "Live stream headers must be 64 bytes");
+
+class LiveStream {
+    public:
+        // ctor. Creates (or replaces) the shared memory segment called name, e.g. "/sph_live", with
+        // room for capacity particles per frame. Exits the program if it can't be created.
+        LiveStream(const std::string &name, int capacity);
+        // dtor. Marks the stream as finished and unmaps it, but leaves the segment for readers.
+        ~LiveStream();
+
+        LiveStream(const LiveStream&) = delete;
+        LiveStream& operator =(const LiveStream&) = delete;
+
+        // Publish the alive particles out of the n given as the next frame. Never waits for readers.
+        // If there are more alive particles than there is room for, the frame is skipped (with a
+        // warning).
+        void publish(const Particle* particles, int n, int step, double time);
+
+    private:
+        std::string name;
+        uint64_t capacity;
+        uint64_t slot_size;
+        size_t map_size;
+
+        LiveStreamHeader* header;
+        uint64_t n_frames = 0;
+
+        // Start of slot i, i.e. its header, which is followed by the columns
+        uint8_t* slot(uint64_t i) const;
+};
+
+#endif
@@ -0,0 +1,187 @@
+# Watch a simulation as it runs, from the live stream it publishes to shared memory (set live_stream
+# in config.txt, see live_stream.hpp for the layout). The frames are used straight from the shared
+# memory with numpy, without copying them or holding up the simulation.
+#
+# Usage: python3 live_view.py [NAME] [--print]
+# e.g.   python3 live_view.py /sph_live
+#
+# Shows the density, velocity, pressure and thermal energy against position, updated as new frames
+# come in. With --print, prints the step, time and position of the shock fronts of each new frame
+# instead, e.g. over ssh. Can be started before or after the simulation, and switches over to the
+# next run with the same name when it starts.
+
+import mmap
+import os
+import struct
+import sys
+import time
+
+import numpy as np
+
+MAGIC = b"SPH-LIV1"
+HEADER = struct.Struct("=8sQQQQQ") # magic, n_slots, capacity, slot_size, latest, finished
+SLOT_HEADER = struct.Struct("=QQQdQ") # seq, frame, step, time, n_part
+HEADER_SIZE = 64 # Both headers are padded to 64 bytes
+COLUMNS = ["pos", "vel", "acc", "h", "density", "pressure", "u"]
+
+class Frame:
+    def __init__(self, slot, seq, step, time, columns):
+        self.slot = slot
+        self.seq = seq
+        self.step = step
+        self.time = time
+        # numpy arrays onto the shared memory, so only valid until the simulation comes back round
+        # to this slot; check with LiveStream.still_valid once done with them
+        self.columns = columns
+
+    def __getitem__(self, name):
+        return self.columns[name]
+
+class LiveStream:
+    def __init__(self, name):
+        self.path = "/dev/shm/" + name.lstrip("/")
+        with open(self.path, "rb") as f:
+            self.inode = os.fstat(f.fileno()).st_ino
+            self.buffer = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+
+        magic, self.n_slots, self.capacity, self.slot_size, _, _ = HEADER.unpack_from(self.buffer, 0)
+        if magic != MAGIC:
+            raise ValueError(f"{name} is not a live stream (or is still being set up)")
+
+        # Views onto every column of every slot, made once up front
+        self.slots = []
+        for s in range(self.n_slots):
+            offset = self.slot_offset(s) + HEADER_SIZE
+            columns = {}
+            for c, column in enumerate(COLUMNS):
+                columns[column] = np.frombuffer(self.buffer, np.float64, self.capacity, offset + c * 8 * self.capacity)
+            columns["id"] = np.frombuffer(self.buffer, np.int32, self.capacity, offset + len(COLUMNS) * 8 * self.capacity)
+            self.slots.append(columns)
+
+    def slot_offset(self, slot):
+        return HEADER_SIZE + slot * self.slot_size
+
+    def n_frames(self):
+        return HEADER.unpack_from(self.buffer, 0)[4]
+
+    def finished(self):
+        return HEADER.unpack_from(self.buffer, 0)[5] == 1
+
+    def latest(self):
+        """The latest complete frame, or None if there isn't one yet (or it's being overwritten)"""
+        n_frames = self.n_frames()
+        if n_frames == 0:
+            return None
+
+        slot = (n_frames - 1) % self.n_slots
+        seq, _, step, t, n_part = SLOT_HEADER.unpack_from(self.buffer, self.slot_offset(slot))
+        if seq % 2 == 1:
+            return None
+
+        columns = {name: view[:n_part] for name, view in self.slots[slot].items()}
+        return Frame(slot, seq, step, t, columns)
+
+    def replaced(self):
+        """Whether a new run has replaced the segment with its own"""
+        try:
+            return os.stat(self.path).st_ino != self.inode
+        except FileNotFoundError:
+            return False
+
+    def still_valid(self, frame):
+        """Whether nothing has been written to the frame's slot since it was read"""
+        return SLOT_HEADER.unpack_from(self.buffer, self.slot_offset(frame.slot))[0] == frame.seq
+
+def open_stream(name):
+    # The simulation may not have made the segment yet
+    while True:
+        try:
+            return LiveStream(name)
+        except (FileNotFoundError, ValueError):
+            time.sleep(0.5)
+
+def shock_fronts(pos, density):
+    # Steepest rise and fall in density, much like the shock fronts found by analysis.cpp
+    order = np.argsort(pos)
+    x, rho = pos[order], density[order]
+    jumps = np.diff(rho)
+    left = np.argmax(jumps) if len(jumps) else 0
+    right = np.argmin(jumps) if len(jumps) else 0
+    return 0.5 * (x[left] + x[left + 1]), 0.5 * (x[right] + x[right + 1])
+
+def print_frames(name):
+    # Exits once a run that was watched while it was going has finished. A segment left behind by an
+    # earlier run is shown, then replaced by the next run as soon as it starts.
+    stream = open_stream(name)
+    seen_running = False
+    last_step = None
+
+    while True:
+        if stream.replaced():
+            stream = open_stream(name)
+            last_step = None
+
+        finished = stream.finished()
+        seen_running = seen_running or not finished
+
+        frame = stream.latest()
+        if frame is not None and frame.step != last_step:
+            rho_max = frame["density"].max()
+            left, right = shock_fronts(frame["pos"], frame["density"])
+            if stream.still_valid(frame):
+                print(f"step {frame.step:6d}  t = {frame.time:.4f}  max density {rho_max:.4f}  "
+                      f"shocks at {left:+.4f}, {right:+.4f}", flush=True)
+                last_step = frame.step
+
+        if seen_running and finished and frame is not None and frame.step == last_step:
+            return
+        time.sleep(0.05)
+
+def plot_frames(name):
+    import matplotlib.pyplot as plt
+    from matplotlib.animation import FuncAnimation
+
+    fig, axes = plt.subplots(2, 2, figsize=(12, 8))
+    plots = [("density", "Density"), ("vel", "Velocity"), ("pressure", "Pressure"), ("u", "Thermal energy")]
+    lines = []
+    for ax, (_, label) in zip(axes.flat, plots):
+        line, = ax.plot([], [], ".", markersize=3)
+        ax.set_xlabel("Position")
+        ax.set_ylabel(label)
+        lines.append(line)
+
+    stream = open_stream(name)
+
+    def update(_):
+        nonlocal stream
+        if stream.replaced():
+            stream = open_stream(name)
+
+        frame = stream.latest()
+        if frame is None:
+            return lines
+
+        # set_data takes copies, so the frame only has to stay valid until then. If it was
+        # overwritten part way through, the next update replaces it.
+        for line, (column, _) in zip(lines, plots):
+            line.set_data(frame["pos"], frame[column])
+        if not stream.still_valid(frame):
+            return lines
+
+        for ax in axes.flat:
+            ax.relim()
+            ax.autoscale_view()
+        fig.suptitle(f"Step {frame.step}, t = {frame.time:.4f}" + (" (finished)" if stream.finished() else ""))
+        return lines
+
+    animation = FuncAnimation(fig, update, interval=100, cache_frame_data=False)
+    plt.show()
+
+if __name__ == "__main__":
+    args = [a for a in sys.argv[1:] if not a.startswith("--")]
+    name = args[0] if args else "/sph_live"
+
+    if "--print" in sys.argv:
+        print_frames(name)
+    else:
+        plot_frames(name)
@@ -0,0 +1,138 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * log.cpp implements the Logger from log.hpp.
+ */
+
+#include <cstdio>
+
+#include "log.hpp"
+#include "define.hpp"
+
+static const char* const LogLevelPrefixes[4] = {
+    "[DEBUG] ",
+    "[INFO] ",
+    "[WARN] ",
+    "[ERROR] "
+};
+
+Logger& Logger::get() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger() : buffer(LOG_BUFFER_SIZE) {
+    writer = std::thread(&Logger::run, this);
+}
+
+Logger::~Logger() {
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex);
+        stopping = true;
+    }
+    queued.notify_one();
+    writer.join();
+}
+
+void Logger::write(LogLevel level, std::string message) {
+    if (level == LogError) {
+        // Written by this thread, so that it is out before the program exits
+        std::lock_guard<std::mutex> lock(output_mutex);
+        drain();
+        output({ level, std::move(message) });
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex);
+
+        // Don't hold up the simulation if the console can't keep up; say how many were lost later
+        if (n_queued == buffer.size()) {
+            n_dropped++;
+            return;
+        }
+
+        buffer[(head + n_queued) % buffer.size()] = { level, std::move(message) };
+        n_queued++;
+    }
+    queued.notify_one();
+}
+
+bool Logger::tally(LogLevel level, const std::string &summary) {
+    std::lock_guard<std::mutex> lock(tally_mutex);
+    Tally &t = tallies[summary];
+    t.level = level;
+    return ++t.count <= LOG_TALLY_DETAIL;
+}
+
+void Logger::flush_tallies() {
+    std::map<std::string, Tally> counts;
+    {
+        std::lock_guard<std::mutex> lock(tally_mutex);
+        counts.swap(tallies);
+    }
+
+    for (auto &[summary, t] : counts) {
+        // Everything has already been written in full
+        if (t.count <= LOG_TALLY_DETAIL)
+            continue;
+
+        std::ostringstream message;
+        message << summary << ": " << t.count << " times (" << LOG_TALLY_DETAIL << " shown above)";
+        write(t.level, message.str());
+    }
+}
+
+void Logger::flush() {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    drain();
+}
+
+void Logger::run() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(buffer_mutex);
+            queued.wait(lock, [this] { return n_queued > 0 || stopping; });
+
+            if (n_queued == 0 && stopping)
+                return;
+        }
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        drain();
+    }
+}
+
+void Logger::drain() {
+    std::vector<Entry> entries;
+    uint64_t dropped;
+
+    {
+        std::lock_guard<std::mutex> lock(buffer_mutex);
+        entries.reserve(n_queued);
+        for (; n_queued > 0; n_queued--) {
+            entries.push_back(std::move(buffer[head]));
+            head = (head + 1) % buffer.size();
+        }
+
+        dropped = n_dropped;
+        n_dropped = 0;
+    }
+
+    for (const Entry &entry : entries)
+        output(entry);
+
+    if (dropped > 0)
+        output({ LogWarn, std::to_string(dropped) + " log messages were dropped, as they were logged faster than they could be written" });
+
+    // One flush for the whole batch, rather than one per line
+    std::fflush(stdout);
+}
+
+void Logger::output(const Entry &entry) {
+    // Errors go to stderr, which isn't buffered, and everything else to stdout
+    std::FILE* stream = entry.level == LogError ? stderr : stdout;
+    std::fputs(LogLevelPrefixes[entry.level], stream);
+    std::fputs(entry.message.c_str(), stream);
+    std::fputc('\n', stream);
+}
@@ -0,0 +1,128 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * log.hpp defines the Logger, which all of the program's messages go through. Messages are put in
+ * a ring buffer and written out by a background thread, so a thread logging a message never waits
+ * on the console. Errors are the exception: they are written straight away (after anything still in
+ * the buffer), as the program usually exits right after them.
+ *
+ * Messages that can be repeated for many particles in one step (e.g. root-finding warnings) should
+ * be tallied with LOG_TALLY instead. Only the first few of each are written in full, and the rest
+ * are summarised in one line by flush_tallies(), which the simulation calls every step.
+ *
+ * The LOG_* macros take anything that can be streamed, e.g. LOG_INFO("t = " << time), and don't
+ * build the message at all if its level isn't shown.
+ */
+
+#ifndef log_hpp
+#define log_hpp
+
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum LogLevel {
+    LogDebug,
+    LogInfo,
+    LogWarn,
+    LogError
+};
+
+class Logger {
+    public:
+        // The logger for the whole program. The background thread is started on first use.
+        static Logger& get();
+
+        // Messages below this level aren't shown. Default is LogInfo.
+        void set_level(LogLevel level) {
+            min_level = level;
+        }
+
+        bool enabled(LogLevel level) const {
+            return level >= min_level;
+        }
+
+        // Queue a message to be written. If the buffer is full, the message is dropped (and counted)
+        // rather than waiting, unless it is an error.
+        void write(LogLevel level, std::string message);
+
+        // Count a message under its summary. Returns true for the first LOG_TALLY_DETAIL with the
+        // same summary since the last flush_tallies(), which should also be written in full.
+        bool tally(LogLevel level, const std::string &summary);
+
+        // Write a line with the count of each summary that has been tallied, and reset the counts
+        void flush_tallies();
+
+        // Write everything in the buffer, and wait until it has been written
+        void flush();
+
+    private:
+        struct Entry {
+            LogLevel level;
+            std::string message;
+        };
+
+        struct Tally {
+            LogLevel level;
+            int count = 0;
+        };
+
+        Logger();
+        // Writes anything left in the buffer, then stops the background thread
+        ~Logger();
+
+        LogLevel min_level = LogInfo;
+
+        // Ring buffer of messages waiting to be written, protected by buffer_mutex
+        std::vector<Entry> buffer;
+        size_t head = 0;
+        size_t n_queued = 0;
+        uint64_t n_dropped = 0;
+        bool stopping = false;
+        std::mutex buffer_mutex;
+        std::condition_variable queued;
+
+        // Held while writing to the console, so that messages come out in the order they were logged
+        std::mutex output_mutex;
+
+        std::map<std::string, Tally> tallies;
+        std::mutex tally_mutex;
+
+        std::thread writer;
+
+        // Background thread: waits for messages and writes them out
+        void run();
+
+        // Take everything out of the buffer and write it. output_mutex must be held.
+        void drain();
+
+        static void output(const Entry &entry);
+};
+
+#define LOG(level, message) do {                          \
+        if (Logger::get().enabled(level)) {               \
+            std::ostringstream log_stream;                \
+            log_stream << message;                        \
+            Logger::get().write(level, log_stream.str()); \
+        }                                                 \
+    } while (0)
+
+#define LOG_DEBUG(message) LOG(LogDebug, message)
+#define LOG_INFO(message) LOG(LogInfo, message)
+#define LOG_WARN(message) LOG(LogWarn, message)
+#define LOG_ERROR(message) LOG(LogError, message)
+
+#define LOG_TALLY(level, summary, message) do {                                      \
+        if (Logger::get().enabled(level) && Logger::get().tally(level, summary)) {   \
+            std::ostringstream log_stream;                                           \
+            log_stream << message;                                                   \
+            Logger::get().write(level, log_stream.str());                            \
+        }                                                                            \
+    } while (0)
+
+#endif
@@ -14,15 +14,25 @@
 
 #include <string>
 #include <fstream>
-#include <iostream>
 #include <memory>
 
 #include "setup.hpp"
 #include "basictypes.hpp"
+#include "particle_array.hpp"
 #include "sph_simulation.hpp"
+#include "out_of_core.hpp"
+#include "log.hpp"
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
 
 
 int main(int argc, char* argv[]) {
+    #ifdef USE_MPI
+    MPI_Init(&argc, &argv);
+    #endif
+
     std::string filename;
 
     // Check if alternative filename argument was given
@@ -34,14 +44,14 @@ int main(int argc, char* argv[]) {
         filename = "./config.txt";
     }
     
-    std::cout << "[INFO] Using config file " << filename << std::endl;
+    LOG_INFO("Using config file " << filename);
 
     std::ifstream config_stream;
     config_stream.open(filename);
 
     if (!config_stream) {
-        std::cerr << "[ERROR] Could not open config file " << filename << " for reading. Perhaps"
-        " the file could not be found, or you do not have permission to read it." << std::endl;
+        LOG_ERROR("Could not open config file " << filename << " for reading. Perhaps"
+                  " the file could not be found, or you do not have permission to read it.");
         
         return 1;
     }
@@ -49,33 +59,45 @@ int main(int argc, char* argv[]) {
     // Read in config file, and only take actual values
     auto config_reader = ConfigReader(config_stream);
     Config config = config_reader.GetConfig();
+    Logger::get().set_level((LogLevel)config.log_level);
+    std::string ic_file = config_reader.GetICFile();
+    std::string out_of_core = config_reader.GetOutOfCore();
 
-    // Allocate memory for particle array. Using a vector would've been way easier but I thought an
-    // array would be mOrE eFfIcIeNt and now I can't be bothered to change it
     ParticleArrayPtr p_arr;
-    
-    try {
-        Particle* p_ptr = new Particle[config.n_part];
-        // Initialize shared pointer with this new memory
-        p_arr.reset(p_ptr);
-    } catch (std::bad_alloc &e) {
-        // Memory allocation failed
-        size_t bytes = config.n_part * sizeof(Particle);
-
-        std::cerr << "[ERROR] Failed to allocate memory for particle array!" << std::endl;
-        std::cerr << "[ERROR] Attempted to allocate " << bytes << " bytes for " << config.n_part
-                  << " particles" << std::endl;
-        exit(1);
+
+    if (!out_of_core.empty()) {
+        // The particles are set up in the file instead, a window at a time
+        LOG_INFO("Initializing particles in " << out_of_core << ", in windows of "
+                 << config.out_of_core_window << "...");
+        auto sim = OutOfCoreSimulation(config, out_of_core);
+        sim.start(1);
+    } else if (ic_file.empty()) {
+        // Allocate memory for particle array. Using a vector would've been way easier but I thought
+        // an array would be mOrE eFfIcIeNt and now I can't be bothered to change it
+        p_arr = allocate_particles(config.n_part);
+        config.n_alloc = config.n_part;
+
+        // Initialize position, velocity, and mass values. p_arr will be reallocated to fit the
+        // ghost particles in.
+        LOG_INFO("Initializing particle array...");
+        init_particles(config, p_arr);
+    } else {
+        // Particles come from a file instead, which also decides how many there are
+        LOG_INFO("Loading particle array from " << ic_file << "...");
+        load_particles(config, p_arr, ic_file);
     }
 
-    // Initialize position, velocity, and mass values. p_arr will be reallocated to fit the ghost
-    // particles in.
-    std::cout << "[INFO] Initializing particle array..." << std::endl;
-    init_particles(config, p_arr);
+    if (out_of_core.empty()) {
+        // Create simulation object
+        auto sim = SPHSimulation(config, p_arr);
+        sim.set_live_stream(config_reader.GetLiveStream());
+        sim.set_metrics_socket(config_reader.GetMetricsSocket());
+        sim.start(1);
+    }
 
-    // Create simulation object
-    auto sim = SPHSimulation(config, p_arr);
-    sim.start(1);
+    #ifdef USE_MPI
+    MPI_Finalize();
+    #endif
 
     return 0;
 }
\ No newline at end of file
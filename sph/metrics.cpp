@@ -0,0 +1,304 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * metrics.cpp implements the MetricCounter and MetricsServer from metrics.hpp.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "metrics.hpp"
+#include "log.hpp"
+
+#pragma region MetricCounter
+
+uint64_t MetricCounter::value() const {
+    uint64_t total = 0;
+    for (const Shard &shard : shards)
+        total += shard.value.load(std::memory_order_relaxed);
+    return total;
+}
+
+int MetricCounter::shard_index() {
+    static std::atomic<int> next_shard(0);
+    thread_local int shard = next_shard++ % METRICS_SHARDS;
+    return shard;
+}
+
+SolverCounters& solver_counters() {
+    static SolverCounters counters;
+    return counters;
+}
+
+#pragma endregion
+
+#pragma region MetricsServer
+
+// Resident and peak resident memory of the process, in bytes
+static void memory_use(uint64_t &resident, uint64_t &peak) {
+    resident = 0;
+    long pages_total, pages_resident;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages_total, &pages_resident) == 2)
+            resident = (uint64_t)pages_resident * sysconf(_SC_PAGESIZE);
+        fclose(statm);
+    }
+
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    // The kernel only updates the peak now and then
+    peak = std::max((uint64_t)usage.ru_maxrss * 1024, resident);
+}
+
+MetricsServer::MetricsServer(const std::string &path) : path(path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        LOG_ERROR("Metrics socket path " << path << " is too long (at most "
+                  << sizeof(address.sun_path) - 1 << " characters).");
+        return;
+    }
+    std::strcpy(address.sun_path, path.c_str());
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        LOG_ERROR("Could not make metrics socket: " << strerror(errno));
+        return;
+    }
+
+    // Left behind by an earlier run, most likely
+    unlink(path.c_str());
+
+    if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listen_fd, 8) < 0) {
+        LOG_ERROR("Could not listen on metrics socket " << path << ": " << strerror(errno));
+        close(listen_fd);
+        listen_fd = -1;
+        return;
+    }
+
+    LOG_INFO("Serving metrics on " << path << ".");
+    thread = std::thread(&MetricsServer::serve, this);
+}
+
+MetricsServer::~MetricsServer() {
+    if (listen_fd < 0)
+        return;
+
+    stopping = true;
+    thread.join();
+    close(listen_fd);
+    unlink(path.c_str());
+}
+
+void MetricsServer::set_progress(int step, double time) {
+    this->step.store(step, std::memory_order_relaxed);
+    this->time.store(time, std::memory_order_relaxed);
+
+    // Rate over the last METRICS_RATE_SECONDS or so, rather than since the start, so that it shows
+    // the run slowing down as it goes
+    auto now = std::chrono::steady_clock::now();
+    if (rate_start_step < 0) {
+        rate_start = now;
+        rate_start_step = step;
+        return;
+    }
+
+    double elapsed = std::chrono::duration<double>(now - rate_start).count();
+    if (elapsed >= METRICS_RATE_SECONDS) {
+        steps_per_second.store((step - rate_start_step) / elapsed, std::memory_order_relaxed);
+        rate_start = now;
+        rate_start_step = step;
+    }
+}
+
+void MetricsServer::set_particles(int n_alive, int n_ghost, int n_halo) {
+    this->n_alive.store(n_alive, std::memory_order_relaxed);
+    this->n_ghost.store(n_ghost, std::memory_order_relaxed);
+    this->n_halo.store(n_halo, std::memory_order_relaxed);
+}
+
+void MetricsServer::set_phase_seconds(ProfilePhase phase, double seconds) {
+    phase_seconds[phase].store(seconds, std::memory_order_relaxed);
+}
+
+void MetricsServer::set_conserved(double energy, double momentum) {
+    if (!have_initial) {
+        initial_energy = energy;
+        initial_momentum = momentum;
+        have_initial = true;
+    }
+
+    this->energy.store(energy, std::memory_order_relaxed);
+    this->momentum.store(momentum, std::memory_order_relaxed);
+    // Relative for the energy. The momentum starts at (about) 0 for the colliding streams, so that
+    // can only be the change.
+    double drift = energy - initial_energy;
+    if (initial_energy != 0)
+        drift /= std::abs(initial_energy);
+    energy_drift.store(drift, std::memory_order_relaxed);
+    momentum_drift.store(momentum - initial_momentum, std::memory_order_relaxed);
+}
+
+std::string MetricsServer::prometheus() const {
+    std::ostringstream out;
+    out.precision(17);
+
+    auto metric = [&out](const char* name, const char* type, const char* help) {
+        out << "# HELP sph_" << name << " " << help << "\n";
+        out << "# TYPE sph_" << name << " " << type << "\n";
+    };
+
+    metric("time", "gauge", "Simulation time");
+    out << "sph_time " << time.load() << "\n";
+    metric("steps_total", "counter", "Timesteps taken");
+    out << "sph_steps_total " << step.load() << "\n";
+    metric("steps_per_second", "gauge", "Timesteps per second of wall-clock time, recently");
+    out << "sph_steps_per_second " << steps_per_second.load() << "\n";
+    metric("finished", "gauge", "1 once the run is over");
+    out << "sph_finished " << (finished.load() ? 1 : 0) << "\n";
+
+    metric("phase_seconds_total", "counter",
+           "Time spent in each phase of the timestep, summed over the threads");
+    for (int phase = 0; phase < N_PROFILE_PHASES; phase++) {
+        out << "sph_phase_seconds_total{phase=\"" << PhaseProfiler::phase_name((ProfilePhase)phase)
+            << "\"} " << phase_seconds[phase].load() << "\n";
+    }
+
+    SolverCounters &solver = solver_counters();
+    metric("h_solves_total", "counter", "Smoothing lengths solved for");
+    out << "sph_h_solves_total " << solver.solves.value() << "\n";
+    metric("h_iterations_total", "counter", "Newton-Raphson iterations of the smoothing length solves");
+    out << "sph_h_iterations_total " << solver.iterations.value() << "\n";
+    metric("h_fallbacks_total", "counter", "Smoothing length solves that fell back to bisection");
+    out << "sph_h_fallbacks_total " << solver.fallbacks.value() << "\n";
+    metric("h_quiescent_total", "counter", "Particles whose smoothing length solve was skipped");
+    out << "sph_h_quiescent_total " << solver.quiescent.value() << "\n";
+
+    metric("particles", "gauge", "Number of particles of each type");
+    out << "sph_particles{type=\"alive\"} " << n_alive.load() << "\n";
+    out << "sph_particles{type=\"ghost\"} " << n_ghost.load() << "\n";
+    out << "sph_particles{type=\"halo\"} " << n_halo.load() << "\n";
+
+    uint64_t resident, peak;
+    memory_use(resident, peak);
+    metric("resident_bytes", "gauge", "Resident memory of the process");
+    out << "sph_resident_bytes " << resident << "\n";
+    metric("peak_resident_bytes", "gauge", "Most resident memory the process has used");
+    out << "sph_peak_resident_bytes " << peak << "\n";
+
+    metric("energy", "gauge", "Total kinetic and thermal energy of the alive particles");
+    out << "sph_energy " << energy.load() << "\n";
+    metric("energy_drift", "gauge", "Change in the total energy since the start, relative to it");
+    out << "sph_energy_drift " << energy_drift.load() << "\n";
+    metric("momentum", "gauge", "Total momentum of the alive particles");
+    out << "sph_momentum " << momentum.load() << "\n";
+    metric("momentum_drift", "gauge", "Change in the total momentum since the start");
+    out << "sph_momentum_drift " << momentum_drift.load() << "\n";
+
+    return out.str();
+}
+
+std::string MetricsServer::json() const {
+    std::ostringstream out;
+    out.precision(17);
+
+    SolverCounters &solver = solver_counters();
+    uint64_t resident, peak;
+    memory_use(resident, peak);
+
+    out << "{\"time\": " << time.load()
+        << ", \"step\": " << step.load()
+        << ", \"steps_per_second\": " << steps_per_second.load()
+        << ", \"finished\": " << (finished.load() ? "true" : "false");
+
+    out << ", \"phase_seconds\": {";
+    for (int phase = 0; phase < N_PROFILE_PHASES; phase++) {
+        out << (phase > 0 ? ", " : "") << "\"" << PhaseProfiler::phase_name((ProfilePhase)phase)
+            << "\": " << phase_seconds[phase].load();
+    }
+    out << "}";
+
+    out << ", \"h_solver\": {\"solves\": " << solver.solves.value()
+        << ", \"iterations\": " << solver.iterations.value()
+        << ", \"fallbacks\": " << solver.fallbacks.value()
+        << ", \"quiescent\": " << solver.quiescent.value() << "}";
+    out << ", \"particles\": {\"alive\": " << n_alive.load() << ", \"ghost\": " << n_ghost.load()
+        << ", \"halo\": " << n_halo.load() << "}";
+    out << ", \"memory\": {\"resident_bytes\": " << resident << ", \"peak_resident_bytes\": " << peak
+        << "}";
+    out << ", \"conservation\": {\"energy\": " << energy.load()
+        << ", \"energy_drift\": " << energy_drift.load()
+        << ", \"momentum\": " << momentum.load()
+        << ", \"momentum_drift\": " << momentum_drift.load() << "}}\n";
+
+    return out.str();
+}
+
+void MetricsServer::serve() {
+    pollfd listener = { listen_fd, POLLIN, 0 };
+
+    while (!stopping) {
+        // Woken up now and then to check whether to stop
+        if (poll(&listener, 1, METRICS_POLL_MS) <= 0)
+            continue;
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+
+        answer(fd);
+        close(fd);
+    }
+}
+
+void MetricsServer::answer(int fd) {
+    // Clients don't have to ask for anything, so only wait a moment for a request
+    char request[1024];
+    ssize_t n = 0;
+    pollfd client = { fd, POLLIN, 0 };
+    if (poll(&client, 1, METRICS_POLL_MS) > 0)
+        n = read(fd, request, sizeof(request) - 1);
+    request[n > 0 ? n : 0] = '\0';
+
+    // e.g. "GET /metrics.json HTTP/1.1" from curl. Only the first line is looked at.
+    bool http = std::strncmp(request, "GET ", 4) == 0;
+    std::string first_line(request, std::strcspn(request, "\r\n"));
+    bool as_json = first_line.find("json") != std::string::npos;
+
+    std::string body = as_json ? json() : prometheus();
+    std::string response;
+    if (http) {
+        response = "HTTP/1.0 200 OK\r\nContent-Type: ";
+        response += as_json ? "application/json" : "text/plain; version=0.0.4";
+        response += "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+    }
+    response += body;
+
+    // MSG_NOSIGNAL, so that a client that has already gone doesn't kill the program with SIGPIPE
+    const char* data = response.data();
+    size_t left = response.size();
+    while (left > 0) {
+        ssize_t sent = send(fd, data, left, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += sent;
+        left -= sent;
+    }
+}
+
+#pragma endregion
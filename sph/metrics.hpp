@@ -0,0 +1,123 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * metrics.hpp defines the metrics endpoint, for keeping an eye on long runs without tailing their
+ * output. When metrics_socket is set in config.txt, a background thread listens on a Unix domain
+ * socket of that name, and answers anything that connects with the current state of the run: the
+ * simulation time and step, steps per second, the time spent in each phase of the timestep, the
+ * number of smoothing lengths solved for (with the Newton-Raphson iterations they took, and how many
+ * fell back to bisection), the numbers of particles, the memory used, and how far the total energy
+ * and momentum have drifted from the start. For example:
+ *
+ *   curl --unix-socket /tmp/sph.sock http://localhost/metrics        (Prometheus text format)
+ *   curl --unix-socket /tmp/sph.sock http://localhost/metrics.json   (JSON)
+ *   echo json | socat - UNIX-CONNECT:/tmp/sph.sock                  (JSON without HTTP)
+ *
+ * Nothing the server does can hold up the simulation. The simulation stores its values in atomics
+ * after each step, and the counters that are added to from the hot path (the root-finding of every
+ * particle) are MetricCounters, which each thread adds to its own shard of, without locks or
+ * sharing cache lines. The server only ever reads them.
+ *
+ * With MPI, only the root rank serves the metrics. The time, step and conservation are those of the
+ * whole run, and the rest are the root rank's own.
+ */
+
+#ifndef metrics_hpp
+#define metrics_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "define.hpp"
+#include "profiler.hpp"
+
+// Counter that any number of threads can add to at once. Each thread adds to its own shard (on its
+// own cache line), and the shards are only summed when the counter is read.
+class MetricCounter {
+    public:
+        void add(uint64_t n) {
+            shards[shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const;
+
+    private:
+        struct alignas(64) Shard {
+            std::atomic<uint64_t> value{0};
+        };
+
+        Shard shards[METRICS_SHARDS];
+
+        // Shard of the calling thread, handed out to threads in turn
+        static int shard_index();
+};
+
+// Counters of the smoothing length root-finding in smoothing_length.cpp, over the whole program
+struct SolverCounters {
+    MetricCounter solves; // Smoothing lengths solved for
+    MetricCounter iterations; // Newton-Raphson iterations, over all of the solves
+    MetricCounter fallbacks; // Solves that fell back to bisection
+    MetricCounter quiescent; // Particles that skipped the solve, see h_activity_tol in config.txt
+};
+
+// The program's solver counters
+SolverCounters& solver_counters();
+
+class MetricsServer {
+    public:
+        // ctor. Listens on the Unix domain socket at path (replacing anything already there) on a
+        // background thread. Logs an error if it can't, and then serves nothing.
+        explicit MetricsServer(const std::string &path);
+        // dtor. Stops the thread and removes the socket.
+        ~MetricsServer();
+
+        MetricsServer(const MetricsServer&) = delete;
+        MetricsServer& operator =(const MetricsServer&) = delete;
+
+        // Set the values served. Called by the simulation between steps.
+        void set_progress(int step, double time);
+        void set_particles(int n_alive, int n_ghost, int n_halo);
+        void set_phase_seconds(ProfilePhase phase, double seconds);
+        // Totals of the energy and momentum. The first ones set are what the drift is measured from.
+        void set_conserved(double energy, double momentum);
+        void set_finished() { finished = true; }
+
+        // The metrics as they would be served
+        std::string prometheus() const;
+        std::string json() const;
+
+    private:
+        std::string path;
+        int listen_fd = -1;
+        std::thread thread;
+        std::atomic<bool> stopping{false};
+
+        std::atomic<int> step{0};
+        std::atomic<double> time{0};
+        std::atomic<double> steps_per_second{0};
+        std::atomic<double> phase_seconds[N_PROFILE_PHASES] = {};
+        std::atomic<int> n_alive{0};
+        std::atomic<int> n_ghost{0};
+        std::atomic<int> n_halo{0};
+        std::atomic<double> energy{0};
+        std::atomic<double> momentum{0};
+        std::atomic<double> energy_drift{0};
+        std::atomic<double> momentum_drift{0};
+        std::atomic<bool> finished{false};
+
+        // Only used by set_progress and set_conserved, from the simulation's thread
+        std::chrono::steady_clock::time_point rate_start;
+        int rate_start_step = -1;
+        bool have_initial = false;
+        double initial_energy = 0;
+        double initial_momentum = 0;
+
+        // Accept connections until stopping, and answer each one
+        void serve();
+        void answer(int fd);
+};
+
+#endif
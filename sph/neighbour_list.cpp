@@ -0,0 +1,125 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * neighbour_list.cpp implements the NeighbourList class from neighbour_list.hpp.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+#include "neighbour_list.hpp"
+#include "kernel.hpp"
+
+void NeighbourList::build(const ParticleArrayPtr &p_arr, const Config &config) {
+    const int n = config.n_part;
+    const Particle* p = p_arr.get();
+
+    // Sort the particle indices by position. Because we are in 1D, the neighbours of a particle are
+    // then found by scanning outwards from it in either direction until we go past the largest
+    // search radius of any particle.
+    std::vector<int> order(n);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [p](int a, int b) { return p[a].pos < p[b].pos; });
+
+    std::vector<int> rank(n);
+    for (int k = 0; k < n; k++)
+        rank[order[k]] = k;
+
+    double h_min = std::numeric_limits<double>::max();
+    double h_max = 0;
+    for (int i = 0; i < n; i++) {
+        h_min = std::min(h_min, (double)p[i].h);
+        h_max = std::max(h_max, (double)p[i].h);
+    }
+
+    const double radius = KERNEL_RADIUS * (1 + skin);
+    const double max_search = radius * h_max;
+
+    offsets.assign(n + 1, 0);
+    indices.clear();
+
+    for (int i = 0; i < n; i++) {
+        offsets[i] = indices.size();
+
+        // A pair interacts if it is within the kernel radius of *either* smoothing length (the
+        // acceleration uses both h_i and h_j), so list j if it is within the larger of the two
+        for (int k = rank[i]; k >= 0; k--) {
+            int j = order[k];
+            double r_ij = p[i].pos - p[j].pos;
+            if (r_ij >= max_search)
+                break;
+            if (r_ij < radius * std::max(p[i].h, p[j].h))
+                indices.push_back(j);
+        }
+
+        for (int k = rank[i] + 1; k < n; k++) {
+            int j = order[k];
+            double r_ij = p[j].pos - p[i].pos;
+            if (r_ij >= max_search)
+                break;
+            if (r_ij < radius * std::max(p[i].h, p[j].h))
+                indices.push_back(j);
+        }
+
+        // Keep each list in index order, so that sums come out the same as a loop over the array
+        std::sort(indices.begin() + offsets[i], indices.end());
+    }
+
+    offsets[n] = indices.size();
+
+    build_pos.resize(n);
+    build_h.resize(n);
+    for (int i = 0; i < n; i++) {
+        build_pos[i] = p[i].pos;
+        build_h[i] = p[i].h;
+    }
+
+    build_n_part = n;
+    build_h_min = h_min;
+    build_counter++;
+}
+
+void NeighbourList::sort_by_position(const Particle* p, int first, int last) {
+    auto before = [p](int a, int b) { return position_order(p[a], p[b]); };
+
+    // Particles rarely overtake each other, so most lists are still in order from the last step
+    for (int i = first; i < last; i++) {
+        auto list_first = indices.begin() + offsets[i];
+        auto list_last = indices.begin() + offsets[i + 1];
+        if (!std::is_sorted(list_first, list_last, before))
+            std::sort(list_first, list_last, before);
+    }
+}
+
+bool NeighbourList::update(const ParticleArrayPtr &p_arr, const Config &config) {
+    if (!is_stale(p_arr, config))
+        return false;
+
+    build(p_arr, config);
+    return true;
+}
+
+bool NeighbourList::is_stale(const ParticleArrayPtr &p_arr, const Config &config) const {
+    // Ghost particles being created or removed changes the array layout
+    if (config.n_part != build_n_part)
+        return true;
+
+    // A pair was listed if it was closer than KERNEL_RADIUS * (1 + skin) * h. Half of that skin is
+    // reserved for growth of the smoothing lengths (see covers()), and the other half for the
+    // particles moving; since both particles of a pair can move towards each other, each one may
+    // only move by half of its share before a pair that should interact could have been missed.
+    const double max_disp = KERNEL_RADIUS * skin * build_h_min / 4;
+    const Particle* p = p_arr.get();
+
+    for (int i = 0; i < config.n_part; i++) {
+        if (std::abs(p[i].pos - build_pos[i]) > max_disp)
+            return true;
+        // Half of the growth allowed by covers(), leaving the rest for the next root-finding
+        if (p[i].h > build_h[i] * (1 + skin / 4))
+            return true;
+    }
+
+    return false;
+}
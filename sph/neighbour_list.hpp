@@ -0,0 +1,109 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * neighbour_list.hpp defines the NeighbourList class, which keeps a persistent (Verlet) list of
+ * neighbours for every particle so that the calculators don't have to loop over the whole particle
+ * array for every particle. The lists are built with a slightly larger radius than the kernel
+ * actually needs (the 'skin'), which means they stay valid for several timesteps as long as the
+ * particles don't move too far or grow their smoothing lengths too much.
+ *
+ * Each list is in order of index, so sums over neighbours come out the same however many threads
+ * there are. With MPI, though, the indices depend on which particles each rank has, so with
+ * deterministic set in config.txt the lists are put in order of position every step instead (see
+ * sort_by_position), which makes the sums the same for any number of ranks too.
+ */
+
+#ifndef neighbour_list_hpp
+#define neighbour_list_hpp
+
+#include <vector>
+
+#include "define.hpp"
+#include "basictypes.hpp"
+
+// Whether a comes before b in position. Ties are broken by the rest of their state rather than by
+// index, so that the order doesn't depend on where the particles are in the array.
+inline bool position_order(const Particle &a, const Particle &b) {
+    if (a.pos != b.pos)
+        return a.pos < b.pos;
+    if (a.vel != b.vel)
+        return a.vel < b.vel;
+    if (a.mass != b.mass)
+        return a.mass < b.mass;
+    return a.h < b.h;
+}
+
+// View onto the neighbours of a single particle: a contiguous run of indices into the particle
+// array. Can be used in a range-based for loop.
+struct NeighbourRange {
+    const int* first;
+    const int* last;
+
+    const int* begin() const { return first; }
+    const int* end() const { return last; }
+    int size() const { return last - first; }
+};
+
+class NeighbourList {
+    public:
+        // ctor. skin is the fractional amount by which the search radius is extended beyond
+        // KERNEL_RADIUS * h, i.e. particles are listed if they are within KERNEL_RADIUS * h * (1 + skin)
+        NeighbourList(double skin = NEIGHBOUR_SKIN) : skin(skin) {}
+
+        // Rebuild the lists for the whole array, using the current positions and smoothing lengths
+        void build(const ParticleArrayPtr &p_arr, const Config &config);
+
+        // Rebuild the lists only if they have gone stale since the last build (see is_stale).
+        // Returns true if a rebuild happened.
+        bool update(const ParticleArrayPtr &p_arr, const Config &config);
+
+        // Check whether the lists built previously can still be used for the current state of the
+        // particle array. This is the case unless the number of particles has changed, or some
+        // particle has moved or grown its smoothing length past the margin allowed by the skin.
+        // The lists are considered stale a bit before h reaches max_h, so that there is room for
+        // h to grow during the next root-finding without outgrowing the lists.
+        bool is_stale(const ParticleArrayPtr &p_arr, const Config &config) const;
+
+        // Put the lists of particles [first, last) in order of position (see position_order) rather
+        // than index. Only those lists are changed, so chunks of particles can be sorted in parallel.
+        void sort_by_position(const Particle* p, int first, int last);
+
+        // Largest smoothing length of particle i for which its list is still complete
+        double max_h(int i) const {
+            return build_h[i] * (1 + skin / 2);
+        }
+
+        // Check whether the list of particle i is still complete for smoothing length h. Used after
+        // the smoothing length root-finding, which can change h by more than the skin in one go.
+        bool covers(int i, double h) const {
+            return h <= max_h(i);
+        }
+
+        // Neighbours of particle i, including i itself (since the density sum includes self-density)
+        NeighbourRange neighbours(int i) const {
+            return NeighbourRange { indices.data() + offsets[i], indices.data() + offsets[i + 1] };
+        }
+
+        // Number of times the lists have been (re)built; useful for diagnostics
+        int n_builds() const { return build_counter; }
+
+    private:
+        double skin;
+
+        // Compressed sparse row layout: the neighbours of particle i are
+        // indices[offsets[i]] ... indices[offsets[i + 1] - 1], in ascending order of index so that
+        // sums over neighbours are carried out in the same order as a loop over the whole array
+        // (until sort_by_position is called).
+        std::vector<int> offsets;
+        std::vector<int> indices;
+
+        // State of the particle array at the last build, used to decide when to rebuild
+        std::vector<double> build_pos;
+        std::vector<double> build_h;
+        int build_n_part = -1;
+        double build_h_min = 0;
+
+        int build_counter = 0;
+};
+
+#endif
@@ -0,0 +1,662 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * out_of_core.cpp implements the ParticleStore and OutOfCoreSimulation from out_of_core.hpp.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "out_of_core.hpp"
+#include "define.hpp"
+#include "dump_writer.hpp"
+#include "ghost_particles.hpp"
+#include "kernel.hpp"
+#include "particle_array.hpp"
+#include "setup.hpp"
+#include "smoothing_length.hpp"
+#include "sph_simulation.hpp"
+#include "validation.hpp"
+#include "log.hpp"
+
+// Copy everything but the id, which the particles in the working array and the file each keep
+static void pack(const Particle &p, StoredParticle &sp) {
+    sp.type = p.type;
+    sp.mass = p.mass;
+    sp.pos = p.pos;
+    sp.vel = p.vel;
+    sp.acc = p.acc;
+    sp.h = p.h;
+    sp.du_dt = p.du_dt;
+    sp.u = p.u;
+    sp.density = p.density;
+    sp.pressure = p.pressure;
+    sp.omega = p.omega;
+    sp.drho_dt = p.drho_dt;
+    sp.n_solve_neighbours = p.n_solve_neighbours;
+    sp.drho_dh = p.drho_dh;
+    sp.activity = p.activity;
+}
+
+static void unpack(const StoredParticle &sp, Particle &p) {
+    p.type = (ParticleType)sp.type;
+    p.mass = sp.mass;
+    p.pos = sp.pos;
+    p.vel = sp.vel;
+    p.acc = sp.acc;
+    p.h = sp.h;
+    p.du_dt = sp.du_dt;
+    p.u = sp.u;
+    p.density = sp.density;
+    p.pressure = sp.pressure;
+    p.omega = sp.omega;
+    p.drho_dt = sp.drho_dt;
+    p.n_solve_neighbours = sp.n_solve_neighbours;
+    p.drho_dh = sp.drho_dh;
+    p.activity = sp.activity;
+}
+
+#pragma region ParticleStore
+
+ParticleStore::ParticleStore(const std::string &path, int n)
+    : n(n), bytes((size_t)n * sizeof(StoredParticle))
+{
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Could not open out-of-core particle file " << path << " for writing: "
+                  << strerror(errno));
+        exit(1);
+    }
+
+    // Allocate the whole file up front, so that running out of disk space is an error here rather
+    // than a SIGBUS part way through the run
+    int err = posix_fallocate(fd, 0, bytes);
+    if (err != 0) {
+        LOG_ERROR("Could not make room for " << n << " particles (" << bytes << " bytes) in "
+                  << path << ": " << strerror(err));
+        exit(1);
+    }
+
+    void* mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mapped == MAP_FAILED) {
+        LOG_ERROR("Could not map out-of-core particle file " << path << " into memory: "
+                  << strerror(errno));
+        exit(1);
+    }
+
+    particles = (StoredParticle*)mapped;
+}
+
+ParticleStore::~ParticleStore() {
+    munmap(particles, bytes);
+}
+
+void ParticleStore::prefetch(int first, int last) {
+    if (first >= last)
+        return;
+
+    // madvise wants the start of a page
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = (size_t)first * sizeof(StoredParticle) / page * page;
+    size_t end = (size_t)last * sizeof(StoredParticle);
+    madvise((char*)particles + begin, end - begin, MADV_WILLNEED);
+}
+
+void ParticleStore::release(int first, int last) {
+    // Only whole pages, so that nothing either side is dropped. The mapping is shared, so dirty
+    // pages are written back to the file rather than lost.
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t begin = ((size_t)first * sizeof(StoredParticle) + page - 1) / page * page;
+    size_t end = (size_t)last * sizeof(StoredParticle) / page * page;
+    if (last == n)
+        end = bytes;
+
+    if (begin < end)
+        madvise((char*)particles + begin, end - begin, MADV_DONTNEED);
+}
+
+#pragma endregion
+#pragma region OutOfCoreSimulation
+
+OutOfCoreSimulation::OutOfCoreSimulation(Config c, const std::string &path)
+    : config(c), store(path, c.n_part),
+      executor(c.n_threads, (ThreadPinning)c.pin_threads),
+      work_config(c),
+      dc(c, work, nlist), ac(c, work, nlist), fc(c, work, nlist),
+      timestep(c.t_i)
+{
+    // Each window is solved in parallel, as in SPHSimulation
+    dc.set_rebuild_lists(false);
+
+    work_config.n_ghost = 0;
+    work_config.n_halo = 0;
+    work_config.n_alloc = 0;
+
+    // Same lattice as init_particles, written straight into the file
+    stream([this](int first, int last) {
+        Particle p(0);
+        for (int i = first; i < last; i++) {
+            init_lattice_particle(config, i, p);
+
+            StoredParticle &sp = store[i];
+            sp = StoredParticle {};
+            sp.id = i;
+            sp.type = Alive;
+            sp.mass = p.mass;
+            sp.pos = p.pos;
+            sp.vel = p.vel;
+            sp.h = p.h;
+            sp.u = config.pressure_calc == Adiabatic ? (double)p.u : 0;
+            sp.omega = 1;
+
+            pass_h_max = std::max(pass_h_max, (double)sp.h);
+        }
+    });
+    h_max = pass_h_max;
+
+    // The rest follows calc_initial_conditions: in the adiabatic case the velocities are set to
+    // the sound speed, which needs the densities, before the ghost particles are set up
+    LOG_INFO("Allocated " << config.n_part << " alive particles in " << path << ".");
+
+    if (config.pressure_calc == Adiabatic) {
+        density_pass(true);
+        sound_speed_pass();
+    }
+
+    setup_ghosts();
+
+    LOG_INFO("Initialized " << left_ghosts.size() + right_ghosts.size() << " ghost particles.");
+    LOG_INFO("Calculating initial conditions...");
+
+    density_pass(true);
+    force_pass(false);
+
+    Logger::get().flush_tallies();
+}
+
+void OutOfCoreSimulation::start(double end_time) {
+    if (show_progress)
+        LOG_INFO("Simulation time: " << current_time << " / " << end_time);
+
+    SPHSimulation::make_output_dir(output_dir);
+    file_write();
+
+    #ifndef SETUP_ONLY
+    while (current_time < (end_time - CALC_EPSILON)) {
+        current_time += timestep;
+        if (show_progress)
+            LOG_INFO("Simulation time: " << current_time << " / " << end_time);
+        step_forward();
+
+        Logger::get().flush_tallies();
+
+        // The final state is always written, even if it isn't on the interval
+        bool last_step = current_time >= (end_time - CALC_EPSILON);
+        bool dump_due = config.dump_interval > 0 && step_counter % config.dump_interval == 0;
+        if (dump_due || last_step)
+            file_write();
+    }
+    #endif
+
+    if (show_progress) {
+        LOG_INFO("At most " << max_loaded << " of the " << config.n_part
+                 << " particles were in memory at once.");
+    }
+}
+
+void OutOfCoreSimulation::advance(int n) {
+    for (int i = 0; i < n; i++) {
+        current_time += timestep;
+        step_forward();
+        Logger::get().flush_tallies();
+    }
+}
+
+std::vector<StoredParticle> OutOfCoreSimulation::get_ghosts() const {
+    std::vector<StoredParticle> ghosts(left_ghosts);
+    ghosts.insert(ghosts.end(), right_ghosts.begin(), right_ghosts.end());
+    return ghosts;
+}
+
+void OutOfCoreSimulation::step_forward() {
+    bool sum_due = density_sum_due(config, step_counter + 1);
+    drift(sum_due);
+
+    // The ghost particles are copies from after the drift, and aren't updated during the rest of
+    // the timestep, as in SPHSimulation
+    setup_ghosts();
+    step_counter++;
+
+    // Skipping the density pass saves a whole stream through the file
+    if (sum_due)
+        density_pass(false);
+    force_pass(true);
+}
+
+double OutOfCoreSimulation::halo_width() const {
+    // Same as the MPI halos: the furthest any particle can interact, plus the margin the neighbour
+    // lists allow the smoothing lengths to grow by
+    return KERNEL_RADIUS * (1 + NEIGHBOUR_SKIN) * h_max;
+}
+
+void OutOfCoreSimulation::parallel_for(int first, int last, const std::function<void(int, int)> &fn) {
+    graph.clear();
+    for (int c = first; c < last; c += TASK_CHUNK_SIZE) {
+        int c_last = std::min(c + TASK_CHUNK_SIZE, last);
+        graph.add([&fn, c, c_last] {
+            fn(c, c_last);
+        });
+    }
+    executor.run(graph);
+}
+
+#pragma endregion
+#pragma region Windows
+
+void OutOfCoreSimulation::stream(const std::function<void(int, int)> &fn) {
+    int n = store.size();
+    int size = config.out_of_core_window;
+    pass_h_max = 0;
+
+    store.prefetch(0, std::min(size, n));
+
+    for (int first = 0; first < n; first += size) {
+        int last = std::min(first + size, n);
+        store.prefetch(last, std::min(last + size, n));
+
+        fn(first, last);
+
+        // The window before this one is only dropped now, as sorting this one can reach back into it
+        if (first >= size)
+            store.release(first - size, first);
+    }
+
+    store.release(std::max(0, n - 2 * size), n);
+}
+
+void OutOfCoreSimulation::sweep(double width, const std::function<void()> &calculate,
+                                const std::function<void(int, int)> &behind) {
+    int n = store.size();
+    int size = config.out_of_core_window;
+    pass_h_max = 0;
+
+    // Particles before done have been passed to behind and dropped from memory
+    int done = 0;
+
+    store.prefetch(0, std::min(size, n));
+
+    for (int first = 0; first < n; first += size) {
+        load_window(first, std::min(first + size, n), width);
+        store.prefetch(window.halo_last, std::min(window.halo_last + size, n));
+
+        // The halos only move forwards, so nothing before this one's is needed again
+        if (window.halo_first > done) {
+            if (behind)
+                behind(done, window.halo_first);
+            store.release(done, window.halo_first);
+            done = window.halo_first;
+        }
+
+        calculate();
+        store_window(false);
+    }
+
+    if (behind)
+        behind(done, n);
+    store.release(done, n);
+    h_max = pass_h_max;
+}
+
+void OutOfCoreSimulation::load_window(int first, int last, double width) {
+    int n = store.size();
+    Window &w = window;
+    w.first = first;
+    w.last = last;
+
+    // The file is in order of position, so the halo is every particle up to width from either end
+    double left_edge = (double)store[first].pos - width;
+    double right_edge = (double)store[last - 1].pos + width;
+
+    w.halo_first = first;
+    while (w.halo_first > 0 && store[w.halo_first - 1].pos >= left_edge)
+        w.halo_first--;
+
+    w.halo_last = last;
+    while (w.halo_last < n && store[w.halo_last].pos <= right_edge)
+        w.halo_last++;
+
+    w.n_left_ghosts = w.halo_first == 0 ? left_ghosts.size() : 0;
+    w.n_right_ghosts = w.halo_last == n ? right_ghosts.size() : 0;
+
+    int n_loaded = w.halo_last - w.halo_first;
+    int n_ghost = w.n_left_ghosts + w.n_right_ghosts;
+    reserve_particles(work, work_config, 0, n_loaded + n_ghost);
+
+    for (int i = w.halo_first; i < w.halo_last; i++) {
+        Particle &p = work[i - w.halo_first];
+        unpack(store[i], p);
+        if (i < first || i >= last)
+            p.type = Halo;
+    }
+
+    for (int k = 0; k < w.n_left_ghosts; k++)
+        unpack(left_ghosts[k], work[n_loaded + k]);
+    for (int k = 0; k < w.n_right_ghosts; k++)
+        unpack(right_ghosts[k], work[n_loaded + w.n_left_ghosts + k]);
+
+    work_config.n_part = n_loaded + n_ghost;
+    work_config.n_ghost = n_ghost;
+    work_config.n_halo = n_loaded - (last - first);
+    max_loaded = std::max(max_loaded, work_config.n_part);
+
+    nlist.build(work, work_config);
+    dc.update(work_config, work);
+    ac.update(work_config, work);
+    fc.update(work_config, work);
+}
+
+void OutOfCoreSimulation::store_window(bool with_ghosts) {
+    const Window &w = window;
+    for (int i = w.first; i < w.last; i++) {
+        pack(work[i - w.halo_first], store[i]);
+        pass_h_max = std::max(pass_h_max, (double)store[i].h);
+    }
+
+    if (!with_ghosts)
+        return;
+
+    int n_loaded = w.halo_last - w.halo_first;
+    for (int k = 0; k < w.n_left_ghosts; k++)
+        pack(work[n_loaded + k], left_ghosts[k]);
+    for (int k = 0; k < w.n_right_ghosts; k++)
+        pack(work[n_loaded + w.n_left_ghosts + k], right_ghosts[k]);
+}
+
+#pragma endregion
+#pragma region Phases
+
+void OutOfCoreSimulation::drift(bool sum_due) {
+    #ifdef PREDICT_H
+    bool predict = true;
+    #else
+    bool predict = !sum_due;
+    #endif
+
+    stream([this, sum_due, predict](int first, int last) {
+        parallel_for(first, last, [this, sum_due, predict](int c_first, int c_last) {
+            for (int i = c_first; i < c_last; i++) {
+                StoredParticle &p = store[i];
+
+                // Half-step velocity
+                p.vel += p.acc * (timestep / 2);
+                // Thermal energy
+                p.u += p.du_dt * (timestep / 2);
+
+                // Position
+                p.pos += p.vel * (timestep);
+
+                if (predict) {
+                    // As in SPHSimulation::step_forward
+                    double factor = predict_h_factor(p.density, p.drho_dt, timestep);
+                    p.density /= factor;
+                    p.h = sum_due ? p.h * factor : config.h_factor * p.mass / p.density;
+                }
+            }
+        });
+
+        // Particles rarely overtake each other, so this only moves the odd one back a place or two
+        for (int i = std::max(first, 1); i < last; i++) {
+            for (int j = i; j > 0 && store[j - 1].pos > store[j].pos; j--)
+                std::swap(store[j - 1], store[j]);
+        }
+
+        for (int i = first; i < last; i++)
+            pass_h_max = std::max(pass_h_max, (double)store[i].h);
+    });
+    h_max = pass_h_max;
+}
+
+void OutOfCoreSimulation::setup_ghosts() {
+    // Only particles within KERNEL_RADIUS * h_max of a boundary can need a ghost particle, and
+    // those are at the ends of the file. Each one is checked once, as in setup_ghost_particles.
+    int n = store.size();
+    double reach = KERNEL_RADIUS * h_max;
+
+    int left_end = 0;
+    while (left_end < n && store[left_end].pos < -config.limit + reach)
+        left_end++;
+
+    int right_start = n;
+    while (right_start > left_end && store[right_start - 1].pos > config.limit - reach)
+        right_start--;
+
+    left_ghosts.clear();
+    right_ghosts.clear();
+
+    auto add_ghost = [this](const StoredParticle &p) {
+        if (!needs_ghost(config, p.pos, p.h))
+            return;
+
+        StoredParticle ghost = p;
+        ghost.pos = ghost_position(config, p.pos);
+        ghost.vel *= -1;
+        ghost.type = Ghost;
+        (p.pos < 0 ? left_ghosts : right_ghosts).push_back(ghost);
+    };
+
+    for (int i = 0; i < left_end; i++)
+        add_ghost(store[i]);
+    for (int i = right_start; i < n; i++)
+        add_ghost(store[i]);
+
+    // Numbered after the alive particles, in the order they are written to the dumps
+    int id = n;
+    for (StoredParticle &ghost : left_ghosts)
+        ghost.id = id++;
+    for (StoredParticle &ghost : right_ghosts)
+        ghost.id = id++;
+
+    config.n_ghost = left_ghosts.size() + right_ghosts.size();
+}
+
+void OutOfCoreSimulation::density_pass(bool setup) {
+    double width = halo_width();
+
+    sweep(width, [this, setup, &width] {
+        int offset = window.first - window.halo_first;
+        int n_own = window.last - window.first;
+
+        parallel_for(offset, offset + n_own, [this](int first, int last) {
+            if (config.deterministic)
+                nlist.sort_by_position(work.get(), first, last);
+            for (int i = first; i < last; i++)
+                dc(work[i]);
+        });
+
+        VALIDATE_PARTICLES(work.get(), offset, offset + n_own,
+                           ValidateDensity | ValidateSmoothingLength | ValidateOmega,
+                           "density", step_counter);
+
+        if (!setup)
+            return;
+
+        // The setup also calculates the densities of the ghost particles, once, along with the
+        // window at the same end of the file. Particles to solve are kept as their index in the
+        // file, or -1 - k for ghost particle k (left then right), as the working array may be
+        // loaded again below.
+        std::vector<int> solve;
+        if (window.first == 0) {
+            for (int k = 0; k < window.n_left_ghosts; k++)
+                solve.push_back(-1 - k);
+        }
+        if (window.last == store.size()) {
+            for (int k = 0; k < window.n_right_ghosts; k++)
+                solve.push_back(-1 - (int)left_ghosts.size() - k);
+        }
+
+        auto work_index = [this](int id) {
+            if (id >= 0)
+                return id - window.halo_first;
+
+            int k = -1 - id;
+            int n_loaded = window.halo_last - window.halo_first;
+            if (k < (int)left_ghosts.size())
+                return n_loaded + k;
+            return n_loaded + window.n_left_ghosts + (k - (int)left_ghosts.size());
+        };
+
+        for (int id : solve)
+            dc(work[work_index(id)]);
+
+        // The first guesses of h can be a long way off, which is why calc_initial_conditions lets
+        // its DensityCalculator rebuild the lists as it goes. Here the smoothing lengths that were
+        // capped at what the lists cover are solved again with lists built around them instead,
+        // widening the halo first if they reach past it.
+        for (int i = window.first; i < window.last; i++)
+            solve.push_back(i);
+
+        while (true) {
+            std::vector<int> capped;
+            double capped_h_max = 0;
+            for (int id : solve) {
+                int i = work_index(id);
+                if (work[i].h >= (real_t)nlist.max_h(i)) {
+                    capped.push_back(id);
+                    capped_h_max = std::max(capped_h_max, (double)work[i].h);
+                }
+            }
+
+            if (capped.empty())
+                break;
+
+            double needed = KERNEL_RADIUS * (1 + NEIGHBOUR_SKIN) * capped_h_max;
+            if (needed > width) {
+                store_window(true);
+                width = needed;
+                load_window(window.first, window.last, width);
+            } else {
+                nlist.build(work, work_config);
+            }
+
+            for (int id : capped)
+                dc(work[work_index(id)]);
+            solve = capped;
+        }
+
+        store_window(true);
+    });
+}
+
+void OutOfCoreSimulation::sound_speed_pass() {
+    // Same as the first part of calc_initial_conditions. Only the pressures of the accelerations are
+    // needed, which don't depend on the velocities.
+    sweep(halo_width(), [this] {
+        int offset = window.first - window.halo_first;
+        int n_own = window.last - window.first;
+
+        parallel_for(offset, offset + n_own, [this](int first, int last) {
+            for (int i = first; i < last; i++)
+                ac(work[i]);
+        });
+
+        for (int i = offset; i < offset + n_own; i++) {
+            double c_s = ac.sound_speed(work[i]);
+            work[i].vel = (work[i].pos < 0) ? c_s : -c_s;
+        }
+    });
+}
+
+void OutOfCoreSimulation::force_pass(bool kick_behind) {
+    std::function<void(int, int)> behind;
+    if (kick_behind) {
+        behind = [this](int first, int last) {
+            kick(first, last);
+        };
+    }
+
+    sweep(halo_width(), [this] {
+        int offset = window.first - window.halo_first;
+        int n_own = window.last - window.first;
+
+        parallel_for(offset, offset + n_own, [this](int first, int last) {
+            for (int i = first; i < last; i++) {
+                // Density-dependent quantities
+                fc(work[i]);
+            }
+        });
+
+        VALIDATE_PARTICLES(work.get(), offset, offset + n_own,
+                           ValidateAcceleration | ValidateEnergyRate | ValidatePressure,
+                           "force", step_counter);
+    }, behind);
+}
+
+void OutOfCoreSimulation::kick(int first, int last) {
+    parallel_for(first, last, [this](int c_first, int c_last) {
+        for (int i = c_first; i < c_last; i++) {
+            StoredParticle &p = store[i];
+
+            // Remaining half-step velocity
+            p.vel += p.acc * (timestep / 2);
+            p.u += p.du_dt * (timestep / 2);
+        }
+    });
+}
+
+void OutOfCoreSimulation::file_write() {
+    // Written straight from the file as it goes, a window at a time, rather than from a copy in the
+    // background like SPHSimulation, since there isn't room for a copy
+    std::string filename = output_dir + "/" + std::to_string(step_counter) + ".txt";
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LOG_ERROR("Could not open dump file " << filename << " for writing: " << strerror(errno));
+        return;
+    }
+
+    bool full_precision = config.dump_format == FullPrecisionTextDump;
+    std::string text = format_dump_header(current_time);
+    // The particles are unpacked into this to be formatted, as Particle has to be made with its id
+    std::vector<Particle> particles;
+    particles.reserve(config.out_of_core_window);
+
+    auto add = [&particles](const StoredParticle &sp) {
+        particles.emplace_back(sp.id);
+        unpack(sp, particles.back());
+    };
+
+    auto flush = [&] {
+        format_dump_lines(particles.data(), particles.size(), full_precision, executor, text);
+        particles.clear();
+        bool ok = write_all(fd, text, filename);
+        text.clear();
+        return ok;
+    };
+
+    // Once a write has failed, the rest of the file is skipped
+    bool ok = true;
+    stream([&](int first, int last) {
+        if (!ok)
+            return;
+        for (int i = first; i < last; i++)
+            add(store[i]);
+        ok = flush();
+    });
+
+    for (const StoredParticle &ghost : left_ghosts)
+        add(ghost);
+    for (const StoredParticle &ghost : right_ghosts)
+        add(ghost);
+    if (ok)
+        flush();
+
+    close(fd);
+}
+
+#pragma endregion
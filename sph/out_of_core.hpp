@@ -0,0 +1,221 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * out_of_core.hpp defines the OutOfCoreSimulation, which runs the same simulation as SPHSimulation
+ * for more particles than fit in memory (set out_of_core in config.txt). The alive particles live
+ * in a memory-mapped file (the ParticleStore) in order of position, and each phase of the timestep
+ * streams through it in windows of out_of_core_window particles. Interactions are local, so a
+ * window only needs the particles within KERNEL_RADIUS * max h (plus the neighbour list skin)
+ * either side of it as well. These are copied into a working array along with it as Halo particles,
+ * much like the halos of the MPI slabs (see domain_decomposition.hpp), and the working array gets
+ * its own neighbour lists and calculators. Only the window's own particles are written back.
+ *
+ * A timestep is three passes through the file:
+ *  - drift, then an insertion sort to put the particles back in order of position (they rarely
+ *    overtake each other, so this hardly moves anything). The ghost particles are then made from
+ *    the ends of the file, and kept in memory, as there are only a few of them.
+ *  - density, a window (and its halo) at a time. Skipped on the steps the densities are integrated
+ *    at the drift instead (see density_sum_interval in config.txt).
+ *  - force and kick. Kicking a particle changes the velocity and energy that the forces of its
+ *    neighbours need, so particles are only kicked once they are behind the halo of the window
+ *    being worked on, which no later window reaches back past.
+ *
+ * While a window is worked on, the kernel is asked to read the next one in from the file
+ * (MADV_WILLNEED), and the pages that have been left behind are dropped from the process
+ * (MADV_DONTNEED; the kernel still writes them back to the file). So only the working array and a
+ * couple of windows of the file are ever resident, however many particles there are.
+ *
+ * Sums over neighbours are in order of position, which is also the order of the normal simulation
+ * unless particles overtake each other, so the results are the same as SPHSimulation's. Only the
+ * lattice set up by init_particles and text dumps are supported, and not refinement, the in-situ
+ * analysis, the live stream, initial conditions files or MPI, which all want every particle at once.
+ */
+
+#ifndef out_of_core_hpp
+#define out_of_core_hpp
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "basictypes.hpp"
+#include "calculators.hpp"
+#include "neighbour_list.hpp"
+#include "task_graph.hpp"
+
+// Particle as it is kept in the file: a plain copy of its data, including its id, which can be
+// moved around as raw bytes (Particle itself can't be, because of its const id)
+struct StoredParticle {
+    int id;
+    int type;
+    real_t mass;
+    position_t pos;
+    real_t vel;
+    real_t acc;
+    real_t h;
+    real_t du_dt;
+    real_t u;
+    real_t density;
+    real_t pressure;
+    real_t omega;
+    real_t drho_dt;
+    int n_solve_neighbours;
+    real_t drho_dh;
+    real_t activity;
+};
+
+// Array of particles in a file, mapped into memory
+class ParticleStore {
+    public:
+        // ctor. Creates the file at path (replacing anything already there) with room for n
+        // particles. Exits the program if it can't.
+        ParticleStore(const std::string &path, int n);
+        // dtor. Unmaps the file, which is left with the particles as they were last.
+        ~ParticleStore();
+
+        ParticleStore(const ParticleStore&) = delete;
+        ParticleStore& operator =(const ParticleStore&) = delete;
+
+        StoredParticle& operator [](int i) { return particles[i]; }
+        const StoredParticle& operator [](int i) const { return particles[i]; }
+
+        int size() const { return n; }
+
+        // Ask the kernel to start reading particles [first, last) in from the file, without waiting
+        // for it
+        void prefetch(int first, int last);
+
+        // Drop the pages that only hold particles in [first, last) from memory. Any changes to them
+        // are kept, and they are read back in if they are used again.
+        void release(int first, int last);
+
+    private:
+        int n;
+        size_t bytes;
+        StoredParticle* particles;
+};
+
+class OutOfCoreSimulation {
+    public:
+        // ctor. Sets up the c.n_part particles of the lattice made by init_particles in the file at
+        // path, then calculates their initial conditions the same way calc_initial_conditions does.
+        OutOfCoreSimulation(Config c, const std::string &path);
+
+        // Same as SPHSimulation::start: run until current_time reaches end_time, writing dumps on
+        // the way
+        void start(double end_time);
+
+        // Take n timesteps, without writing any output
+        void advance(int n);
+
+        // Directory to write dump files into. Default is ./dumps
+        void set_output_dir(const std::string &dir) {
+            output_dir = dir;
+        }
+
+        // Whether to print the simulation time every step. Default is true.
+        void set_show_progress(bool show) {
+            show_progress = show;
+        }
+
+        int steps_taken() const { return step_counter; }
+
+        double get_time() const { return current_time; }
+
+        // The alive particles, in order of position
+        const ParticleStore& get_particles() const { return store; }
+
+        // The ghost particles, in the order they are written to the dumps
+        std::vector<StoredParticle> get_ghosts() const;
+
+        // Largest number of particles that have been in the working array at once
+        int max_working_set() const { return max_loaded; }
+
+    private:
+        // Range of the file in the working array: the window's own particles are [first, last),
+        // and the halo either side of them makes it [halo_first, halo_last). The ghost particles at
+        // the ends of the file (if the halo reaches them) come after those, left then right.
+        struct Window {
+            int first;
+            int last;
+            int halo_first;
+            int halo_last;
+            int n_left_ghosts;
+            int n_right_ghosts;
+        };
+
+        // config.n_part is the number of alive particles, i.e. the size of the file. The ghost
+        // particles are kept separately.
+        Config config;
+
+        ParticleStore store;
+        Executor executor;
+        TaskGraph graph;
+
+        // Ghost particles, mirrored from the ends of the file after each drift
+        std::vector<StoredParticle> left_ghosts;
+        std::vector<StoredParticle> right_ghosts;
+
+        // Working array, with its own config (n_part etc.), neighbour lists and calculators
+        Window window;
+        ParticleArrayPtr work;
+        Config work_config;
+        NeighbourList nlist;
+        DensityCalculator dc;
+        AccelerationCalculator ac;
+        ForceCalculator fc;
+        int max_loaded = 0;
+
+        // Largest smoothing length of any alive particle, which decides how wide the halos are, and
+        // the largest seen so far by the current pass
+        double h_max = 0;
+        double pass_h_max = 0;
+
+        double current_time = 0;
+        double timestep;
+
+        int step_counter = 0;
+
+        std::string output_dir = "dumps";
+        bool show_progress = true;
+
+        // Step the simulation forward
+        void step_forward();
+
+        // Call fn(first, last) on the particles of each window of the file in turn, reading the
+        // next window in while it runs
+        void stream(const std::function<void(int, int)> &fn);
+
+        // Copy each window of the file and its halo (all the particles within width of it) into the
+        // working array in turn, call calculate on it, and copy its own particles back. behind (if
+        // given) is called on the particles that no later window will need, as the windows move on.
+        void sweep(double width, const std::function<void()> &calculate,
+                   const std::function<void(int, int)> &behind = nullptr);
+
+        // Copy particles [first, last) and their halo into the working array, as window, and set up
+        // the neighbour lists and calculators for it
+        void load_window(int first, int last, double width);
+
+        // Copy the window's own particles (and its ghost particles, if with_ghosts) back
+        void store_window(bool with_ghosts);
+
+        // Call fn(first, last) on chunks of [first, last) in parallel
+        void parallel_for(int first, int last, const std::function<void(int, int)> &fn);
+
+        // Halo width that covers every neighbour of every particle, for the current h_max
+        double halo_width() const;
+
+        // Phases of the timestep, and of the setup
+        void drift(bool sum_due);
+        void setup_ghosts();
+        void density_pass(bool setup);
+        void sound_speed_pass();
+        void force_pass(bool kick);
+        void kick(int first, int last);
+
+        // Write the alive then the ghost particles to "{output_dir}/{step_counter}.txt", in the same
+        // format as SPHSimulation
+        void file_write();
+};
+
+#endif
@@ -0,0 +1,134 @@
+/* 
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * particle_array.cpp implements the functions from particle_array.hpp.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+#include <sys/mman.h>
+
+#include "particle_array.hpp"
+#include "define.hpp"
+#include "log.hpp"
+#include "task_graph.hpp"
+
+// Set by set_particle_allocation. Arrays can be allocated from several threads at once (e.g. by the
+// members of an ensemble), so these are atomic.
+static std::atomic<int> allocation_huge_pages(NoHugePages);
+static std::atomic<Executor*> allocation_executor(nullptr);
+
+// Only warn once that there aren't any explicit huge pages
+static std::atomic<bool> warned_explicit(false);
+
+void set_particle_allocation(HugePages huge_pages, Executor* executor) {
+    allocation_huge_pages = huge_pages;
+    allocation_executor = executor;
+}
+
+// Allocate (but don't touch) bytes of memory backed as given. Returns nullptr if it fails, and
+// otherwise sets free_memory to the function that frees it.
+static void* allocate_memory(size_t bytes, HugePages huge_pages, void (*&free_memory)(void*, size_t)) {
+    size_t huge_bytes = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+
+    #ifdef MAP_HUGETLB
+    if (huge_pages == ExplicitHugePages) {
+        void* memory = mmap(nullptr, huge_bytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            free_memory = [](void* memory, size_t bytes) {
+                munmap(memory, (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+            };
+            return memory;
+        }
+
+        if (!warned_explicit.exchange(true)) {
+            LOG_WARN("Could not get " << huge_bytes << " bytes of explicit huge pages (see "
+                     << "/proc/sys/vm/nr_hugepages), so using transparent huge pages instead.");
+        }
+    }
+    #endif
+
+    if (huge_pages == NoHugePages) {
+        free_memory = [](void* memory, size_t bytes) {
+            ::operator delete(memory, std::align_val_t(PARTICLE_ALIGNMENT));
+        };
+        return ::operator new(bytes, std::align_val_t(PARTICLE_ALIGNMENT), std::nothrow);
+    }
+
+    // Transparent huge pages: aligned to a huge page so that the kernel can use them from the start
+    void* memory = ::operator new(huge_bytes, std::align_val_t(HUGE_PAGE_SIZE), std::nothrow);
+    #ifdef MADV_HUGEPAGE
+    if (memory)
+        madvise(memory, huge_bytes, MADV_HUGEPAGE);
+    #endif
+
+    free_memory = [](void* memory, size_t bytes) {
+        ::operator delete(memory, std::align_val_t(HUGE_PAGE_SIZE));
+    };
+    return memory;
+}
+
+ParticleArrayPtr allocate_particles(int n) {
+    size_t bytes = std::max(n, 1) * sizeof(Particle);
+    void (*free_memory)(void*, size_t) = nullptr;
+    Particle* particles = (Particle*)allocate_memory(bytes, (HugePages)allocation_huge_pages.load(),
+                                                     free_memory);
+
+    if (!particles) {
+        LOG_ERROR("Failed to allocate memory for particle array!");
+        LOG_ERROR("Attempted to allocate " << bytes << " bytes for " << n
+                  << " particles");
+        exit(1);
+    }
+
+    // Same ids as constructing them one after another
+    int first_id = _particle_counter.fetch_add(n);
+    auto construct = [particles, first_id](int first, int last) {
+        for (int i = first; i < last; i++)
+            new (particles + i) Particle(first_id + i);
+    };
+
+    // Constructing the particles is the first time their pages are touched, which decides which
+    // NUMA node they are on
+    Executor* executor = allocation_executor;
+    if (executor && n > TASK_CHUNK_SIZE) {
+        TaskGraph graph;
+        for (int first = 0; first < n; first += TASK_CHUNK_SIZE) {
+            graph.add([&construct, first, n] {
+                construct(first, std::min(first + TASK_CHUNK_SIZE, n));
+            });
+        }
+        executor->run(graph);
+    } else {
+        construct(0, n);
+    }
+
+    // Particles have nothing to destroy, so only the memory needs freeing
+    return ParticleArrayPtr(particles, [free_memory, bytes](Particle* particles) {
+        free_memory(particles, bytes);
+    });
+}
+
+bool reserve_particles(ParticleArrayPtr &p_arr, Config &config, int n_keep, int n_total) {
+    /* 
+     * There isn't really any point shrinking the array if we need less room, as we may end up
+     * needing more in a future timestep... so this way we avoid having to carry out this procedure
+     * on most timesteps.
+     */
+    if (n_total <= config.n_alloc)
+        return false;
+
+    int n_alloc = n_total + n_total / 8;
+    ParticleArrayPtr new_arr = allocate_particles(n_alloc);
+
+    // Copy over the particles we want to keep. Reinitializing the shared ptr frees the old memory,
+    // as the smart pointer detects it is no longer in use
+    std::copy(p_arr.get(), p_arr.get() + n_keep, new_arr.get());
+    p_arr.swap(new_arr);
+
+    config.n_alloc = n_alloc;
+    return true;
+}
@@ -0,0 +1,38 @@
+/* 
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * particle_array.hpp defines functions to allocate and resize the particle array. These used to be
+ * duplicated between main.cpp and ghost_particles.cpp, but the array now changes size for more
+ * reasons than just the ghost particles (e.g. particles migrating between MPI ranks), so it makes
+ * sense to keep track of how much room there is in the array in one place.
+ *
+ * Arrays are aligned to a cache line (PARTICLE_ALIGNMENT). For large runs, where TLB misses start to
+ * show up, they can also be backed by huge pages (huge_pages in config.txt). And on machines with
+ * several NUMA nodes, memory is placed on the node of the thread that first touches it, so with
+ * pin_threads set, the particles are constructed by the worker threads in the same chunks that the
+ * timestep is split into. Each chunk then starts out in the memory of the worker that will work on
+ * it (see Executor::run), rather than all of it being on the node of the main thread.
+ */
+
+#ifndef particle_array_hpp
+#define particle_array_hpp
+
+#include "basictypes.hpp"
+
+class Executor;
+
+// Allocate a new array with room for n particles. Exits the program if the allocation fails.
+ParticleArrayPtr allocate_particles(int n);
+
+// Make sure the array has room for n_total particles. If it doesn't, it is reallocated (with a bit
+// of headroom, so that it doesn't have to happen again for small changes) and the first n_keep
+// particles are copied over. config.n_alloc is updated with the new size of the array.
+// Returns true if the array was reallocated.
+bool reserve_particles(ParticleArrayPtr &p_arr, Config &config, int n_keep, int n_total);
+
+// Set how arrays allocated from now on are backed, and which executor's workers construct them (or
+// nullptr for the calling thread). The executor must outlive the setting, so set it back to nullptr
+// before destroying it.
+void set_particle_allocation(HugePages huge_pages, Executor* executor);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * profiler.cpp implements the PhaseProfiler from profiler.hpp.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "profiler.hpp"
+#include "log.hpp"
+
+static const char* const PhaseNames[N_PROFILE_PHASES] = {
+    "Drift",
+    "Boundaries",
+    "Density",
+    "Force",
+    "Kick"
+};
+
+static const char* const CounterNames[N_PERF_COUNTERS] = {
+    "cycles",
+    "instructions",
+    "L1 misses",
+    "LLC misses",
+    "branch misses"
+};
+
+// Counters that couldn't be opened on some thread, as bits (1 << PerfCounter)
+static std::atomic<int> unavailable_counters(0);
+
+#pragma region CounterGroup
+
+// The counters of one thread, opened as a group (led by the cycle counter) so that they all count
+// over exactly the same time and can be read with one system call
+class CounterGroup {
+    public:
+        CounterGroup() {
+            for (int c = 0; c < N_PERF_COUNTERS; c++)
+                fds[c] = -1;
+            open();
+        }
+
+        ~CounterGroup() {
+            #ifdef __linux__
+            for (int c = 0; c < N_PERF_COUNTERS; c++) {
+                if (fds[c] >= 0)
+                    close(fds[c]);
+            }
+            #endif
+        }
+
+        CounterGroup(const CounterGroup&) = delete;
+        CounterGroup& operator =(const CounterGroup&) = delete;
+
+        // Current values of the counters. Left as 0 if they aren't available.
+        void read_into(CounterSample &sample) const;
+
+    private:
+        int fds[N_PERF_COUNTERS];
+        // Position of each counter in the values read from the group (-1 if it isn't open)
+        int positions[N_PERF_COUNTERS];
+        int n_open = 0;
+
+        void open();
+};
+
+#ifdef __linux__
+
+static int perf_event_open(uint32_t type, uint64_t config, int group_fd) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // Only count this program, which is all that is allowed by default (perf_event_paranoid 2)
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // The leader starts the whole group
+    attr.disabled = group_fd == -1;
+
+    // pid 0 and cpu -1: the calling thread, on whichever CPU it runs on
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static uint64_t cache_miss_config(uint64_t cache) {
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+void CounterGroup::open() {
+    const uint32_t types[N_PERF_COUNTERS] = {
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HW_CACHE,
+        PERF_TYPE_HARDWARE
+    };
+    const uint64_t configs[N_PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        cache_miss_config(PERF_COUNT_HW_CACHE_L1D),
+        cache_miss_config(PERF_COUNT_HW_CACHE_LL),
+        PERF_COUNT_HW_BRANCH_MISSES
+    };
+
+    for (int c = 0; c < N_PERF_COUNTERS; c++) {
+        positions[c] = -1;
+
+        // Nothing can be counted without the leader
+        if (c > 0 && fds[0] < 0)
+            continue;
+
+        fds[c] = perf_event_open(types[c], configs[c], c == 0 ? -1 : fds[0]);
+        if (fds[c] >= 0) {
+            positions[c] = n_open++;
+        } else if (c == 0) {
+            // Reported once for the whole program, rather than for every thread
+            static std::once_flag warned;
+            int error = errno;
+            std::call_once(warned, [error] {
+                LOG_WARN("Hardware performance counters aren't available (perf_event_open: "
+                         << std::strerror(error) << "), so the phases will only be timed.");
+                if (error == EACCES || error == EPERM)
+                    LOG_WARN("Lowering /proc/sys/kernel/perf_event_paranoid may help.");
+                else if (error == ENOENT)
+                    LOG_WARN("The CPU (or virtual machine) may not have the counters.");
+            });
+        }
+    }
+
+    int unavailable = 0;
+    for (int c = 0; c < N_PERF_COUNTERS; c++) {
+        if (fds[c] < 0)
+            unavailable |= 1 << c;
+    }
+    unavailable_counters |= unavailable;
+
+    if (fds[0] >= 0) {
+        ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+}
+
+void CounterGroup::read_into(CounterSample &sample) const {
+    if (n_open == 0)
+        return;
+
+    // Layout with PERF_FORMAT_GROUP: number of counters, time enabled, time running, then the value
+    // of each counter in the order they were added to the group
+    uint64_t values[3 + N_PERF_COUNTERS];
+    ssize_t expected = (3 + n_open) * sizeof(uint64_t);
+    if (read(fds[0], values, sizeof(values)) != expected)
+        return;
+
+    sample.time_enabled = values[1];
+    sample.time_running = values[2];
+    for (int c = 0; c < N_PERF_COUNTERS; c++) {
+        if (positions[c] >= 0)
+            sample.counts[c] = values[3 + positions[c]];
+    }
+}
+
+#else
+
+void CounterGroup::open() {
+    for (int c = 0; c < N_PERF_COUNTERS; c++)
+        positions[c] = -1;
+
+    unavailable_counters = (1 << N_PERF_COUNTERS) - 1;
+
+    static std::once_flag warned;
+    std::call_once(warned, [] {
+        LOG_WARN("Hardware performance counters are only supported on Linux, so the phases will "
+                 << "only be timed.");
+    });
+}
+
+void CounterGroup::read_into(CounterSample &sample) const {}
+
+#endif
+
+// Counters are opened the first time a thread is profiled, and closed when it exits
+static CounterGroup& thread_counter_group() {
+    thread_local CounterGroup group;
+    return group;
+}
+
+#pragma endregion
+
+#pragma region PhaseProfiler
+
+PhaseCounts& PhaseCounts::operator +=(const PhaseCounts &other) {
+    for (int c = 0; c < N_PERF_COUNTERS; c++)
+        counts[c] += other.counts[c];
+    seconds += other.seconds;
+    n_particles += other.n_particles;
+    n_pairs += other.n_pairs;
+    return *this;
+}
+
+static std::atomic<uint64_t> profiler_serial(0);
+
+PhaseProfiler::PhaseProfiler(bool enabled)
+    : is_enabled(enabled), counting(enabled), serial(++profiler_serial) {}
+
+PhaseProfiler::ThreadCounts& PhaseProfiler::thread_counts() {
+    // Threads usually keep working for the same simulation, so remember the last entry they used.
+    // Profilers are told apart by serial rather than address, as a new one can reuse the address
+    // of one that has been destroyed.
+    thread_local uint64_t cached_serial = 0;
+    thread_local ThreadCounts* cached = nullptr;
+
+    if (cached_serial == serial)
+        return *cached;
+
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    std::thread::id id = std::this_thread::get_id();
+
+    cached = nullptr;
+    for (ThreadCounts &t : threads) {
+        if (t.thread == id)
+            cached = &t;
+    }
+
+    if (!cached) {
+        threads.emplace_back();
+        cached = &threads.back();
+        cached->thread = id;
+    }
+
+    cached_serial = serial;
+    return *cached;
+}
+
+PhaseProfiler::Scope::Scope(PhaseProfiler &profiler, ProfilePhase phase)
+    : profiler(profiler.enabled() ? &profiler : nullptr), phase(phase)
+{
+    if (!this->profiler)
+        return;
+
+    if (profiler.counting)
+        thread_counter_group().read_into(start);
+    start_time = std::chrono::steady_clock::now();
+}
+
+PhaseProfiler::Scope::~Scope() {
+    if (!profiler)
+        return;
+
+    CounterSample end;
+    if (profiler->counting)
+        thread_counter_group().read_into(end);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    PhaseCounts &totals = profiler->thread_counts().phases[phase];
+    totals.seconds += elapsed.count();
+    totals.n_particles += particles;
+    totals.n_pairs += pairs;
+
+    // Scale up for the time the counters weren't actually counting, if they were multiplexed
+    uint64_t enabled = end.time_enabled - start.time_enabled;
+    uint64_t running = end.time_running - start.time_running;
+    if (running == 0)
+        return;
+
+    double scale = (double)enabled / running;
+    for (int c = 0; c < N_PERF_COUNTERS; c++)
+        totals.counts[c] += (uint64_t)((end.counts[c] - start.counts[c]) * scale);
+}
+
+PhaseCounts PhaseProfiler::phase_totals(ProfilePhase phase) const {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    PhaseCounts total;
+    for (const ThreadCounts &t : threads)
+        total += t.phases[phase];
+    return total;
+}
+
+bool PhaseProfiler::counter_available(PerfCounter counter) {
+    return !(unavailable_counters & (1 << counter));
+}
+
+const char* PhaseProfiler::phase_name(ProfilePhase phase) {
+    return PhaseNames[phase];
+}
+
+const char* PhaseProfiler::counter_name(PerfCounter counter) {
+    return CounterNames[counter];
+}
+
+void PhaseProfiler::report(const std::string &title, int n_steps) const {
+    if (!is_enabled)
+        return;
+
+    int unavailable = unavailable_counters;
+    bool have_ipc = !(unavailable & ((1 << CounterCycles) | (1 << CounterInstructions)));
+
+    std::string counted;
+    for (int c = 0; c < N_PERF_COUNTERS; c++) {
+        if (!(unavailable & (1 << c)))
+            counted += std::string(counted.empty() ? "" : ", ") + CounterNames[c];
+    }
+
+    LOG_INFO(title << ": " << n_steps << " steps on " << n_threads() << " threads, counting "
+             << (counted.empty() ? "time only" : counted));
+    LOG_INFO("  Phase         Time (s)   Per        ns         Cycles     IPC     L1 miss    LLC miss   Br. miss");
+
+    // Formats a count per particle or pair, or n/a if the counter isn't available
+    auto per = [unavailable](const PhaseCounts &p, PerfCounter c, uint64_t n) {
+        char buffer[32];
+        if (unavailable & (1 << c) || n == 0)
+            std::snprintf(buffer, sizeof(buffer), "%-10s ", "n/a");
+        else
+            std::snprintf(buffer, sizeof(buffer), "%-10.3g ", (double)p.counts[c] / n);
+        return std::string(buffer);
+    };
+
+    for (int phase = 0; phase < N_PROFILE_PHASES; phase++) {
+        PhaseCounts total = phase_totals((ProfilePhase)phase);
+
+        // Phases that loop over neighbours are reported per particle-neighbour pair, and the rest
+        // per particle
+        bool by_pair = total.n_pairs > 0;
+        uint64_t n = by_pair ? total.n_pairs : total.n_particles;
+
+        char ipc[16];
+        if (have_ipc && total.counts[CounterCycles] > 0)
+            std::snprintf(ipc, sizeof(ipc), "%-7.2f", (double)total.counts[CounterInstructions] / total.counts[CounterCycles]);
+        else
+            std::snprintf(ipc, sizeof(ipc), "%-7s", "n/a");
+
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "  %-12s  %-9.4f  %-9s  %-10.3g ",
+                      PhaseNames[phase], total.seconds, by_pair ? "pair" : "particle",
+                      n > 0 ? total.seconds * 1e9 / n : 0.0);
+
+        std::string row = buffer + per(total, CounterCycles, n) + ipc + " " + per(total, CounterL1Misses, n)
+                          + per(total, CounterLLCMisses, n) + per(total, CounterBranchMisses, n);
+        row.erase(row.find_last_not_of(' ') + 1);
+        LOG_INFO(row);
+    }
+
+    // Shows how evenly the work was spread between the threads
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    int i = 0;
+    for (const ThreadCounts &t : threads) {
+        PhaseCounts total;
+        for (int phase = 0; phase < N_PROFILE_PHASES; phase++)
+            total += t.phases[phase];
+
+        char buffer[96];
+        if (have_ipc && total.counts[CounterCycles] > 0)
+            std::snprintf(buffer, sizeof(buffer), "  Thread %d: %.4f s, %llu particles, IPC %.2f", i, total.seconds,
+                          (unsigned long long)total.n_particles, (double)total.counts[CounterInstructions] / total.counts[CounterCycles]);
+        else
+            std::snprintf(buffer, sizeof(buffer), "  Thread %d: %.4f s, %llu particles", i, total.seconds,
+                          (unsigned long long)total.n_particles);
+        LOG_INFO(buffer);
+        i++;
+    }
+}
+
+#pragma endregion
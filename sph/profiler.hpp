@@ -0,0 +1,141 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * profiler.hpp defines the PhaseProfiler, which is used when profile is set in config.txt to find
+ * out where the time in each timestep goes, and why. Each phase of SPHSimulation::step_forward is
+ * measured with hardware performance counters (cycles, instructions, L1 and last-level cache misses
+ * and branch mispredictions), opened with perf_event_open on each thread that runs part of it. At
+ * the end of the run the totals are reported per phase, as IPC (instructions per cycle) and misses
+ * per particle-neighbour pair, which shows whether a phase is bound by memory or by compute.
+ *
+ * The counters aren't always available: perf_event_open is Linux only, may not be permitted (see
+ * /proc/sys/kernel/perf_event_paranoid), and virtual machines often have no hardware counters at
+ * all. The phases are then only timed, after a warning.
+ *
+ * The phases of a timestep overlap in the task graph, so times are the sum over threads of the time
+ * spent in each phase, not wall-clock time.
+ */
+
+#ifndef profiler_hpp
+#define profiler_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+enum ProfilePhase {
+    PhaseDrift,      // First half kick and drift
+    PhaseBoundaries, // Ghost (and halo) particles, neighbour lists
+    PhaseDensity,
+    PhaseForce,
+    PhaseKick,       // Second half kick
+    N_PROFILE_PHASES
+};
+
+enum PerfCounter {
+    CounterCycles,
+    CounterInstructions,
+    CounterL1Misses,
+    CounterLLCMisses,
+    CounterBranchMisses,
+    N_PERF_COUNTERS
+};
+
+// Values of the counters at one point, along with how long they have been enabled and actually
+// counting, since the kernel multiplexes them if there are more than the hardware can count at once
+struct CounterSample {
+    uint64_t counts[N_PERF_COUNTERS] = {};
+    uint64_t time_enabled = 0;
+    uint64_t time_running = 0;
+};
+
+// Counters of one thread for one phase. counts[c] is only meaningful if the counter was available.
+struct PhaseCounts {
+    uint64_t counts[N_PERF_COUNTERS] = {};
+    double seconds = 0;
+    uint64_t n_particles = 0;
+    uint64_t n_pairs = 0;
+
+    PhaseCounts& operator +=(const PhaseCounts &other);
+};
+
+class PhaseProfiler {
+    public:
+        // ctor. Does nothing at all if not enabled.
+        explicit PhaseProfiler(bool enabled);
+
+        bool enabled() const { return is_enabled; }
+
+        // Time the phases, without the hardware counters, if the profiler wasn't already enabled.
+        // For when only the times are wanted (see metrics.hpp).
+        void enable_timing() {
+            if (!is_enabled) {
+                is_enabled = true;
+                counting = false;
+            }
+        }
+
+        // Number of threads that have run a phase so far
+        int n_threads() const {
+            std::lock_guard<std::mutex> lock(threads_mutex);
+            return threads.size();
+        }
+
+        // Measures a phase on the calling thread, from construction to destruction
+        class Scope {
+            public:
+                Scope(PhaseProfiler &profiler, ProfilePhase phase);
+                ~Scope();
+
+                // Count the particles (and particle-neighbour pairs) the phase has worked on, which
+                // the counts are reported relative to
+                void add_work(uint64_t n_particles, uint64_t n_pairs = 0) {
+                    particles += n_particles;
+                    pairs += n_pairs;
+                }
+
+            private:
+                PhaseProfiler* profiler;
+                ProfilePhase phase;
+                CounterSample start;
+                std::chrono::steady_clock::time_point start_time;
+                uint64_t particles = 0;
+                uint64_t pairs = 0;
+        };
+
+        // Log the totals of each phase over the run so far, headed by title
+        void report(const std::string &title, int n_steps) const;
+
+        // Totals of a phase over every thread so far
+        PhaseCounts phase_totals(ProfilePhase phase) const;
+
+        // Whether counter could be opened on every thread that has been profiled
+        static bool counter_available(PerfCounter counter);
+
+        static const char* phase_name(ProfilePhase phase);
+        static const char* counter_name(PerfCounter counter);
+
+    private:
+        struct ThreadCounts {
+            std::thread::id thread;
+            PhaseCounts phases[N_PROFILE_PHASES];
+        };
+
+        bool is_enabled;
+        // Whether the hardware counters are read, as well as the time
+        bool counting;
+        // Distinguishes profilers from each other in the threads' caches of their ThreadCounts
+        uint64_t serial;
+
+        // One entry per thread that has run a phase. A deque, so that the entries don't move.
+        std::deque<ThreadCounts> threads;
+        mutable std::mutex threads_mutex;
+
+        // The calling thread's entry in threads
+        ThreadCounts& thread_counts();
+};
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * python_bindings.cpp defines the pysph Python module (built with `make python`, which needs
+ * pybind11), so that simulations can be set up, stepped and analysed from Python in the same
+ * process, rather than going through the dump files:
+ *
+ *   import pysph
+ *   config = pysph.read_config("../config.txt")   # or just a dict
+ *   config["n_part"] = 1001
+ *   sim = pysph.Simulation(config)
+ *   sim.step(100)
+ *   alive = slice(0, sim.n_alive)
+ *   plt.plot(sim.pos[alive], sim.density[alive])
+ *
+ * The particle properties are NumPy arrays that view the particle array itself, so nothing is
+ * copied, and writing to them changes the particles. As the particles are stored as an array of
+ * structs, each is a strided view over one member of Particle. They cover the alive then the ghost
+ * particles, in the same order as the dump files.
+ *
+ * The particle array can be reallocated during a step (e.g. when the number of ghost particles
+ * changes), so the arrays should be fetched again after each call to step(). An old array keeps its
+ * copy of the particles alive, so it is never left pointing at freed memory, but it won't change
+ * any more.
+ *
+ * As in the program, an invalid config value ends the whole process with an error, so check
+ * configs before running a long scan.
+ */
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <fstream>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+
+#include "basictypes.hpp"
+#include "particle_array.hpp"
+#include "setup.hpp"
+#include "sph_simulation.hpp"
+
+#ifdef USE_MPI
+#error "The Python module runs the simulation in the Python process, and can't be combined with MPI"
+#endif
+
+namespace py = pybind11;
+
+static_assert(sizeof(ParticleType) == sizeof(int32_t), "Particle types are viewed as int32");
+
+// Properties that ConfigReader needs to be given. n_part and mass aren't needed with an ic_file.
+static const char* const REQUIRED_PROPERTIES[] = {
+    "pressure_calc", "limit", "v_0", "h_factor", "t_i"
+};
+
+#pragma region Conversion
+
+// Config values as the strings they would be in a config file. Python's str() of a float is the
+// shortest string that reads back as the same value, so nothing is lost.
+static ConfigMap to_config_map(const py::dict &values) {
+    ConfigMap config_map;
+    for (auto item : values)
+        config_map[py::str(item.first)] = py::str(item.second);
+
+    for (const char* name : REQUIRED_PROPERTIES) {
+        if (!config_map.count(name))
+            throw py::key_error(std::string("Missing config property '") + name + "'");
+    }
+
+    if (!config_map.count("ic_file") && !(config_map.count("n_part") && config_map.count("mass")))
+        throw py::key_error("Config needs n_part and mass, unless the particles come from an ic_file");
+
+    return config_map;
+}
+
+static py::dict to_dict(const Config &config) {
+    py::dict d;
+    d["n_part"] = config.n_part - config.n_ghost - config.n_halo;
+    d["mass"] = config.mass;
+    d["pressure_calc"] = (int)config.pressure_calc;
+    d["limit"] = config.limit;
+    d["v_0"] = config.v_0;
+    d["h_factor"] = config.h_factor;
+    d["t_i"] = config.t_i;
+    d["n_threads"] = config.n_threads;
+    d["h_activity_tol"] = config.h_activity_tol;
+    d["density_sum_interval"] = config.density_sum_interval;
+    d["profile"] = config.profile;
+    d["deterministic"] = config.deterministic;
+    d["huge_pages"] = config.huge_pages;
+    d["pin_threads"] = config.pin_threads;
+    return d;
+}
+
+#pragma endregion
+#pragma region Simulation
+
+// A simulation and its particles, set up from a dict of config values the same way main.cpp does
+// from the config file
+class PySimulation {
+    public:
+        explicit PySimulation(const py::dict &values) {
+            ConfigReader reader(to_config_map(values));
+            Config config = reader.GetConfig();
+            std::string ic_file = reader.GetICFile();
+            ParticleArrayPtr p_arr;
+
+            if (ic_file.empty()) {
+                p_arr = allocate_particles(config.n_part);
+                config.n_alloc = config.n_part;
+                init_particles(config, p_arr);
+            } else {
+                load_particles(config, p_arr, ic_file);
+            }
+
+            sim = std::make_unique<SPHSimulation>(config, p_arr);
+            sim->set_show_progress(false);
+            sim->set_write_output(false);
+        }
+
+        void step(int n) {
+            sim->advance(n);
+        }
+
+        // Strided view of the member of every particle at offset, e.g. offsetof(Particle, density)
+        template <typename T>
+        py::array_t<T> view(size_t offset, bool writable = true) const {
+            ParticleArrayPtr p_arr = sim->get_particles();
+            py::ssize_t n = sim->get_config().n_part;
+
+            // The array's base holds a reference to the particles, so they outlive the view even if
+            // the simulation moves on to a new array
+            py::capsule base(new ParticleArrayPtr(p_arr), [](void* p) {
+                delete (ParticleArrayPtr*)p;
+            });
+
+            const T* first = (const T*)((const char*)p_arr.get() + offset);
+            py::array_t<T> result({ n }, { (py::ssize_t)sizeof(Particle) }, first, base);
+
+            if (!writable)
+                result.attr("setflags")(py::arg("write") = false);
+            return result;
+        }
+
+        const SPHSimulation& get() const { return *sim; }
+
+    private:
+        std::unique_ptr<SPHSimulation> sim;
+};
+
+// Property for a member of Particle, as a view onto the particle array
+#define PARTICLE_VIEW(name, type, member, writable) \
+    def_property_readonly(name, [](const PySimulation &s) { \
+        return s.view<type>(offsetof(Particle, member), writable); \
+    })
+
+#pragma endregion
+
+PYBIND11_MODULE(pysph, m) {
+    m.doc() = "1D SPH simulation of two colliding streams, with NumPy views of the particles";
+
+    m.def("read_config", [](const std::string &filename) {
+        std::ifstream config_stream(filename);
+        if (!config_stream)
+            throw py::value_error("Could not open config file " + filename);
+
+        py::dict d;
+        for (auto &[name, value] : ConfigReader::parse_config(config_stream))
+            d[py::str(name)] = value;
+        return d;
+    }, py::arg("filename"), "Read a config file (in the format of config.txt) into a dict of strings");
+
+    py::class_<PySimulation>(m, "Simulation")
+        .def(py::init<const py::dict&>(), py::arg("config"),
+             "Set up the particles from a dict of config values, with the same names as config.txt")
+        .def("step", &PySimulation::step, py::arg("n") = 1, py::call_guard<py::gil_scoped_release>(),
+             "Take n timesteps. Fetch the particle arrays again afterwards.")
+
+        .def_property_readonly("time", [](const PySimulation &s) { return s.get().get_time(); })
+        .def_property_readonly("steps", [](const PySimulation &s) { return s.get().steps_taken(); })
+        .def_property_readonly("config", [](const PySimulation &s) { return to_dict(s.get().get_config()); })
+        .def_property_readonly("n_part", [](const PySimulation &s) { return s.get().get_config().n_part; })
+        .def_property_readonly("n_alive", [](const PySimulation &s) {
+            const Config &c = s.get().get_config();
+            return c.n_part - c.n_ghost - c.n_halo;
+        })
+
+        .PARTICLE_VIEW("id", int32_t, id, false)
+        .PARTICLE_VIEW("type", int32_t, type, false)
+        .PARTICLE_VIEW("mass", real_t, mass, true)
+        #ifdef USE_MIXED_PRECISION
+        // Stored as a bin and an offset, so can't be viewed as a plain array
+        .def_property_readonly("pos", [](const PySimulation &s) {
+            ParticleArrayPtr p_arr = s.get().get_particles();
+            int n = s.get().get_config().n_part;
+            py::array_t<double> pos(n);
+            for (int i = 0; i < n; i++)
+                pos.mutable_at(i) = p_arr[i].pos;
+            return pos;
+        })
+        #else
+        .PARTICLE_VIEW("pos", double, pos, true)
+        #endif
+        .PARTICLE_VIEW("vel", real_t, vel, true)
+        .PARTICLE_VIEW("acc", real_t, acc, true)
+        .PARTICLE_VIEW("h", real_t, h, true)
+        .PARTICLE_VIEW("du_dt", real_t, du_dt, true)
+        .PARTICLE_VIEW("u", real_t, u, true)
+        .PARTICLE_VIEW("density", real_t, density, true)
+        .PARTICLE_VIEW("pressure", real_t, pressure, true)
+        .PARTICLE_VIEW("omega", real_t, omega, true)
+        .PARTICLE_VIEW("drho_dt", real_t, drho_dt, true);
+
+    m.attr("ALIVE") = (int)Alive;
+    m.attr("GHOST") = (int)Ghost;
+    m.attr("HALO") = (int)Halo;
+}
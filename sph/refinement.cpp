@@ -0,0 +1,286 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * refinement.cpp implements the Refiner from refinement.hpp.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "refinement.hpp"
+#include "define.hpp"
+#include "kernel.hpp"
+#include "particle_array.hpp"
+
+// Masses are halved and doubled exactly, but may have been given in a file, so compare loosely
+static const double MASS_TOLERANCE = 1e-6;
+
+// Resets the activity tracking, so that the smoothing length of a new particle is solved for in full
+static void reset_activity(Particle &p) {
+    p.n_solve_neighbours = 0;
+    p.drho_dh = 0;
+    p.activity = 0;
+}
+
+Refiner::Refiner(const Config &config, const Particle* particles, int n)
+    : pressure_calc(config.pressure_calc), h_factor(config.h_factor), limit(config.limit),
+      threshold(config.refine_threshold), max_level(config.refine_max_level)
+{
+    max_mass = 0;
+    for (int i = 0; i < n; i++) {
+        if (particles[i].type == Alive)
+            max_mass = std::max(max_mass, (double)particles[i].mass);
+    }
+
+}
+
+double Refiner::indicator(const Particle* particles, int i, NeighbourRange neighbours) const {
+    const Particle &p = particles[i];
+    double h = p.h;
+    double c_s = pressure_calc == Isothermal ? 1 : std::sqrt(GAMMA * p.pressure / p.density);
+
+    double grad_density = 0;
+    double convergence = 0;
+
+    for (int j : neighbours) {
+        const Particle &p_j = particles[j];
+        double r_ij = p.pos - p_j.pos;
+        double q = std::abs(r_ij) / h;
+
+        if (j == i || q >= KERNEL_RADIUS)
+            continue;
+
+        // SPH estimate of the density gradient, from the differences to the neighbours so that it
+        // is exactly 0 for uniform density
+        double grad_W = dkernel_dq(q) / (h * h) * (r_ij > 0 ? 1 : -1);
+        grad_density += (p_j.mass / p_j.density) * (p_j.density - p.density) * grad_W;
+
+        // mu_ij of the artificial viscosity (Bate eq. 2.32), with the same softening
+        double dot = (p.vel - p_j.vel) * r_ij;
+        if (dot < 0) {
+            double mu = -h * dot / (r_ij * r_ij + 0.01 * h * h);
+            convergence = std::max(convergence, mu / c_s);
+        }
+    }
+
+    return std::max(h * std::abs(grad_density) / p.density, convergence);
+}
+
+RefinementCounts Refiner::refine(ParticleArrayPtr &p_arr, Config &config, const NeighbourList &nlist,
+                                 Executor &executor) {
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+    int n_chunks = (n_alive + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE;
+    const Particle* particles = p_arr.get();
+
+    indicators.resize(n_alive);
+
+    TaskGraph graph;
+    for (int k = 0; k < n_chunks; k++) {
+        graph.add([&, k] {
+            int first = k * TASK_CHUNK_SIZE;
+            int last = std::min(first + TASK_CHUNK_SIZE, n_alive);
+            for (int i = first; i < last; i++)
+                indicators[i] = indicator(particles, i, nlist.neighbours(i));
+        });
+    }
+    executor.run(graph);
+
+    // Merges are between neighbours in position, and the levels are graded along the tube, so walk
+    // through the particles in that order
+    std::vector<int> order(n_alive);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [particles](int a, int b) {
+        return particles[a].pos < particles[b].pos;
+    });
+
+    // Level of each particle (the number of times it has been split), and the level it should be at
+    double merge_threshold = threshold * REFINE_MERGE_FRACTION;
+    std::vector<int> level(n_alive), target(n_alive);
+
+    for (int k = 0; k < n_alive; k++) {
+        int i = order[k];
+        level[k] = std::max(0, (int)std::lround(std::log2(max_mass / particles[i].mass)));
+
+        if (indicators[i] > threshold)
+            target[k] = std::min(level[k] + 1, max_level);
+        else if (indicators[i] < merge_threshold)
+            target[k] = std::max(level[k] - 1, 0);
+        else
+            target[k] = level[k];
+    }
+
+    // The density of a particle much heavier or lighter than the ones around it is dominated by its
+    // own mass, so neighbouring particles are kept within a level (a factor of 2 in mass) of each
+    // other, by refining around the particles that need it. Particles only move one level per
+    // pass, so this may take a few passes to be reached.
+    for (int k = 1; k < n_alive; k++)
+        target[k] = std::max(target[k], target[k - 1] - 1);
+    for (int k = n_alive - 2; k >= 0; k--)
+        target[k] = std::max(target[k], target[k + 1] - 1);
+
+    RefinementCounts counts;
+    std::vector<Particle> refined;
+    refined.reserve(n_alive + n_alive / 8);
+
+    // Level of the last particle added, once it has been split or merged (-1 before the first)
+    int last_level = -1;
+
+    auto keep = [&](int k) {
+        refined.push_back(particles[order[k]]);
+        last_level = level[k];
+        counts.max_level = std::max(counts.max_level, last_level);
+    };
+
+    for (int k = 0; k < n_alive; k++) {
+        int lvl = level[k];
+
+        if (target[k] > lvl) {
+            if (split(particles[order[k]], refined)) {
+                counts.n_split++;
+                last_level = lvl + 1;
+                counts.max_level = std::max(counts.max_level, last_level);
+            } else {
+                keep(k);
+            }
+            continue;
+        }
+
+        if (target[k] == lvl) {
+            keep(k);
+            continue;
+        }
+
+        // A run of particles [k, end) of the same level that all want merging. The boundary between
+        // two levels isn't quite in equilibrium (the particles next to it drift into pairs, and one
+        // lighter particle on its own between heavier ones ends up with a low density), so merging
+        // mustn't make new ones: runs are only merged next to heavier particles, which moves the
+        // boundary along rather than adding another, and always in pairs from that side.
+        int end = k + 1;
+        while (end < n_alive && level[end] == lvl && target[end] < lvl)
+            end++;
+
+        // Levels the particles either side could end up at. The ends of the tube are mirrored by
+        // the ghost particles, so count as being at the same level.
+        int left = k > 0 ? last_level : lvl;
+        int right_min = end < n_alive ? level[end] - (target[end] < level[end]) : lvl;
+        int right_max = end < n_alive ? level[end] + (target[end] > level[end]) : lvl;
+
+        bool merge_run = left < lvl || right_max < lvl;
+
+        // With an odd number, one is left at the end that isn't next to heavier particles
+        int first = k, last = end;
+        if ((end - k) % 2 == 1) {
+            if (right_min >= lvl)
+                last--;
+            else if (left >= lvl)
+                first++;
+            else
+                merge_run = false;
+        }
+
+        // The merged particles also have to stay within a level of the particles either side
+        if ((first == k && left > lvl) || (last == end && right_max > lvl))
+            merge_run = false;
+
+        if (!merge_run) {
+            for (; k < end; k++)
+                keep(k);
+            k--;
+            continue;
+        }
+
+        if (first > k)
+            keep(k);
+
+        for (int m = first; m + 1 < last; m += 2) {
+            const Particle &a = particles[order[m]];
+            const Particle &b = particles[order[m + 1]];
+
+            if (can_merge(a, b)) {
+                Particle merged = a;
+                merge(merged, b);
+                refined.push_back(merged);
+                counts.n_merged++;
+                last_level = lvl - 1;
+                counts.max_level = std::max(counts.max_level, last_level);
+            } else {
+                keep(m);
+                keep(m + 1);
+            }
+        }
+
+        if (last < end)
+            keep(end - 1);
+
+        k = end - 1;
+    }
+
+    if (counts.n_split == 0 && counts.n_merged == 0)
+        return counts;
+
+    // The ghost and halo particles go, and are set up again afterwards
+    int n_refined = refined.size();
+    reserve_particles(p_arr, config, 0, n_refined);
+    std::copy(refined.begin(), refined.end(), p_arr.get());
+
+    config.n_part = n_refined;
+    config.n_ghost = 0;
+    config.n_halo = 0;
+
+    return counts;
+}
+
+bool Refiner::split(const Particle &p, std::vector<Particle> &out) const {
+    // The parent takes up m / rho of the tube, so the children go in the middle of each half of it.
+    // That is where they would be in a lattice of twice as many particles, however close the
+    // parent happens to be to its neighbours.
+    double offset = p.mass / p.density / 4;
+    double pos = p.pos;
+    if (pos - offset <= -limit || pos + offset >= limit)
+        return false;
+
+    // Everything else (velocity, energy, density and their derivatives) is the same as the parent's,
+    // and the smoothing length halves along with the mass
+    for (int side : { -1, 1 }) {
+        Particle child = p;
+        child.mass = p.mass / 2;
+        child.pos = pos + side * offset;
+        child.h = p.h / 2;
+        reset_activity(child);
+        out.push_back(child);
+    }
+
+    return true;
+}
+
+bool Refiner::can_merge(const Particle &a, const Particle &b) const {
+    // Only equal masses, so that merging undoes a split rather than making lopsided particles
+    double m = a.mass + b.mass;
+    return std::abs(a.mass - b.mass) <= MASS_TOLERANCE * m
+           && m <= max_mass * (1 + MASS_TOLERANCE);
+}
+
+void Refiner::merge(Particle &a, const Particle &b) const {
+    double m_a = a.mass;
+    double m_b = b.mass;
+    double m = m_a + m_b;
+    double dv = a.vel - b.vel;
+
+    // Centre of mass, and mass-weighted averages of everything else, which conserves momentum. The
+    // kinetic energy of the pair's motion relative to each other would be lost, so it goes into
+    // the thermal energy instead.
+    a.pos = (m_a * a.pos + m_b * b.pos) / m;
+    a.vel = (m_a * a.vel + m_b * b.vel) / m;
+    a.acc = (m_a * a.acc + m_b * b.acc) / m;
+    a.u = (m_a * a.u + m_b * b.u) / m + 0.5 * m_a * m_b * dv * dv / (m * m);
+    a.du_dt = (m_a * a.du_dt + m_b * b.du_dt) / m;
+    a.density = (m_a * a.density + m_b * b.density) / m;
+    a.pressure = (m_a * a.pressure + m_b * b.pressure) / m;
+    a.drho_dt = (m_a * a.drho_dt + m_b * b.drho_dt) / m;
+    a.mass = m;
+
+    // Same relation between h and density as the root-finding
+    a.h = h_factor * m / a.density;
+    reset_activity(a);
+}
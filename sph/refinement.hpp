@@ -0,0 +1,92 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * refinement.hpp defines the Refiner, which adapts the resolution of the simulation to the flow
+ * when refine_interval is set in config.txt, rather than it being fixed by n_part everywhere. Every
+ * refine_interval steps, each alive particle gets a resolution indicator (see indicator()):
+ *
+ *  - particles above refine_threshold (i.e. in or near a shock) are split into two children with
+ *    half the mass each, either side of where the parent was, down to refine_max_level splits
+ *  - pairs of particles of the same mass that are below REFINE_MERGE_FRACTION of the threshold
+ *    (i.e. in a smooth region) are merged back into one, as long as the result is no heavier than
+ *    the particles started out. This starts from the edges of the refined region, so that it
+ *    shrinks back rather than being broken up into lots of regions of different levels.
+ *  - so that no particle is more than twice as heavy as its neighbours, the particles around the
+ *    ones being split are split too, and particles next to lighter ones aren't merged
+ *
+ * so that the shock is resolved as if there were 2^refine_max_level times as many particles, while
+ * the rest of the tube stays at the resolution it started at. Splitting and merging both conserve
+ * mass and momentum exactly. Splits also conserve energy, and merges do by putting the kinetic
+ * energy of the relative motion of the pair into the thermal energy of the merged particle.
+ *
+ * The new particles only have estimates of their smoothing length and density, so the ghost and
+ * halo particles, neighbour lists, densities and forces all have to be redone afterwards, which
+ * SPHSimulation::refine does. Each split also halves the spacing of the particles, and so the
+ * timestep that they are stable at, so the timestep is t_i / 2^level, for the highest level of
+ * any particle at the time.
+ */
+
+#ifndef refinement_hpp
+#define refinement_hpp
+
+#include <vector>
+
+#include "basictypes.hpp"
+#include "neighbour_list.hpp"
+#include "task_graph.hpp"
+
+// Number of particles split and pairs of particles merged by one pass of the Refiner, and the
+// highest level of any particle afterwards
+struct RefinementCounts {
+    int n_split = 0;
+    int n_merged = 0;
+    int max_level = 0;
+};
+
+class Refiner {
+    public:
+        // ctor. particles are the n particles the simulation starts with; particles can be merged
+        // back up to the mass of the heaviest alive one, and split down to 2^-refine_max_level of it.
+        Refiner(const Config &config, const Particle* particles, int n);
+
+        // Resolution indicator of particle i, from its neighbours: the larger of the relative change
+        // in density over a smoothing length (h |grad rho| / rho), and how fast its neighbours are
+        // converging on it relative to the sound speed (mu / c_s, as in the artificial viscosity).
+        // Both are roughly 0 in smooth flow and of order 1 or more in a shock.
+        double indicator(const Particle* particles, int i, NeighbourRange neighbours) const;
+
+        // Split and merge the alive particles (the first n_alive of the array), using neighbour lists
+        // built for their current positions. If any were split or merged, the array is replaced with
+        // the new alive particles in order of position, without the ghost and halo particles
+        // (config.n_part is the new number of alive particles), so those have to be set up again.
+        // Otherwise the array is left alone.
+        RefinementCounts refine(ParticleArrayPtr &p_arr, Config &config, const NeighbourList &nlist,
+                                Executor &executor);
+
+        // Mass of a particle that has never been split, i.e. the heaviest that can be made by merging
+        double get_max_mass() const { return max_mass; }
+
+    private:
+        PressureCalc pressure_calc;
+        double h_factor;
+        double limit;
+        double threshold;
+        int max_level;
+
+        double max_mass;
+
+        // Indicators of the alive particles, reused between passes
+        std::vector<double> indicators;
+
+        // Replace p with two children of half its mass, either side of it. Returns false (and adds
+        // nothing) if a child would be outside the boundaries.
+        bool split(const Particle &p, std::vector<Particle> &out) const;
+
+        // Whether a and b (neighbours in position) can be merged into one particle
+        bool can_merge(const Particle &a, const Particle &b) const;
+
+        // Combine a and b into a (which keeps the rest of its properties)
+        void merge(Particle &a, const Particle &b) const;
+};
+
+#endif
@@ -5,7 +5,6 @@
  * constructor.
  */
 
-#include <iostream>
 #include <memory>
 #include <algorithm>
 
@@ -13,27 +12,124 @@
 #include "define.hpp"
 #include "basictypes.hpp"
 #include "ghost_particles.hpp"
+#include "neighbour_list.hpp"
+#include "ic_file.hpp"
+#include "task_graph.hpp"
+#include "log.hpp"
 
 #pragma region ConfigParsing
 
-ConfigReader::ConfigReader(std::istream &config_stream) {
-    // Read filestream. ConfigMap is a <string, string> map of <propertyname, value>.
-    ConfigMap config_map = parse_config(config_stream);
-    
+// Read filestream. ConfigMap is a <string, string> map of <propertyname, value>.
+ConfigReader::ConfigReader(std::istream &config_stream) : ConfigReader(parse_config(config_stream)) {}
+
+ConfigReader::ConfigReader(ConfigMap config_map) {
     // Set properties. set_property is a method with a number of overloads, that looks up a string
     // property name in the ConfigMap and then converts the associated value to an appropriate
     // datatype (such as int or double) based on the type of the first argument, which is passed by
     // reference. In short, this initializes the values of the 'config' struct object.
-    set_property(config.n_part, config_map, "n_part");
-    set_property(config.mass, config_map, "mass");
+    set_optional_property(ic_file, config_map, "ic_file", std::string());
+    set_optional_property(live_stream, config_map, "live_stream", std::string());
+    set_optional_property(out_of_core, config_map, "out_of_core", std::string());
+    set_optional_property(metrics_socket, config_map, "metrics_socket", std::string());
+
+    // The particles in an initial conditions file have their own masses, and there are as many as
+    // there are in the file
+    if (ic_file.empty()) {
+        set_property(config.n_part, config_map, "n_part");
+        set_property(config.mass, config_map, "mass");
+    } else {
+        set_optional_property(config.n_part, config_map, "n_part", 0);
+        set_optional_property(config.mass, config_map, "mass", 0.0);
+    }
+
     set_property(config.pressure_calc, config_map, "pressure_calc");
     set_property(config.limit, config_map, "limit");
     set_property(config.v_0, config_map, "v_0");
     set_property(config.h_factor, config_map, "h_factor");
     set_property(config.t_i, config_map, "t_i");
 
+    // Optional properties, which have sensible defaults
+    set_optional_property(config.n_threads, config_map, "n_threads", 0);
+    set_optional_property(config.log_level, config_map, "log_level", (int)LogInfo);
+    set_optional_property(config.h_activity_tol, config_map, "h_activity_tol", 0.0);
+    set_optional_property(config.density_sum_interval, config_map, "density_sum_interval", 1);
+    set_optional_property(config.dump_interval, config_map, "dump_interval", 1);
+    set_optional_property(config.dump_format, config_map, "dump_format", TextDump);
+    set_optional_property(config.analysis_interval, config_map, "analysis_interval", 0);
+    set_optional_property(config.analysis_bins, config_map, "analysis_bins", 100);
+    set_optional_property(config.live_interval, config_map, "live_interval", 1);
+    set_optional_property(config.profile, config_map, "profile", 0);
+    set_optional_property(config.trace, config_map, "trace", 0);
+    set_optional_property(config.trace_interval, config_map, "trace_interval", 10);
+    set_optional_property(config.refine_interval, config_map, "refine_interval", 0);
+    set_optional_property(config.refine_threshold, config_map, "refine_threshold", 0.3);
+    set_optional_property(config.refine_max_level, config_map, "refine_max_level", 2);
+    set_optional_property(config.deterministic, config_map, "deterministic", 0);
+    set_optional_property(config.huge_pages, config_map, "huge_pages", (int)NoHugePages);
+    set_optional_property(config.pin_threads, config_map, "pin_threads", (int)NoPinning);
+    set_optional_property(config.out_of_core_window, config_map, "out_of_core_window", 1000000);
+
+    if (config.dump_interval < 0 || config.analysis_interval < 0 || config.analysis_bins < 1
+        || config.live_interval < 1) {
+        LOG_ERROR("dump_interval and analysis_interval can't be negative, and there must "
+                  << "be at least one analysis bin and one step between live stream frames.");
+        exit(1);
+    }
+
+    if (config.density_sum_interval < 1) {
+        LOG_ERROR("density_sum_interval must be at least 1.");
+        exit(1);
+    }
+
+    if (config.trace_interval < 1) {
+        LOG_ERROR("trace_interval must be at least 1.");
+        exit(1);
+    }
+
+    if (config.dump_format < TextDump || config.dump_format > FullPrecisionTextDump) {
+        LOG_ERROR("dump_format must be 0 (text), 1 (compressed) or 2 (text at full precision).");
+        exit(1);
+    }
+
+    if (config.refine_interval < 0 || config.refine_threshold <= 0 || config.refine_max_level < 0
+        || config.refine_max_level > REFINE_MAX_LEVEL) {
+        LOG_ERROR("refine_interval can't be negative, refine_threshold must be positive, and "
+                  << "refine_max_level must be between 0 and " << REFINE_MAX_LEVEL << ".");
+        exit(1);
+    }
+
+    if (config.huge_pages < NoHugePages || config.huge_pages > ExplicitHugePages
+        || config.pin_threads < NoPinning || config.pin_threads > SpreadPinning) {
+        LOG_ERROR("huge_pages must be 0 (none), 1 (transparent) or 2 (explicit), and pin_threads "
+                  << "must be 0 (none), 1 (compact) or 2 (spread over NUMA nodes).");
+        exit(1);
+    }
+
+    if (!out_of_core.empty()) {
+        #ifdef USE_MPI
+        LOG_ERROR("out_of_core can't be used in the MPI build.");
+        exit(1);
+        #endif
+
+        // These all need every particle in memory at once
+        if (!ic_file.empty() || !live_stream.empty() || !metrics_socket.empty()
+            || config.analysis_interval > 0 || config.refine_interval > 0 || config.trace
+            || config.dump_format == CompressedDump) {
+            LOG_ERROR("out_of_core can't be combined with ic_file, live_stream, metrics_socket, "
+                      << "analysis_interval, refine_interval, trace or compressed dumps.");
+            exit(1);
+        }
+
+        if (config.out_of_core_window < 1) {
+            LOG_ERROR("out_of_core_window must be at least 1.");
+            exit(1);
+        }
+    }
+
     // 'Runtime' properties
     config.n_ghost = 0;
+    config.n_halo = 0;
+    config.n_alloc = 0;
 }
 
 Config ConfigReader::GetConfig() {
@@ -41,6 +137,22 @@ Config ConfigReader::GetConfig() {
     return config;
 }
 
+std::string ConfigReader::GetICFile() {
+    return ic_file;
+}
+
+std::string ConfigReader::GetLiveStream() {
+    return live_stream;
+}
+
+std::string ConfigReader::GetOutOfCore() {
+    return out_of_core;
+}
+
+std::string ConfigReader::GetMetricsSocket() {
+    return metrics_socket;
+}
+
 ConfigMap ConfigReader::parse_config(std::istream &cfg_stream) {
     ConfigMap result_map;
 
@@ -60,7 +172,7 @@ ConfigMap ConfigReader::parse_config(std::istream &cfg_stream) {
 
             if (space == std::string::npos) {
                 // Error if no space found
-                std::cerr << "[ERROR] Parsing error on line " << current_line << " of config file.";
+                LOG_ERROR("Parsing error on line " << current_line << " of config file.");
                 exit(1);
             }
 
@@ -69,15 +181,15 @@ ConfigMap ConfigReader::parse_config(std::istream &cfg_stream) {
 
             if (propname.length() == 0 || propvalue.length() == 0) {
                 // Error if there was a space but nothing on one side of it
-                std::cerr << "[ERROR] Parsing error on line " << current_line << " of config file.";
+                LOG_ERROR("Parsing error on line " << current_line << " of config file.");
                 exit(1);
             }
 
             // What if the parameter is already in the map? Not a fatal error, but the user should
             // be told
             if (result_map.count(propname)) {
-                std::cout << "[WARN] Ignoring second definition of parameter '" << propname << 
-                "' on line " << current_line << " of config file." << std::endl; 
+                LOG_WARN("Ignoring second definition of parameter '" << propname << 
+                         "' on line " << current_line << " of config file.");
             }
             
             // .insert() will do nothing if the value is already in the map, as per the above
@@ -96,8 +208,8 @@ std::string ConfigReader::read_config_map(ConfigMap &config_map, const std::stri
     } else {
         // The problem with this is it means every parameter is required...it should be fine for a
         // simple SPH program without optional functionality
-        std::cerr << "[ERROR] Failed to find a definition for property '" << prop_name << "' in the"
-        " config file." << std::endl;
+        LOG_ERROR("Failed to find a definition for property '" << prop_name << "' in the"
+                  " config file.");
         exit(1);
     }
 }
@@ -107,12 +219,12 @@ void ConfigReader::set_property(int &prop, ConfigMap &config_map, const std::str
     try {
         prop = std::stoi(prop_value);
     } catch (const std::invalid_argument &ia) {
-        std::cerr << "[ERROR] Failed to parse value '" << prop_value << "' for property '"
-                  << prop_name << "' of type 'int'." << std::endl;
+        LOG_ERROR("Failed to parse value '" << prop_value << "' for property '"
+                  << prop_name << "' of type 'int'.");
         exit(1);
     } catch (const std::out_of_range &e) {
-        std::cerr << "[ERROR] The value '" << prop_value << "' is out of range for property '"
-                  << prop_name << "' of type 'int'" << std::endl;
+        LOG_ERROR("The value '" << prop_value << "' is out of range for property '"
+                  << prop_name << "' of type 'int'");
         exit(1);
 
     }
@@ -123,8 +235,8 @@ void ConfigReader::set_property(double &prop, ConfigMap &config_map, const std::
     try {
         prop = std::stod(prop_value);
     } catch (const std::invalid_argument &ia) {
-        std::cerr << "[ERROR] Failed to parse value '" << prop_value << "' for property '"
-                  << prop_name << "' of type 'double'." << std::endl;
+        LOG_ERROR("Failed to parse value '" << prop_value << "' for property '"
+                  << prop_name << "' of type 'double'.");
         exit(1);
     }
 }
@@ -137,11 +249,21 @@ void ConfigReader::set_property(PressureCalc &prop, ConfigMap &config_map, const
     prop = (PressureCalc)tmp_prop;
 }
 
+void ConfigReader::set_property(DumpFormat &prop, ConfigMap &config_map, const std::string &prop_name) {
+    // Same as PressureCalc
+    int tmp_prop;
+    set_property(tmp_prop, config_map, prop_name);
+    prop = (DumpFormat)tmp_prop;
+}
+
+void ConfigReader::set_property(std::string &prop, ConfigMap &config_map, const std::string &prop_name) {
+    prop = read_config_map(config_map, prop_name);
+}
+
 #pragma endregion
 #pragma region ParticleInitialization
 
-void init_particles(Config &config, ParticleArrayPtr &p_arr)
-{
+void init_lattice_particle(const Config &config, int i, Particle &p) {
     double max_x = config.limit;
     double min_x = -max_x;
     double spacing = (max_x - min_x) / (config.n_part-1);
@@ -151,45 +273,81 @@ void init_particles(Config &config, ParticleArrayPtr &p_arr)
     max_x -= spacing / 2;
     min_x += spacing / 2;
 
+    spacing = (max_x - min_x) / (config.n_part-1);
+    double pos = min_x + spacing * (i);
+    
+    // +v_0 if pos negative, -v_0 otherwise
+    double vel = (pos < 0) ? config.v_0 : -config.v_0;
+    
+    p.pos = pos;
+    p.mass = config.mass;
+    // p.vel will be overwritten later if the adiabatic option is enabled, as soon as the
+    // acceleration is known, which defines the pressure as an intermediate and thus the sound
+    // speed
+    p.vel = vel;
+
+    // Set initial adiabatic energy
+    if (config.pressure_calc == Adiabatic)
+        p.u = 1/(GAMMA - 1);
+
+    
+    #ifdef USE_VARIABLE_H
+    // Set variable h to a guess. Don't actually do the rootfinding, because that leads to the
+    // edge particles having higher smoothing lengths and influences the ghost particle setup.
+    p.h = config.h_factor * spacing;
+    #endif
+    
+    #ifndef USE_VARIABLE_H
+    // Set constant h
+    p.h = CONSTANT_H;
+    #endif
+}
+
+void init_particles(Config &config, ParticleArrayPtr &p_arr)
+{
+    for (int i = 0; i < config.n_part; i++)
+        init_lattice_particle(config, i, p_arr[i]);
+
+    calc_initial_conditions(config, p_arr, config.pressure_calc == Adiabatic);
+}
+
+void load_particles(Config &config, ParticleArrayPtr &p_arr, const std::string &filename) {
+    uint32_t flags = read_ic_file(filename, config, p_arr);
+
     for (int i = 0; i < config.n_part; i++) {
-        Particle& p  = p_arr[i];
-
-        double spacing = (max_x - min_x) / (config.n_part-1);
-        double pos = min_x + spacing * (i);
-        
-        // +v_0 if pos negative, -v_0 otherwise
-        double vel = (pos < 0) ? config.v_0 : -config.v_0;
-        
-        p.pos = pos;
-        p.mass = config.mass;
-        // p.vel will be overwritten later if the adiabatic option is enabled, as soon as the
-        // acceleration is known, which defines the pressure as an intermediate and thus the sound
-        // speed
-        p.vel = vel;
-
-        // Set initial adiabatic energy
-        if (config.pressure_calc == Adiabatic)
-            p.u = 1/(GAMMA - 1);
-
-        
+        Particle& p = p_arr[i];
+
+        // Same defaults as init_particles for anything not in the file
+        if (!(flags & IC_HAS_VEL))
+            p.vel = (p.pos < 0) ? config.v_0 : -config.v_0;
+
         #ifdef USE_VARIABLE_H
-        // Set variable h to a guess. Don't actually do the rootfinding, because that leads to the
-        // edge particles having higher smoothing lengths and influences the ghost particle setup.
-        p.h = config.h_factor * spacing;
+        // Guess based on the mean spacing; it's only a starting point for the root-finding
+        if (!(flags & IC_HAS_H))
+            p.h = config.h_factor * 2 * config.limit / (config.n_part - 1);
         #endif
-        
+
         #ifndef USE_VARIABLE_H
-        // Set constant h
         p.h = CONSTANT_H;
         #endif
     }
 
+    // Velocities from the file are used as they are, so the adiabatic sound speed pass (and its
+    // density and acceleration sums) can be skipped
+    bool set_sound_speed = config.pressure_calc == Adiabatic && !(flags & IC_HAS_VEL);
+    calc_initial_conditions(config, p_arr, set_sound_speed);
+}
+
+void calc_initial_conditions(Config &config, ParticleArrayPtr &p_arr, bool set_sound_speed) {
     // In the adiabatic case, we must first calculate accelerations so that we can set the
     // initial velocitites of particles to the adiabatic sound speed, which depends on pressure.
-    auto dc = DensityCalculator(config, p_arr);
-    auto ac = AccelerationCalculator(config, p_arr);
+    NeighbourList nlist;
+    nlist.build(p_arr, config);
 
-    if (config.pressure_calc == Adiabatic) {
+    auto dc = DensityCalculator(config, p_arr, nlist);
+    auto ac = AccelerationCalculator(config, p_arr, nlist);
+
+    if (set_sound_speed) {
         for (int i = 0; i < config.n_part; i++) {
             dc(p_arr[i]);
         }
@@ -201,30 +359,31 @@ void init_particles(Config &config, ParticleArrayPtr &p_arr)
         }
     }
 
-    std::cout << "[INFO] Allocated " << config.n_part << " alive particles." << std::endl;
+    LOG_INFO("Allocated " << config.n_part << " alive particles.");
     
     // Next step: setup ghost particles. 
     setup_ghost_particles(p_arr, config);
 
-    std::cout << "[INFO] Initialized " << config.n_ghost << " ghost particles." << std::endl;
-    std::cout << "[INFO] Initialized " << config.n_part << " total particles." << std::endl;
-    std::cout << "[INFO] Calculating initial conditions..." << std::endl;
+    LOG_INFO("Initialized " << config.n_ghost << " ghost particles.");
+    LOG_INFO("Initialized " << config.n_part << " total particles.");
+    LOG_INFO("Calculating initial conditions...");
 
     // Calculate conditions at T = 0
+    nlist.update(p_arr, config);
     dc.update(config, p_arr);
-    ac.update(config, p_arr);
-    auto ec = EnergyCalculator(config, p_arr);
+    auto fc = ForceCalculator(config, p_arr, nlist);
 
     for (int i = 0; i < config.n_part; i++) {
         dc(p_arr[i]);
     }
-    
+
     // Once density is defined for all particles, can calculate derived quantities
     for (int i = 0; i < config.n_part; i++) {
-        ac(p_arr[i]);
-        ec(p_arr[i]);
+        fc(p_arr[i]);
     }
 
+    Logger::get().flush_tallies();
+
 }
 
 #pragma endregion
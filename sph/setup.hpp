@@ -32,13 +32,33 @@ class ConfigReader {
     public:
         // Ctor reads stream and initializes Config object
         ConfigReader(std::istream &config_stream);
+        // Ctor for an already parsed config, e.g. with some of the values changed by the ensemble
+        // driver
+        ConfigReader(ConfigMap config_map);
         
         // Return determined Config object. ALmost every context within the program requires the
         // config value (basically because we always need to know n_part to loop through the C-style
         // array), so it is advantageous to 'shed' the extraneous parts of the ConfigReader class
         // and just return the struct values which are then passed around.
         Config GetConfig();
-    private:
+
+        // Path of the binary initial conditions file to load the particles from, or an empty string
+        // if the particles should be set up by init_particles instead. Not part of Config, since
+        // that is copied around a lot.
+        std::string GetICFile();
+
+        // Name of the shared memory segment to publish the particles to as the simulation runs
+        // (see live_stream.hpp), or an empty string if there isn't one
+        std::string GetLiveStream();
+
+        // Path of the file to keep the particles in, streaming through them in windows rather than
+        // holding them all in memory (see out_of_core.hpp), or an empty string to run as normal
+        std::string GetOutOfCore();
+
+        // Path of the Unix domain socket to serve the progress of the run on (see metrics.hpp), or
+        // an empty string if there isn't one
+        std::string GetMetricsSocket();
+
         // parse_config: takes in a stream of the config file, and creates a <string, string> map of
         // <propertyname, propertyvalue> to be converted later in the Config constructor. 
         static ConfigMap parse_config(std::istream &cfg_stream);
@@ -49,16 +69,54 @@ class ConfigReader {
 
         // Overloads of set_property. These take in a particular type of Config member by reference
         // as well as a string property value, and each overload has a different way of converting
-        // the property value based on the type of the Config member.
+        // the property value based on the type of the Config member. Public so that other input
+        // files in the same format (e.g. the ensemble sweep spec) can use them too.
         static void set_property(int &prop, ConfigMap &config_map, const std::string &prop_name);
         static void set_property(double &prop, ConfigMap &config_map, const std::string &prop_name);
         static void set_property(PressureCalc &prop, ConfigMap &config_map, const std::string &prop_name);
+        static void set_property(DumpFormat &prop, ConfigMap &config_map, const std::string &prop_name);
+        static void set_property(std::string &prop, ConfigMap &config_map, const std::string &prop_name);
 
+        // Optional properties: if the property isn't in the config file at all, prop is set to
+        // default_value instead of this being an error. Uses the set_property overloads otherwise.
+        template <typename T>
+        static void set_optional_property(
+            T &prop,
+            ConfigMap &config_map,
+            const std::string &prop_name,
+            T default_value
+        ) {
+            if (config_map.count(prop_name))
+                set_property(prop, config_map, prop_name);
+            else
+                prop = default_value;
+        }
+
+    private:
         // Data structure.
         Config config;
+        std::string ic_file;
+        std::string live_stream;
+        std::string out_of_core;
+        std::string metrics_socket;
 };
 
 // Take in a pointer to a particle array, and loop through it to properly initialize the particles.
 void init_particles(Config &c, ParticleArrayPtr &p_arr_ptr);
 
+// Set the position, velocity, mass, energy and smoothing length of particle i of the c.n_part in
+// the lattice made by init_particles, e.g. for particles that aren't all in one array
+void init_lattice_particle(const Config &c, int i, Particle &p);
+
+// Alternative to init_particles: allocate the particle array and fill it from a binary initial
+// conditions file (see ic_file.hpp) instead of generating the lattice. n_part and mass from the
+// config are ignored. If the file has velocities, they are used as they are, even in the adiabatic
+// case.
+void load_particles(Config &c, ParticleArrayPtr &p_arr_ptr, const std::string &filename);
+
+// Second half of the setup, shared by the two functions above: optionally set the velocities to the
+// adiabatic sound speed, set up the ghost particles, and calculate the densities, accelerations etc
+// at t = 0.
+void calc_initial_conditions(Config &c, ParticleArrayPtr &p_arr_ptr, bool set_sound_speed);
+
 #endif
\ No newline at end of file
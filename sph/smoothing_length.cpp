@@ -1,11 +1,14 @@
 #include <gsl/gsl_vector.h>
 #include <gsl/gsl_roots.h>
 #include <gsl/gsl_errno.h>
-#include <iostream>
+#include <algorithm>
+#include <cmath>
 
 #include "smoothing_length.hpp"
 #include "define.hpp"
 #include "kernel.hpp"
+#include "log.hpp"
+#include "metrics.hpp"
 
 // Params for root-finding method
 // In hindsight, I should've used a ParticleArrayPtr in this params struct, but I suppose I had an
@@ -17,10 +20,25 @@ struct params
 {
     const Particle* p; // Particle in question
     const Particle* p_arr; // Pointer to array of particles
-    int n_part; // Length of above array
+    NeighbourRange neighbours; // Indices of the particles in the above array to sum over
     double h_fact; // Smoothing length parameter; see Price 2012 eq. 10
 };
 
+// GSL solvers, allocated once per thread and then reused for every root-finding rather than being
+// allocated and freed for every particle. gsl_root_*solver_set resets them before each use.
+struct Solvers
+{
+    gsl_root_fdfsolver* newton = gsl_root_fdfsolver_alloc(gsl_root_fdfsolver_newton);
+    gsl_root_fsolver* bisection = gsl_root_fsolver_alloc(gsl_root_fsolver_bisection);
+
+    ~Solvers() {
+        gsl_root_fdfsolver_free(newton);
+        gsl_root_fsolver_free(bisection);
+    }
+};
+
+static thread_local Solvers solvers;
+
 
 
 // Calculate the derivative of the weighting function with respect to h
@@ -50,10 +68,10 @@ double calc_dW_dh(const Particle &p_1, const Particle &p_2, double h) {
 }
 
 // Calculate the derivative of the summation with respect to h
-double calc_density_dh(const Particle &p, double h, const Particle* p_arr, int n_part) {
+double calc_density_dh(const Particle &p, double h, const Particle* p_arr, NeighbourRange neighbours) {
     double d_sum = 0;
-    for (int i = 0; i < n_part; i++) {
-        Particle p_j = *(p_arr + i);
+    for (int j : neighbours) {
+        const Particle &p_j = *(p_arr + j);
         double dW_dh = calc_dW_dh(p, p_j, h);
         d_sum += p_j.mass * dW_dh;
     }
@@ -61,14 +79,9 @@ double calc_density_dh(const Particle &p, double h, const Particle* p_arr, int n
     return d_sum;
 }
 
-double calc_omega(const Particle &p, ParticleArrayPtr p_arr, Config c) {
+double calc_omega(const Particle &p, ParticleArrayPtr p_arr, NeighbourRange neighbours) {
     #ifdef USE_VARIABLE_H
-    // Price 2012 eq. 27
-    double o_sum = calc_density_dh(p, p.h, p_arr.get(), c.n_part);
-
-    double dh_drho = -p.h / p.density;
-    o_sum *= dh_drho;
-    return 1 - o_sum;
+    return calc_omega(p, calc_density_dh(p, p.h, p_arr.get(), neighbours));
     #endif
     
     #ifndef USE_VARIABLE_H
@@ -76,15 +89,51 @@ double calc_omega(const Particle &p, ParticleArrayPtr p_arr, Config c) {
     #endif
 }
 
+double calc_omega(const Particle &p, double drho_dh) {
+    // Price 2012 eq. 27
+    double o_sum = drho_dh;
+
+    double dh_drho = -p.h / p.density;
+    o_sum *= dh_drho;
+    return 1 - o_sum;
+}
+
 // Summation density calculation
-double calc_density(const Particle &p, double h, const Particle* p_arr, int n_part) {
+double calc_density(const Particle &p, double h, const Particle* p_arr, NeighbourRange neighbours) {
     double d_sum = 0;
-    for (int i = 0; i < n_part; i++) {
-        Particle p_j = *(p_arr + i);
+    for (int j : neighbours) {
+        const Particle &p_j = *(p_arr + j);
         double q = std::abs(p.pos - p_j.pos) / h;
         double w = kernel(q);
 
-        d_sum += p.mass * (w / h);
+        d_sum += p_j.mass * (w / h);
+    }
+
+    return d_sum;
+}
+
+double calc_density_activity(
+    const Particle &p,
+    const Particle* p_arr,
+    NeighbourRange neighbours,
+    int &n_inside,
+    double &max_dv
+) {
+    double d_sum = 0;
+    n_inside = 0;
+    max_dv = 0;
+
+    for (int j : neighbours) {
+        const Particle &p_j = *(p_arr + j);
+        double q = std::abs(p.pos - p_j.pos) / p.h;
+        double w = kernel(q);
+
+        d_sum += p_j.mass * (w / p.h);
+
+        if (q < KERNEL_RADIUS) {
+            n_inside++;
+            max_dv = std::max(max_dv, std::abs((double)(p.vel - p_j.vel)));
+        }
     }
 
     return d_sum;
@@ -95,11 +144,11 @@ double smoothing_f(double x, void* params) {
     // Get parameters
     const Particle p = *((struct params*)params)->p;
     const Particle* p_arr = ((struct params*)params)->p_arr;
-    int n_part = ((struct params*)params)->n_part;
+    NeighbourRange neighbours = ((struct params*)params)->neighbours;
     double h_fact = ((struct params*)params)->h_fact;
 
     // Calculate density via sum over other particles
-    double density_sum = calc_density(p, x, p_arr, n_part);
+    double density_sum = calc_density(p, x, p_arr, neighbours);
     // Calculate density via expression (Price 2018 eq. 10)
     double density_exp = p.mass * h_fact / x;
 
@@ -113,11 +162,11 @@ double smoothing_df(double x, void *params) {
     // Get parameters
     const Particle p = *((struct params*)params)->p;
     const Particle* p_arr = ((struct params*)params)->p_arr;
-    int n_part = ((struct params*)params)->n_part;
+    NeighbourRange neighbours = ((struct params*)params)->neighbours;
     double h_fact = ((struct params*)params)->h_fact;
 
     // Price 2018 eq. 12
-    double drho_dh_sum = calc_density_dh(p, x, p_arr, n_part);
+    double drho_dh_sum = calc_density_dh(p, x, p_arr, neighbours);
     double drho_dh_exp = -p.mass * h_fact / std::pow(x, 2);
 
     return drho_dh_sum - drho_dh_exp;
@@ -129,18 +178,32 @@ void smoothing_fdf(double x, void *params, double *y, double *dy) {
     *dy = smoothing_df(x, params);
 }
 
+double predict_h_factor(double density, double drho_dt, double dt) {
+    if (!(density > 0))
+        return 1;
+
+    // Integrated over the step as if drho/dt / rho were constant, which keeps h positive however
+    // fast the density changes
+    double factor = std::exp(-dt * drho_dt / density);
+    return std::clamp(factor, 1 / H_PREDICT_MAX_FACTOR, H_PREDICT_MAX_FACTOR);
+}
+
+bool density_sum_due(const Config &c, int step) {
+    return c.density_sum_interval <= 1 || step % c.density_sum_interval == 0;
+}
+
 // Fallback bisection method. Not in header file since it's only called into by rootfind_h in case
 // Newton's method fails
 double rootfind_h_fallback(
     const Particle &p, 
     const ParticleArrayPtr p_arr,
-    const Config c
+    const Config c,
+    NeighbourRange neighbours
 ) {
     int status;
     int iter = 0;
 
-    const gsl_root_fsolver_type *T;
-    gsl_root_fsolver *s;
+    gsl_root_fsolver *s = solvers.bisection;
 
     // Since it's a fallback, and is unlikely to be used that much, set the intervals really wide
     double x = CALC_EPSILON;
@@ -150,7 +213,7 @@ double rootfind_h_fallback(
     struct params param = {
         &p,
         p_arr.get(),
-        c.n_part,
+        neighbours,
         c.h_factor
     };
 
@@ -161,8 +224,6 @@ double rootfind_h_fallback(
     
     // Could probably use Brent to be honest, but again -- it's not going to be used unless Newton's
     // method fails, so it's probably wise to keep it simple and extremely reliable
-    T = gsl_root_fsolver_bisection;
-    s = gsl_root_fsolver_alloc(T);
     status = gsl_root_fsolver_set(s, &f, x_lo, x_hi);
 
     // Solver loop
@@ -178,11 +239,11 @@ double rootfind_h_fallback(
 
     // If this fails, then we're probably in trouble!
     if (status != GSL_SUCCESS) {
-        std::cout << "[WARN] Fallback smoothing length root-finding failed for particle id " << p.id
-                  << " with status '" << gsl_strerror(status) << "'" << std::endl;
+        LOG_TALLY(LogWarn, "Fallback smoothing length root-finding failed",
+                  "Fallback smoothing length root-finding failed for particle id " << p.id
+                  << " with status '" << gsl_strerror(status) << "'");
     }
 
-    gsl_root_fsolver_free(s);
     return x;
 
 }
@@ -191,10 +252,10 @@ double rootfind_h_fallback(
 double rootfind_h(
     const Particle &p, // p probably doesn't need to be passed by reference...oops
     const ParticleArrayPtr p_arr,
-    const Config c
+    const Config c,
+    NeighbourRange neighbours
 ) {
-    const gsl_root_fdfsolver_type *T;
-    gsl_root_fdfsolver *s;
+    gsl_root_fdfsolver *s = solvers.newton;
 
     int status;
     size_t iter = 0;
@@ -203,7 +264,7 @@ double rootfind_h(
     struct params param = {
         &p,
         p_arr.get(),
-        c.n_part,
+        neighbours,
         c.h_factor
     };
 
@@ -229,8 +290,6 @@ double rootfind_h(
         x = c.h_factor * mean_p_spacing;
     }
 
-    T = gsl_root_fdfsolver_newton;
-    s = gsl_root_fdfsolver_alloc(T);
     gsl_root_fdfsolver_set(s, &f, x);
     
     // Main solver loop
@@ -243,18 +302,23 @@ double rootfind_h(
 
     } while (status == GSL_CONTINUE && iter < H_MAX_ITER_NR);
 
+    SolverCounters &counters = solver_counters();
+    counters.solves.add(1);
+    counters.iterations.add(iter);
+
     if (status != GSL_SUCCESS) {
+        counters.fallbacks.add(1);
+
         // Fallback to bisection
         #ifdef H_WARNINGS
-        std::cout << "[WARN] Smoothing length root-finding failed for particle id " << p.id
-                  << " with status '" << gsl_strerror(status) << "'" << std::endl;
-        
-        std::cout << "[WARN] Repeating root-finding process using bisection." << std::endl;
+        LOG_TALLY(LogWarn, "Smoothing length root-finding fell back to bisection",
+                  "Smoothing length root-finding failed for particle id " << p.id
+                  << " with status '" << gsl_strerror(status) << "'. Repeating root-finding process "
+                  << "using bisection.");
         #endif
-        x = rootfind_h_fallback(p, p_arr, c);
+        x = rootfind_h_fallback(p, p_arr, c, neighbours);
     }
 
-    gsl_root_fdfsolver_free(s);
     return x;
 }
 
@@ -13,25 +13,58 @@
 #include <utility>
 
 #include "basictypes.hpp"
+#include "neighbour_list.hpp"
 
-// Actual iterative density calculation (Equation 2.21 of Bate thesis)
-double calc_density(const Particle &p, const double h, const Particle* p_arr, const int n_part);
+// Actual iterative density calculation (Equation 2.21 of Bate thesis), summing over the given
+// neighbours of p
+double calc_density(const Particle &p, const double h, const Particle* p_arr, NeighbourRange neighbours);
 
 
+// The same summation as calc_density at p's current smoothing length, which also counts the
+// neighbours inside the kernel and finds the largest speed of one of them relative to p. Used by
+// DensityCalculator to tell whether p's smoothing length needs solving for again.
+double calc_density_activity(
+    const Particle &p,
+    const Particle* p_arr,
+    NeighbourRange neighbours,
+    int &n_inside,
+    double &max_dv
+);
+
+// Derivative of the density summation with respect to h (Price 2018 eq. 12)
+double calc_density_dh(const Particle &p, double h, const Particle* p_arr, NeighbourRange neighbours);
+
 // Calculate 'omega' parameter from Rosswog 2009 eq. 111
 // Incorporation of this quantity into the momentum equation is required when using variable
 // smoothing lengths.
-double calc_omega(const Particle &p, ParticleArrayPtr p_arr, Config c);
+double calc_omega(const Particle &p, ParticleArrayPtr p_arr, NeighbourRange neighbours);
+
+// As above, from an already calculated derivative of the density summation w.r.t. h
+double calc_omega(const Particle &p, double drho_dh);
+
+// Factor the smoothing length of a particle changes by over the next dt, from the rate of change of
+// its density, as it follows from h = h_fact * m / rho (Price 2012 eq. 10 in 1D):
+// dh/dt = -(h / rho) * drho/dt. The density changes by the inverse. Used to seed rootfind_h with,
+// see PREDICT_H in define.hpp.
+double predict_h_factor(double density, double drho_dt, double dt);
+
+// Whether the densities are summed (and h solved for) on the given step. On the other steps (see
+// density_sum_interval in config.txt) the density is integrated with the same factor, and h found
+// from it in closed form instead. Omega keeps its value from the last sum.
+bool density_sum_due(const Config &c, int step);
 
 // Use a derivative based (Newton Raphsen at the moment) rootfinding method to determine a value for
 // h. Returns the estimate for h.
 // show_steps will make the algorithm show every iteration (lots of spam!) but this will always be
 // done irrespective of the value passed on a repeat run after the solver encountered a warning or
 // error when H_DEBUG is defined
+// The density summations only run over the given neighbours of p, so these must cover the kernel
+// radius of the smoothing length that is found (see NeighbourList::covers)
 double rootfind_h(
     const Particle &p, 
     const ParticleArrayPtr p_arr,
-    const Config c
+    const Config c,
+    NeighbourRange neighbours
 );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,292 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * snapshot_codec.cpp implements the snapshot stream from snapshot_codec.hpp.
+ */
+
+#include <cstring>
+
+#include "snapshot_codec.hpp"
+#include "define.hpp"
+#include "log.hpp"
+
+// Runs of zeros shorter than this are left in the literals, as a run costs at least 2 bytes and
+// splits the literal around it in two
+static const size_t MIN_ZERO_RUN = 4;
+
+// Bytes per particle before compression: id, type and the double columns
+static const size_t BYTES_PER_PARTICLE = sizeof(int32_t) + sizeof(uint8_t) + SNAPSHOT_N_COLUMNS * sizeof(double);
+
+Snapshot::Snapshot(const std::vector<Particle> &particles, int step, double time)
+    : step(step), time(time)
+{
+    int n = particles.size();
+    id.resize(n);
+    type.resize(n);
+    for (auto &column : columns)
+        column.resize(n);
+
+    for (int i = 0; i < n; i++) {
+        const Particle &p = particles[i];
+        id[i] = p.id;
+        type[i] = p.type;
+        columns[0][i] = p.h;
+        columns[1][i] = p.density;
+        columns[2][i] = p.pressure;
+        columns[3][i] = p.acc;
+        columns[4][i] = p.vel;
+        columns[5][i] = p.pos;
+        columns[6][i] = p.u;
+    }
+}
+
+#pragma region Compression
+
+static void put_varint(std::vector<uint8_t> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static bool get_varint(const uint8_t* &data, const uint8_t* end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (data == end)
+            return false;
+
+        uint8_t byte = *data++;
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+std::vector<uint8_t> compress_zero_runs(const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> out;
+    size_t n = data.size();
+    size_t literal_start = 0;
+
+    auto end_literal = [&](size_t end) {
+        if (end > literal_start) {
+            out.push_back(0);
+            put_varint(out, end - literal_start);
+            out.insert(out.end(), data.begin() + literal_start, data.begin() + end);
+        }
+    };
+
+    size_t i = 0;
+    while (i < n) {
+        if (data[i] != 0) {
+            i++;
+            continue;
+        }
+
+        size_t run_end = i;
+        while (run_end < n && data[run_end] == 0)
+            run_end++;
+
+        if (run_end - i >= MIN_ZERO_RUN) {
+            end_literal(i);
+            out.push_back(1);
+            put_varint(out, run_end - i);
+            literal_start = run_end;
+        }
+        i = run_end;
+    }
+    end_literal(n);
+
+    return out;
+}
+
+bool decompress_zero_runs(const uint8_t* data, size_t size, std::vector<uint8_t> &out) {
+    const uint8_t* end = data + size;
+    size_t pos = 0;
+
+    while (data != end) {
+        uint8_t tag = *data++;
+        uint64_t length;
+
+        if (tag > 1 || !get_varint(data, end, length) || length > out.size() - pos)
+            return false;
+
+        if (tag == 0) {
+            if (length > (uint64_t)(end - data))
+                return false;
+            std::memcpy(out.data() + pos, data, length);
+            data += length;
+        } else {
+            std::memset(out.data() + pos, 0, length);
+        }
+        pos += length;
+    }
+
+    return pos == out.size();
+}
+
+#pragma endregion
+#pragma region Columns
+
+// XOR each value with its reference (the same particle in the previous frame, or the previous
+// particle if there is no previous frame) and append the result to out, byte-shuffled
+template <typename T>
+static void encode_column(const std::vector<T> &values, const std::vector<T>* previous, std::vector<uint8_t> &out) {
+    const size_t n = values.size();
+    const size_t width = sizeof(T);
+    const uint8_t* bytes = (const uint8_t*)values.data();
+    const uint8_t* ref = previous ? (const uint8_t*)previous->data() : nullptr;
+
+    size_t start = out.size();
+    out.resize(start + n * width);
+    uint8_t* shuffled = out.data() + start;
+
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < width; b++) {
+            uint8_t r = ref ? ref[i * width + b] : (i > 0 ? bytes[(i - 1) * width + b] : 0);
+            shuffled[b * n + i] = bytes[i * width + b] ^ r;
+        }
+    }
+}
+
+// Reverse of encode_column. Reads values.size() values from in, and returns the position after them.
+template <typename T>
+static const uint8_t* decode_column(const uint8_t* in, const std::vector<T>* previous, std::vector<T> &values) {
+    const size_t n = values.size();
+    const size_t width = sizeof(T);
+    uint8_t* bytes = (uint8_t*)values.data();
+    const uint8_t* ref = previous ? (const uint8_t*)previous->data() : nullptr;
+
+    for (size_t i = 0; i < n; i++) {
+        for (size_t b = 0; b < width; b++) {
+            uint8_t r = ref ? ref[i * width + b] : (i > 0 ? bytes[(i - 1) * width + b] : 0);
+            bytes[i * width + b] = in[b * n + i] ^ r;
+        }
+    }
+
+    return in + n * width;
+}
+
+#pragma endregion
+#pragma region SnapshotWriter
+
+SnapshotWriter::SnapshotWriter(const std::string &filename)
+    : filename(filename), outstream(filename, std::ios::binary)
+{
+    if (!outstream) {
+        LOG_ERROR("Could not open snapshot file " << filename << " for writing.");
+        exit(1);
+    }
+
+    outstream.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    n_bytes = sizeof(SNAPSHOT_MAGIC);
+}
+
+void SnapshotWriter::write(Snapshot snapshot) {
+    // Deltas only make sense against a frame with the same particles in it
+    bool key = first_frame || frames_since_key + 1 >= SNAPSHOT_KEYFRAME_INTERVAL
+               || snapshot.size() != previous.size();
+    const Snapshot* ref = key ? nullptr : &previous;
+
+    std::vector<uint8_t> raw;
+    raw.reserve(snapshot.size() * BYTES_PER_PARTICLE);
+    encode_column(snapshot.id, ref ? &ref->id : nullptr, raw);
+    encode_column(snapshot.type, ref ? &ref->type : nullptr, raw);
+    for (int c = 0; c < SNAPSHOT_N_COLUMNS; c++)
+        encode_column(snapshot.columns[c], ref ? &ref->columns[c] : nullptr, raw);
+
+    std::vector<uint8_t> payload = compress_zero_runs(raw);
+
+    FrameHeader header = {
+        key ? KeyFrame : DeltaFrame,
+        (uint32_t)snapshot.step,
+        (uint64_t)snapshot.size(),
+        snapshot.time,
+        payload.size()
+    };
+    outstream.write((const char*)&header, sizeof(header));
+    outstream.write((const char*)payload.data(), payload.size());
+    outstream.flush();
+
+    if (!outstream) {
+        LOG_ERROR("Failed to write to snapshot file " << filename << ".");
+        exit(1);
+    }
+
+    n_bytes += sizeof(header) + payload.size();
+    frames_since_key = key ? 0 : frames_since_key + 1;
+    first_frame = false;
+    previous = std::move(snapshot);
+}
+
+#pragma endregion
+#pragma region SnapshotReader
+
+SnapshotReader::SnapshotReader(const std::string &filename)
+    : filename(filename), instream(filename, std::ios::binary)
+{
+    if (!instream) {
+        LOG_ERROR("Could not open snapshot file " << filename << " for reading.");
+        exit(1);
+    }
+
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    instream.read(magic, sizeof(magic));
+
+    if (!instream || std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+        LOG_ERROR(filename << " is not a snapshot file, or was written by a "
+                  << "different version of the program.");
+        exit(1);
+    }
+}
+
+bool SnapshotReader::read(Snapshot &snapshot) {
+    FrameHeader header;
+    instream.read((char*)&header, sizeof(header));
+
+    if (instream.gcount() == 0)
+        return false;
+
+    bool key = header.type == KeyFrame;
+    bool valid = instream.gcount() == sizeof(header)
+                 && (key || header.type == DeltaFrame)
+                 && (key || header.n_part == (uint64_t)previous.size());
+
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> raw;
+
+    if (valid) {
+        payload.resize(header.payload_size);
+        instream.read((char*)payload.data(), payload.size());
+        raw.resize(header.n_part * BYTES_PER_PARTICLE);
+        valid = instream.gcount() == (std::streamsize)payload.size()
+                && decompress_zero_runs(payload.data(), payload.size(), raw);
+    }
+
+    if (!valid) {
+        LOG_ERROR("Snapshot file " << filename << " is corrupt or was cut short.");
+        exit(1);
+    }
+
+    int n = header.n_part;
+    const Snapshot* ref = key ? nullptr : &previous;
+
+    snapshot.step = header.step;
+    snapshot.time = header.time;
+    snapshot.id.resize(n);
+    snapshot.type.resize(n);
+    for (auto &column : snapshot.columns)
+        column.resize(n);
+
+    const uint8_t* in = raw.data();
+    in = decode_column(in, ref ? &ref->id : nullptr, snapshot.id);
+    in = decode_column(in, ref ? &ref->type : nullptr, snapshot.type);
+    for (int c = 0; c < SNAPSHOT_N_COLUMNS; c++)
+        in = decode_column(in, ref ? &ref->columns[c] : nullptr, snapshot.columns[c]);
+
+    previous = snapshot;
+    return true;
+}
+
+#pragma endregion
@@ -0,0 +1,115 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * snapshot_codec.hpp defines a compressed binary alternative to the text dump files, used when
+ * dump_format is 1 in config.txt. Every dump is appended as a frame to one file,
+ * {output_dir}/snapshots.sph, which decode_snapshots.py turns back into the usual text dumps.
+ *
+ * Consecutive dumps are mostly the same, so most frames are stored as the difference from the frame
+ * before (a delta frame), with a full keyframe every SNAPSHOT_KEYFRAME_INTERVAL frames, or whenever
+ * the number of particles changes. Each property is stored as a column, encoded as follows:
+ *
+ *  1. Each value is XORed with the same particle's value in the previous frame (delta frames), or
+ *     with the previous particle's value in the same frame (keyframes). Values that have hardly
+ *     changed share their sign, exponent and top mantissa bits, which become zero bytes.
+ *  2. The bytes are shuffled, so that the first bytes of every value come first, then the second
+ *     bytes, and so on. The zero bytes from 1. end up in long runs.
+ *  3. All of the columns of a frame are compressed together by replacing runs of zero bytes with
+ *     their length (see compress_zero_runs).
+ *
+ * All of the steps are reversible, so the values are decoded exactly as they were written.
+ *
+ * File format: SNAPSHOT_MAGIC, then for each frame a FrameHeader followed by payload_size bytes of
+ * compressed columns, in the order id (int32), type (uint8), then h, density, pressure, acc, vel,
+ * pos and u (double), all in native byte order.
+ */
+
+#ifndef snapshot_codec_hpp
+#define snapshot_codec_hpp
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "basictypes.hpp"
+
+// First bytes of a snapshot file. The last character is the format version.
+const char SNAPSHOT_MAGIC[8] = { 'S', 'P', 'H', '-', 'S', 'N', 'P', '1' };
+
+enum FrameType : uint32_t {
+    KeyFrame,
+    DeltaFrame
+};
+
+struct FrameHeader {
+    uint32_t type;
+    uint32_t step; // Timestep the frame was written at, which the text dumps are named after
+    uint64_t n_part;
+    double time;
+    uint64_t payload_size; // Size of the compressed columns following the header
+};
+
+// Number of double columns, i.e. everything in the text dumps other than the ID and type
+const int SNAPSHOT_N_COLUMNS = 7;
+
+// Every particle at one time, as columns in the same order as the text dumps
+struct Snapshot {
+    int step = 0;
+    double time = 0;
+    std::vector<int32_t> id;
+    std::vector<uint8_t> type;
+    std::vector<double> columns[SNAPSHOT_N_COLUMNS]; // h, density, pressure, acc, vel, pos, u
+
+    Snapshot() {}
+    Snapshot(const std::vector<Particle> &particles, int step, double time);
+
+    int size() const { return id.size(); }
+};
+
+// Lossless compression of runs of zero bytes. The output is a sequence of a tag byte (0 for
+// literal bytes, 1 for zeros) then a varint length, followed by the bytes themselves for literals.
+std::vector<uint8_t> compress_zero_runs(const std::vector<uint8_t> &data);
+
+// Reverse of compress_zero_runs. Returns false if the input is malformed or doesn't decompress to
+// exactly out.size() bytes.
+bool decompress_zero_runs(const uint8_t* data, size_t size, std::vector<uint8_t> &out);
+
+class SnapshotWriter {
+    public:
+        // ctor. Creates (or replaces) the file and writes the magic. Exits the program if the file
+        // can't be opened.
+        explicit SnapshotWriter(const std::string &filename);
+
+        // Append a frame. Not thread-safe; frames have to be written one at a time, in order. Takes
+        // the snapshot by value, as it is kept to work out the deltas of the next frame.
+        void write(Snapshot snapshot);
+
+        // Total size of the file so far
+        uint64_t bytes_written() const { return n_bytes; }
+
+    private:
+        std::string filename;
+        std::ofstream outstream;
+        Snapshot previous;
+        int frames_since_key = 0;
+        bool first_frame = true;
+        uint64_t n_bytes = 0;
+};
+
+class SnapshotReader {
+    public:
+        // ctor. Exits the program if the file can't be opened or isn't a snapshot file.
+        explicit SnapshotReader(const std::string &filename);
+
+        // Read the next frame into snapshot. Returns false at the end of the file. Exits the
+        // program if the file is corrupt.
+        bool read(Snapshot &snapshot);
+
+    private:
+        std::string filename;
+        std::ifstream instream;
+        Snapshot previous;
+};
+
+#endif
@@ -4,33 +4,143 @@
  * sph.cpp implements the functions defined and explained in sph.hpp.
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <iostream>
 #include <filesystem> // Support for this is a bit questionable, but should work with recent g++
 #include <system_error>
 
 #include "sph_simulation.hpp"
+#include "dump_writer.hpp"
 #include "ghost_particles.hpp"
+#include "smoothing_length.hpp"
+#include "particle_array.hpp"
+#include "validation.hpp"
+#include "trace.hpp"
+#include "log.hpp"
+
+SPHSimulation::SPHSimulation(Config c, ParticleArrayPtr p_arr, Executor* shared_executor)
+    : config(c), p_arr(p_arr),
+      #ifdef USE_MPI
+      decomp(c),
+      #endif
+      dc(c, p_arr, nlist), fc(c, p_arr, nlist),
+      own_executor(shared_executor ? nullptr : new Executor(c.n_threads, (ThreadPinning)c.pin_threads)),
+      executor(shared_executor ? *shared_executor : *own_executor),
+      analysis(c, c.analysis_bins),
+      profiler(c.profile != 0),
+      refiner(c, p_arr.get(), c.n_part),
+      timestep(c.t_i)
+{
+    // Densities are calculated in parallel during the timestep, see DensityCalculator
+    dc.set_rebuild_lists(false);
+
+    // The particles we were given were allocated before we had any workers, so move them into an
+    // array allocated the way the config asks for, as every array will be from now on
+    bool pinned = config.pin_threads != NoPinning;
+    set_particle_allocation((HugePages)config.huge_pages, pinned ? &executor : nullptr);
+
+    if (config.huge_pages != NoHugePages || pinned) {
+        ParticleArrayPtr placed = allocate_particles(config.n_alloc);
+        std::copy(p_arr.get(), p_arr.get() + config.n_part, placed.get());
+        this->p_arr = placed;
+    }
+
+    #ifdef USE_MPI
+    // Every rank has set up the whole domain; only keep our own slab of it
+    decomp.distribute(this->p_arr, config);
+    #endif
+    dc.update(config, this->p_arr);
+    fc.update(config, this->p_arr);
+
+    nlist.build(this->p_arr, config);
+
+    // Everything should have been set up by now
+    VALIDATE_PARTICLES(this->p_arr.get(), 0, config.n_part, ValidateAll, "setup", 0);
+}
+
+SPHSimulation::~SPHSimulation() {
+    // The background writes refer to our TaskGroup, so can't be left running
+    try {
+        executor.wait(writes);
+    } catch (const std::exception &e) {
+        LOG_ERROR("Failed to write dump file: " << e.what());
+    }
+
+    // Our workers are about to go
+    if (own_executor && config.pin_threads != NoPinning)
+        set_particle_allocation((HugePages)config.huge_pages, nullptr);
+}
+
+void SPHSimulation::make_output_dir(const std::string &dir) {
+    if (std::filesystem::exists(dir))
+        return;
+
+    std::error_code dir_ec;
+    std::filesystem::create_directories(dir, dir_ec);
+    
+    if (dir_ec.value() != 0) {
+        LOG_ERROR("Failed to make directory " << dir << " to store dump files.");
+        LOG_ERROR("Error code " << dir_ec.value() << " with message " 
+                  << dir_ec.message());
+        LOG_ERROR("Hint: you can probably get around this by just making the directory "
+                  << dir << " manually...");
+        exit(1);
+    }
+}
+
+bool SPHSimulation::is_root() const {
+    #ifdef USE_MPI
+    return decomp.get_rank() == 0;
+    #else
+    return true;
+    #endif
+}
 
 void SPHSimulation::start(double end_time) {
-    std::cout << "[INFO] Simulation time: " << current_time << " / " << end_time << std::endl;
-
-    if (!std::filesystem::exists("dumps")) {
-        std::error_code dir_ec;
-        std::filesystem::create_directory("dumps", dir_ec);
-        
-        if (dir_ec.value() != 0) {
-            std::cerr << "[ERROR] Failed to make directory ./dumps/ to store dump files." << std::endl;
-            std::cerr << "[ERROR] Error code " << dir_ec.value() << " with message " 
-                      << dir_ec.message()  << std::endl;
-            std::cerr << "[HINT] You can probably get around this by just making the directory ./dumps"
-                      << "manually..." << std::endl;
-            exit(1);
-        }
+    if (is_root() && show_progress)
+        LOG_INFO("Simulation time: " << current_time << " / " << end_time);
+
+    if (is_root() && write_output)
+        make_output_dir(output_dir);
+
+    // Every rank records its own timeline
+    bool tracing = config.trace != 0;
+    if (tracing) {
+        make_output_dir(output_dir);
+        #ifdef USE_MPI
+        int rank = decomp.get_rank();
+        tracing = Tracer::get().open(output_dir + "/trace_rank" + std::to_string(rank) + ".json", rank);
+        #else
+        tracing = Tracer::get().open(output_dir + "/trace.json", 0);
+        #endif
     }
 
+    if (is_root() && write_output && config.dump_format == CompressedDump)
+        snapshot_writer = std::make_unique<SnapshotWriter>(output_dir + "/snapshots.sph");
+
+    bool analysing = write_output && config.analysis_interval > 0;
+    if (is_root() && analysing)
+        analysis.open(output_dir);
+
     // Initial densities/acceleration/pressure etc was handled in setup.cpp
-    file_write();
+    if (write_output)
+        file_write();
+    if (analysing)
+        analyse();
+
+    bool live = !live_stream_name.empty();
+    if (live)
+        publish_live();
+
+    // The metrics include the time spent in each phase, so they need the profiler, if only to time
+    bool serving_metrics = !metrics_socket.empty();
+    if (serving_metrics) {
+        profiler.enable_timing();
+        if (is_root())
+            metrics = std::make_unique<MetricsServer>(metrics_socket);
+        publish_metrics();
+    }
 
     // And so it begins. Note that `while(current_time < end_time)` produces
     
@@ -45,32 +155,171 @@ void SPHSimulation::start(double end_time) {
         current_time += timestep;
         // These print statements help to identify where the program has had an error, should one
         // occur.
-        std::cout << "[INFO] Simulation time: " << current_time << " / " << end_time << std::endl;
+        if (is_root() && show_progress)
+            LOG_INFO("Simulation time: " << current_time << " / " << end_time);
         step_forward();
-        file_write();
+
+        // Summarise any warnings that were repeated for lots of particles this step
+        Logger::get().flush_tallies();
+
+        // The final state is always written, even if it isn't on the interval
+        bool last_step = current_time >= (end_time - CALC_EPSILON);
+        bool dump_due = config.dump_interval > 0 && step_counter % config.dump_interval == 0;
+        if (write_output && (dump_due || last_step))
+            file_write();
+
+        if (analysing && step_counter % config.analysis_interval == 0)
+            analyse();
+
+        if (live && step_counter % config.live_interval == 0)
+            publish_live();
+
+        if (serving_metrics)
+            publish_metrics();
+
+        if (tracing && step_counter % config.trace_interval == 0)
+            Tracer::get().flush();
     }
     #endif
+
+    // The last dump may still be being written
+    executor.wait(writes);
+
+    if (tracing)
+        Tracer::get().close();
+
+    if (metrics)
+        metrics->set_finished();
+
+    // Only if it was asked for, rather than just enabled for the metrics
+    if (show_progress && config.profile) {
+        #ifdef USE_MPI
+        profiler.report("Profile of rank " + std::to_string(decomp.get_rank()), step_counter);
+        #else
+        profiler.report("Profile of " + output_dir, step_counter);
+        #endif
+    }
+
+    if (config.refine_interval > 0) {
+        int totals[3] = { refinement_totals.n_split, refinement_totals.n_merged,
+                          config.n_part - config.n_ghost - config.n_halo };
+        #ifdef USE_MPI
+        MPI_Allreduce(MPI_IN_PLACE, totals, 3, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+        #endif
+
+        if (is_root() && show_progress) {
+            LOG_INFO("Refinement split " << totals[0] << " particles and merged " << totals[1]
+                     << " pairs, leaving " << totals[2] << " alive particles.");
+        }
+    }
+}
+
+void SPHSimulation::advance(int n) {
+    for (int i = 0; i < n; i++) {
+        current_time += timestep;
+        step_forward();
+        Logger::get().flush_tallies();
+    }
+}
+
+std::pair<int, int> SPHSimulation::chunk(int k, int n_alive) const {
+    int first = k * TASK_CHUNK_SIZE;
+    return std::make_pair(first, std::min(first + TASK_CHUNK_SIZE, n_alive));
+}
+
+void SPHSimulation::update_chunk_neighbours(int n_alive) {
+    // The chunks only depend on which particles are in which neighbour list, so there's no need to
+    // redo this unless the lists have been rebuilt
+    if (nlist.n_builds() == chunk_neighbours_build && n_alive == chunk_neighbours_n_alive)
+        return;
+
+    int n_chunks = (n_alive + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE;
+    chunk_neighbours.assign(n_chunks, {});
+    std::vector<int> last_seen(n_chunks, -1);
+
+    for (int k = 0; k < n_chunks; k++) {
+        auto [first, last] = chunk(k, n_alive);
+        for (int i = first; i < last; i++) {
+            for (int j : nlist.neighbours(i)) {
+                // Ghost and halo particles aren't updated during the timestep
+                if (j >= n_alive)
+                    continue;
+
+                int c = j / TASK_CHUNK_SIZE;
+                if (last_seen[c] != k) {
+                    last_seen[c] = k;
+                    chunk_neighbours[k].push_back(c);
+                }
+            }
+        }
+    }
+
+    chunk_neighbours_build = nlist.n_builds();
+    chunk_neighbours_n_alive = n_alive;
+}
+
+uint64_t SPHSimulation::neighbour_pairs(int first, int last) const {
+    uint64_t n = 0;
+    for (int i = first; i < last; i++)
+        n += nlist.neighbours(i).size();
+    return n;
 }
 
 void SPHSimulation::step_forward() {
     // Call into the integrator. For now it's a simple velocity verlet one because I remember
     // how to write that from the nbody assignment, and the GSL documentation scares me
-    
-    for (int i = 0; i < config.n_part; i++) {
-        Particle& p = p_arr[i];
 
-        // Don't evolve ghost particles
-        if (p.type == Ghost) 
-            continue;
+    // The alive particles are always at the start of the array (then the ghost, then the halo
+    // particles). They are split into chunks, and each stage of the integration is a task per chunk.
+    TraceSpan step_span("step_forward", "step", step_counter);
+
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+    int n_chunks = (n_alive + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE;
+
+    // Whether the densities are summed this step. If not, they are integrated at the drift instead,
+    // and there is no density sweep.
+    bool sum_due = density_sum_due(config, step_counter + 1);
+    #ifdef PREDICT_H
+    bool predict = true;
+    #else
+    bool predict = !sum_due;
+    #endif
 
-        // Half-step velocity
-        p.vel += p.acc * (timestep / 2);
-        // Thermal energy
-        p.u += p.du_dt * (timestep / 2);
+    graph.clear();
+    for (int k = 0; k < n_chunks; k++) {
+        graph.add([this, k, n_alive, sum_due, predict] {
+            PhaseProfiler::Scope scope(profiler, PhaseDrift);
+            TraceSpan span("Drift", "chunk", k);
+            auto [first, last] = chunk(k, n_alive);
+            scope.add_work(last - first);
 
-        // Position
-        p.pos += p.vel * (timestep);
+            for (int i = first; i < last; i++) {
+                Particle& p = p_arr[i];
+
+                // Half-step velocity
+                p.vel += p.acc * (timestep / 2);
+                // Thermal energy
+                p.u += p.du_dt * (timestep / 2);
+
+                // Position
+                p.pos += p.vel * (timestep);
+
+                if (predict) {
+                    // Starting point for the root-finding, which also decides when the neighbour
+                    // lists are rebuilt. The density is predicted along with it, so that the ghost
+                    // particles, which are copied before the densities are calculated, have a
+                    // matching pair. If the densities aren't summed this step, that's their value.
+                    double factor = predict_h_factor(p.density, p.drho_dt, timestep);
+                    p.density /= factor;
+                    p.h = sum_due ? p.h * factor : config.h_factor * p.mass / p.density;
+                }
+            }
+
+            VALIDATE_PARTICLES(p_arr.get(), first, last, ValidatePosition | ValidateVelocity | ValidateEnergy,
+                               "drift", step_counter);
+        });
     }
+    executor.run(graph);
 
     /*
     // Artefacts of me debugging ghost-particle-induced segmentation faults
@@ -78,63 +327,355 @@ void SPHSimulation::step_forward() {
     std::cout << "n_part pre-update: " << config.n_part << std::endl;
     */
 
-    // Now that we've moved the particles, reinitialize ghost particles
-    setup_ghost_particles(p_arr, config);
-    // Update calculators with new n_part and possibly array pointer
-    dc.update(config, p_arr);
-    ac.update(config, p_arr);
-    ec.update(config, p_arr);
+    {
+        // Now that we've moved the particles, reinitialize ghost particles
+        PhaseProfiler::Scope boundaries(profiler, PhaseBoundaries);
+        TraceSpan span("Boundaries");
+        boundaries.add_work(config.n_part);
+
+        #ifdef USE_MPI
+        // Hand over the particles that have left our slab first, then recreate the ghost and halo
+        // particles. Only the ranks at the edges of the domain have any ghost particles.
+        if (step_counter % MPI_REBALANCE_INTERVAL == 0)
+            decomp.rebalance(p_arr, config);
+        decomp.migrate(p_arr, config);
+        if (decomp.is_boundary_rank())
+            setup_ghost_particles(p_arr, config);
+        decomp.exchange_halos(p_arr, config);
+        #else
+        setup_ghost_particles(p_arr, config);
+        #endif
+        step_counter++;
+
+        // The new ghost and halo particles are copies, but the neighbour lists need their
+        // smoothing lengths, and the forces need their densities
+        VALIDATE_PARTICLES(p_arr.get(), 0, config.n_part,
+                           ValidatePosition | ValidateSmoothingLength | ValidateDensity | ValidateMass,
+                           "boundaries", step_counter);
+
+        // Neighbour lists only need rebuilding once particles have moved far enough
+        {
+            TraceSpan lists_span("Neighbour lists");
+            nlist.update(p_arr, config);
+        }
+        // Update calculators with new n_part and possibly array pointer
+        dc.update(config, p_arr);
+        fc.update(config, p_arr);
+    }
 
     /*
     std::cout << "p_arr post-update: " << p_arr << std::endl;
     std::cout << "n_part post-update: " << config.n_part << std::endl;
     */
 
-    // Perform the final half of the integration
-    for (int i = 0; i < config.n_part; i++) {
-        Particle& p = p_arr[i];
-        if (p.type == Ghost) 
-            continue;
+    // Perform the final half of the integration. Rather than waiting for every density before
+    // calculating any acceleration, the tasks of a chunk only wait for the chunks that its
+    // particles' neighbours are in:
+    //  - density: independent, only needs positions (and skipped if the densities were integrated)
+    //  - force (acceleration and energy): needs the densities of the neighbours
+    //  - kick: changes velocities and energies, which the forces of the neighbours use
+    n_alive = config.n_part - config.n_ghost - config.n_halo;
+    n_chunks = (n_alive + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE;
+    update_chunk_neighbours(n_alive);
+
+    graph.clear();
+    std::vector<TaskGraph::TaskId> density(n_chunks), force(n_chunks);
+
+    for (int k = 0; k < n_chunks && sum_due; k++) {
+        density[k] = graph.add([this, k, n_alive] {
+            PhaseProfiler::Scope scope(profiler, PhaseDensity);
+            TraceSpan span("Density", "chunk", k);
+            auto [first, last] = chunk(k, n_alive);
+            if (profiler.enabled())
+                scope.add_work(last - first, neighbour_pairs(first, last));
+
+            // The particles have moved, so the order of their neighbours may have changed too. The
+            // forces are calculated from the same lists, so this covers them as well.
+            if (config.deterministic)
+                nlist.sort_by_position(p_arr.get(), first, last);
+
+            {
+                TraceSpan rootfind_span("rootfind_h", "particles", last - first);
+                for (int i = first; i < last; i++) {
+                    // Recalculate density and smoothing length
+                    dc(p_arr[i]);
+                }
+            }
+
+            VALIDATE_PARTICLES(p_arr.get(), first, last,
+                               ValidateDensity | ValidateSmoothingLength | ValidateOmega,
+                               "density", step_counter);
+        });
+    }
+
+    #ifdef USE_MPI
+    // Halo particles need the densities that their owners have just calculated, which needs every
+    // rank to have finished its densities anyway. Integrated densities were already up to date
+    // when the halos were exchanged.
+    if (sum_due) {
+        executor.run(graph);
+        decomp.refresh_halos(p_arr, config);
+        graph.clear();
+    }
+    #endif
+
+    for (int k = 0; k < n_chunks; k++) {
+        std::vector<TaskGraph::TaskId> deps;
+        #ifndef USE_MPI
+        if (sum_due) {
+            for (int c : chunk_neighbours[k])
+                deps.push_back(density[c]);
+        }
+        #endif
+
+        force[k] = graph.add([this, k, n_alive, sum_due] {
+            PhaseProfiler::Scope scope(profiler, PhaseForce);
+            TraceSpan span("Force", "chunk", k);
+            auto [first, last] = chunk(k, n_alive);
+            if (profiler.enabled())
+                scope.add_work(last - first, neighbour_pairs(first, last));
+
+            // Sorted by the density tasks, when there are any
+            if (config.deterministic && !sum_due)
+                nlist.sort_by_position(p_arr.get(), first, last);
+
+            for (int i = first; i < last; i++) {
+                // Density-dependent quantities
+                fc(p_arr[i]);
+            }
+
+            VALIDATE_PARTICLES(p_arr.get(), first, last,
+                               ValidateAcceleration | ValidateEnergyRate | ValidatePressure,
+                               "force", step_counter);
+        }, deps);
+    }
+
+    for (int k = 0; k < n_chunks; k++) {
+        std::vector<TaskGraph::TaskId> deps;
+        for (int c : chunk_neighbours[k])
+            deps.push_back(force[c]);
+
+        graph.add([this, k, n_alive] {
+            PhaseProfiler::Scope scope(profiler, PhaseKick);
+            TraceSpan span("Kick", "chunk", k);
+            auto [first, last] = chunk(k, n_alive);
+            scope.add_work(last - first);
+
+            for (int i = first; i < last; i++) {
+                Particle& p = p_arr[i];
+
+                // Remaining half-step velocity
+                p.vel += p.acc * (timestep / 2);
+                p.u += p.du_dt * (timestep / 2);
+            }
+
+            VALIDATE_PARTICLES(p_arr.get(), first, last, ValidateVelocity | ValidateEnergy, "kick",
+                               step_counter);
+        }, deps);
+    }
+
+    executor.run(graph);
+
+    if (config.refine_interval > 0 && step_counter % config.refine_interval == 0)
+        refine();
+}
+
+void SPHSimulation::refine() {
+    RefinementCounts counts = refiner.refine(p_arr, config, nlist, executor);
+    refinement_totals.n_split += counts.n_split;
+    refinement_totals.n_merged += counts.n_merged;
+
+    bool refined = counts.n_split > 0 || counts.n_merged > 0;
+    if (refined) {
+        LOG_DEBUG("Split " << counts.n_split << " particles and merged " << counts.n_merged
+                  << " pairs, leaving " << config.n_part << " alive particles.");
+    }
+
+    #ifdef USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE, &counts.max_level, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    #endif
+
+    // The finest particles need the shortest timestep
+    double level_timestep = std::ldexp(config.t_i, -counts.max_level);
+    if (level_timestep != timestep) {
+        LOG_DEBUG("Timestep is now " << level_timestep << " for particles of level "
+                  << counts.max_level << ".");
+        timestep = level_timestep;
+    }
+
+    #ifdef USE_MPI
+    // The halo particles from the other ranks may have changed even if ours haven't, and exchanging
+    // them is collective, so every rank carries on if any of them refined
+    int any_refined = refined;
+    MPI_Allreduce(MPI_IN_PLACE, &any_refined, 1, MPI_INT, MPI_LOR, MPI_COMM_WORLD);
+    if (!any_refined)
+        return;
+
+    if (!refined) {
+        // Our alive particles stay as they are, but the ghost and halo particles are set up again
+        config.n_part -= config.n_ghost + config.n_halo;
+        config.n_ghost = 0;
+        config.n_halo = 0;
+    }
+
+    if (decomp.is_boundary_rank())
+        setup_ghost_particles(p_arr, config);
+    decomp.exchange_halos(p_arr, config);
+    #else
+    if (!refined)
+        return;
 
-        // Recalculate density and density-dependent quantities
-        dc(p);
-        ac(p);
-        ec(p);
+    setup_ghost_particles(p_arr, config);
+    #endif
+
+    nlist.build(p_arr, config);
+    dc.update(config, p_arr);
+    fc.update(config, p_arr);
+
+    // The new particles only have estimates of their smoothing lengths and densities, which
+    // everything else depends on, so calculate them all again. The velocities and energies are
+    // already up to date, so this is the second half of a timestep without the kick.
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+    int n_chunks = (n_alive + TASK_CHUNK_SIZE - 1) / TASK_CHUNK_SIZE;
 
-        // Remaining half-step velocity
-        p.vel += p.acc * (timestep / 2);
-        p.u += p.du_dt * (timestep / 2);
+    // If an estimate was too far off, its smoothing length will have been capped at the largest the
+    // lists cover, so in that case rebuild them and solve again
+    do {
+        graph.clear();
+        for (int k = 0; k < n_chunks; k++) {
+            graph.add([this, k, n_alive] {
+                auto [first, last] = chunk(k, n_alive);
+                if (config.deterministic)
+                    nlist.sort_by_position(p_arr.get(), first, last);
+                for (int i = first; i < last; i++)
+                    dc(p_arr[i]);
+            });
+        }
+        executor.run(graph);
+    } while (nlist.update(p_arr, config));
+
+    #ifdef USE_MPI
+    decomp.refresh_halos(p_arr, config);
+    #endif
+
+    graph.clear();
+    for (int k = 0; k < n_chunks; k++) {
+        graph.add([this, k, n_alive] {
+            auto [first, last] = chunk(k, n_alive);
+            for (int i = first; i < last; i++)
+                fc(p_arr[i]);
+        });
     }
+    executor.run(graph);
+
+    VALIDATE_PARTICLES(p_arr.get(), 0, config.n_part, ValidateAll, "refinement", step_counter);
 }
 
 void SPHSimulation::file_write() {
+    TraceSpan span("file_write", "step", step_counter);
+
+    #ifdef USE_MPI
+    // Collect everyone's particles on the root process, which writes them all to one file
+    ParticleArrayPtr out_arr;
+    int n_out = decomp.gather(p_arr, config, out_arr);
+
+    if (!is_root())
+        return;
+    #else
+    ParticleArrayPtr out_arr = p_arr;
+    int n_out = config.n_part;
+    #endif
+
     // Directory should hopefully have been made in start()
-    outstream.open("./dumps/" + std::to_string(dump_counter) + ".txt");
-
-    // File header
-    outstream << "# This file was dumped at t = " << current_time << std::endl;
-    outstream << "# Column definitions:" << std::endl;
-    outstream << "# Particle ID / Type / Smoothing length / Density / Pressure / Acceleration / Velocity / Position / Thermal energy" << std::endl;
-    outstream << "# Aligned definition 'tags' for easier reading:" << std::endl;
-    outstream << "# ID    TYPE     H          DENSITY  PRESS    ACCEL     VEL       POS       U" << std::endl;
-
-    // Particle information
-    for (int i = 0; i < config.n_part; i++) {
-        Particle& p = p_arr[i];
-        // Bit of C-style code here...
-        // I want to format the strings so the floats use the same d.p. and it all lines up nicely.
-        // But for some reason, no major compiler has an implementation of std::format from C++20
-        // yet, and I didn't feel like adding an external dependency e.g.
-        // https://github.com/fmtlib/fmt
-        
-        char buffer[256];
-        sprintf(buffer, 
-                "%4d    %s    %3.5f    %3.3f    %3.3f    %+3.3f    %+3.3f    %+3.3f    %3.3f\n", 
-                p.id, ParticleTypeNames[p.type], p.h, p.density, p.pressure, p.acc, p.vel, p.pos, p.u);
-        outstream << buffer;
-    }
-
-    outstream.close();
-
-    dump_counter++;
-}
\ No newline at end of file
+    std::string filename = output_dir + "/" + std::to_string(step_counter) + ".txt";
+    double time = current_time;
+    int step = step_counter;
+
+    if (config.dump_format == CompressedDump) {
+        // Take a copy of the particles, so that the simulation can carry on while the copy is
+        // compressed and written to the file in the background
+        std::vector<Particle> snapshot(out_arr.get(), out_arr.get() + n_out);
+
+        // Only write one file at a time, so they are finished in order
+        executor.wait(writes);
+
+        // Appended to the snapshot stream rather than written to its own file
+        SnapshotWriter* writer = snapshot_writer.get();
+        executor.submit([snapshot = std::move(snapshot), writer, step, time] {
+            TraceSpan span("Write snapshot", "step", step);
+            writer->write(Snapshot(snapshot, step, time));
+        }, writes);
+    } else {
+        // Formatted now, in parallel on all of the workers, rather than copied and formatted in the
+        // background, which would take one worker for longer than the timesteps between dumps.
+        // Only writing the file is left to the background.
+        std::string text = format_dump_header(time);
+        format_dump_lines(out_arr.get(), n_out, config.dump_format == FullPrecisionTextDump,
+                          executor, text);
+
+        executor.wait(writes);
+        executor.submit([text = std::move(text), filename, step] {
+            TraceSpan span("Write dump file", "step", step);
+            write_dump_file(filename, text);
+        }, writes);
+    }
+}
+
+void SPHSimulation::analyse() {
+    int n_alive = config.n_part - config.n_ghost - config.n_halo;
+    AnalysisResult result = analysis.reduce(p_arr.get(), n_alive, executor);
+
+    if (is_root())
+        analysis.write(result, current_time);
+}
+
+void SPHSimulation::publish_live() {
+    // Nothing is running on the particles between steps, so they can be published straight from
+    // the array
+    #ifdef USE_MPI
+    ParticleArrayPtr out_arr;
+    int n_out = decomp.gather(p_arr, config, out_arr);
+
+    if (!is_root())
+        return;
+
+    const Particle* particles = out_arr.get();
+    #else
+    int n_out = config.n_part;
+    const Particle* particles = p_arr.get();
+    #endif
+
+    // The number of alive particles only changes with refinement, which can at most double it
+    // refine_max_level times, so the first frame decides how much room there needs to be
+    if (!live_stream) {
+        int n_alive = std::count_if(particles, particles + n_out, [](const Particle &p) {
+            return p.type == Alive;
+        });
+        if (config.refine_interval > 0)
+            n_alive <<= config.refine_max_level;
+        live_stream = std::make_unique<LiveStream>(live_stream_name, n_alive);
+    }
+
+    live_stream->publish(particles, n_out, step_counter, current_time);
+}
+
+void SPHSimulation::publish_metrics() {
+    if (step_counter % METRICS_CONSERVATION_INTERVAL == 0) {
+        int n_alive = config.n_part - config.n_ghost - config.n_halo;
+        AnalysisResult result = analysis.reduce(p_arr.get(), n_alive, executor);
+
+        if (metrics) {
+            metrics->set_conserved(result.totals.kinetic_energy + result.totals.thermal_energy,
+                                   result.totals.momentum);
+        }
+    }
+
+    if (!metrics)
+        return;
+
+    metrics->set_progress(step_counter, current_time);
+    metrics->set_particles(config.n_part - config.n_ghost - config.n_halo, config.n_ghost,
+                           config.n_halo);
+    for (int phase = 0; phase < N_PROFILE_PHASES; phase++)
+        metrics->set_phase_seconds((ProfilePhase)phase, profiler.phase_totals((ProfilePhase)phase).seconds);
+}
@@ -11,43 +11,186 @@
 #define sph_simulation_hpp
 
 #include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "define.hpp"
+#include "analysis.hpp"
+#include "snapshot_codec.hpp"
+#include "live_stream.hpp"
+#include "metrics.hpp"
 #include "basictypes.hpp"
 #include "calculators.hpp"
+#include "neighbour_list.hpp"
+#include "domain_decomposition.hpp"
+#include "task_graph.hpp"
+#include "profiler.hpp"
+#include "refinement.hpp"
 
 class SPHSimulation {
     public:
-        // ctor
-        SPHSimulation(Config c, ParticleArrayPtr p_arr) 
-            : config(c), p_arr(p_arr), dc(c, p_arr), ac(c, p_arr), ec(c, p_arr), timestep(c.t_i)
-        {}
+        // ctor. When running with MPI, p_arr should contain the whole domain, as set up by
+        // init_particles, and only this rank's slab of it is kept. If shared_executor is given,
+        // the simulation runs its tasks on that rather than starting its own worker threads, so
+        // that several simulations can share them (see ensemble.hpp).
+        SPHSimulation(Config c, ParticleArrayPtr p_arr, Executor* shared_executor = nullptr);
+        // dtor. Waits for any dump files that are still being written.
+        ~SPHSimulation();
 
         // Start the simulation (and block the thread until current_time reaches end_time)
         void start(double end_time);
 
+        // Take n timesteps, without writing any output. For driving the simulation a few steps at a
+        // time from elsewhere, e.g. the Python bindings, rather than with start().
+        void advance(int n);
+
+        // Directory to write dump files into. Created by start() if it doesn't exist. Default is
+        // ./dumps
+        void set_output_dir(const std::string &dir) {
+            output_dir = dir;
+        }
+
+        // Whether to print the simulation time every step, and the profile at the end (if
+        // config.profile is set). Default is true.
+        void set_show_progress(bool show) {
+            show_progress = show;
+        }
+
+        // Whether to write dump files (and the analysis, if enabled) at all. Default is true; turned
+        // off by the benchmarks, which only want to time the steps.
+        void set_write_output(bool write) {
+            write_output = write;
+        }
+
+        // Publish the particles to the shared memory segment called name every config.live_interval
+        // steps, so that the run can be watched as it goes (see live_stream.hpp). Empty for none,
+        // which is the default.
+        void set_live_stream(const std::string &name) {
+            live_stream_name = name;
+        }
+
+        // Serve the progress of the run on the Unix domain socket at path, from start() until the
+        // run is over (see metrics.hpp). Empty for none, which is the default.
+        void set_metrics_socket(const std::string &path) {
+            metrics_socket = path;
+        }
+
+        // Number of timesteps taken so far
+        int steps_taken() const { return step_counter; }
+
+        double get_time() const { return current_time; }
+
+        // Config, with the current number of ghost particles etc.
+        const Config& get_config() const { return config; }
+
+        // The particle array: the alive particles, then the ghost (and halo) particles. It can be
+        // reallocated by any step, so shouldn't be held on to across steps other than to keep it
+        // from being freed.
+        ParticleArrayPtr get_particles() const { return p_arr; }
+
+        // Counters of each phase of the timestep, if config.profile is set
+        const PhaseProfiler& get_profiler() const { return profiler; }
+
+        // Make the directory for the dump files if it doesn't exist. Exits the program if it can't.
+        static void make_output_dir(const std::string &dir);
+
     private:
         Config config;
         
         ParticleArrayPtr p_arr;
 
+        #ifdef USE_MPI
+        SlabDecomposition decomp;
+        #endif
+
+        // Persistent neighbour lists, shared by the calculators. Must be declared before them.
+        NeighbourList nlist;
+
         DensityCalculator dc;
-        AccelerationCalculator ac;
-        EnergyCalculator ec;
+        ForceCalculator fc;
+
+        // Worker threads, and the graph of tasks that make up a timestep. own_executor is only
+        // used if no executor was given to the ctor, and must be declared before executor.
+        std::unique_ptr<Executor> own_executor;
+        Executor &executor;
+        TaskGraph graph;
+
+        // Dump files being written in the background
+        TaskGroup writes;
+
+        // Stream that the dumps are appended to instead, if config.dump_format is CompressedDump.
+        // Only made on the root process, by start().
+        std::unique_ptr<SnapshotWriter> snapshot_writer;
+
+        // Live stream of the particles, made by the first publish_live() on the root process
+        std::string live_stream_name;
+        std::unique_ptr<LiveStream> live_stream;
+
+        // Metrics endpoint, made by start() on the root process
+        std::string metrics_socket;
+        std::unique_ptr<MetricsServer> metrics;
+
+        // In-situ analysis, run every config.analysis_interval steps
+        Analysis analysis;
+
+        // Hardware counters for each phase of the timestep, if config.profile is set
+        PhaseProfiler profiler;
+
+        // Splits and merges particles every config.refine_interval steps
+        Refiner refiner;
+        RefinementCounts refinement_totals;
+
+        // For each chunk of alive particles, the chunks that contain its particles' neighbours.
+        // Only recalculated when the neighbour lists have been rebuilt.
+        std::vector<std::vector<int>> chunk_neighbours;
+        int chunk_neighbours_build = -1;
+        int chunk_neighbours_n_alive = -1;
         
         double current_time = 0;
         double timestep;
 
-        int dump_counter = 0;
-        std::ofstream outstream;
+        int step_counter = 0;
+
+        std::string output_dir = "dumps";
+        bool show_progress = true;
+        bool write_output = true;
+
+        // Only one process should print progress messages and write files
+        bool is_root() const;
 
         // Step the simulation forward
         void step_forward();
 
-        // Write particle information to a file: "./dumps/{dump_counter}.txt", and then increment
-        // dump_counter
+        // Split and merge the alive particles where the resolution needs to change, then set up the
+        // ghost and halo particles, and the densities and forces, for the new set of particles
+        void refine();
+
+        // Range of particle indices [first, last) in chunk k of the alive particles
+        std::pair<int, int> chunk(int k, int n_alive) const;
+
+        // Work out which chunks each chunk depends on, from the neighbour lists
+        void update_chunk_neighbours(int n_alive);
+
+        // Number of particle-neighbour pairs in the neighbour lists of particles [first, last)
+        uint64_t neighbour_pairs(int first, int last) const;
+
+        // Write particle information to a file: "{output_dir}/{step_counter}.txt", or append it to
+        // the snapshot stream. Text dumps are formatted in parallel first (see dump_writer.hpp), and
+        // the file is written in the background, while the simulation carries on.
         void file_write();
 
+        // Run the in-situ analysis on the alive particles, and append it to the analysis files
+        void analyse();
+
+        // Publish the alive particles as the next frame of the live stream
+        void publish_live();
+
+        // Update the values served by the metrics endpoint. The energy and momentum are summed every
+        // METRICS_CONSERVATION_INTERVAL steps, which with MPI every rank has to take part in.
+        void publish_metrics();
+
 };
 
 #endif
\ No newline at end of file
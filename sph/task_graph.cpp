@@ -0,0 +1,328 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * task_graph.cpp implements the TaskGraph and Executor classes from task_graph.hpp.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "task_graph.hpp"
+#include "log.hpp"
+#include "trace.hpp"
+
+#pragma region TaskGraph
+
+TaskGraph::TaskId TaskGraph::add(std::function<void()> fn, const std::vector<TaskId> &deps) {
+    TaskId id = tasks.size();
+    tasks.push_back(Task { fn, {}, (int)deps.size() });
+
+    for (TaskId dep : deps)
+        tasks[dep].successors.push_back(id);
+
+    return id;
+}
+
+void TaskGraph::clear() {
+    tasks.clear();
+}
+
+#pragma endregion
+#pragma region Pinning
+
+#ifdef __linux__
+// Parse a list of CPUs as in /sys, e.g. "0-3,8-11"
+static std::vector<int> parse_cpu_list(const std::string &list) {
+    std::vector<int> cpus;
+    size_t start = 0;
+
+    while (start < list.length()) {
+        size_t end = std::min(list.find(',', start), list.length());
+        std::string range = list.substr(start, end - start);
+        size_t dash = range.find('-');
+
+        try {
+            int first = std::stoi(range.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        } catch (const std::exception &e) {
+            // Trailing newline or an unexpected format; use what has been read so far
+        }
+
+        start = end + 1;
+    }
+
+    return cpus;
+}
+#endif
+
+// Cores for the workers to be pinned to, in order, or nothing if they can't be pinned
+static std::vector<int> pinning_order(ThreadPinning pinning) {
+    std::vector<int> cores;
+
+    #ifdef __linux__
+    if (pinning == NoPinning)
+        return cores;
+
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return cores;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed))
+            cores.push_back(cpu);
+    }
+
+    if (pinning == CompactPinning)
+        return cores;
+
+    // Spread: take the allowed cores of each NUMA node in turn
+    std::vector<std::vector<int>> nodes;
+    for (int node = 0; ; node++) {
+        std::ifstream cpulist("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!std::getline(cpulist, list))
+            break;
+
+        std::vector<int> node_cores;
+        for (int cpu : parse_cpu_list(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))
+                node_cores.push_back(cpu);
+        }
+        if (!node_cores.empty())
+            nodes.push_back(node_cores);
+    }
+
+    // Without NUMA information there is nothing to spread over
+    if (nodes.size() < 2)
+        return cores;
+
+    size_t longest = 0;
+    for (const std::vector<int> &node_cores : nodes)
+        longest = std::max(longest, node_cores.size());
+
+    std::vector<int> spread;
+    for (size_t k = 0; k < longest; k++) {
+        for (const std::vector<int> &node_cores : nodes) {
+            if (k < node_cores.size())
+                spread.push_back(node_cores[k]);
+        }
+    }
+    return spread;
+    #else
+    if (pinning != NoPinning)
+        LOG_WARN("Worker threads can only be pinned to cores on Linux; leaving them unpinned.");
+    return cores;
+    #endif
+}
+
+// Pin the calling thread to one core
+static void pin_thread(int core) {
+    #ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        LOG_WARN("Could not pin a worker thread to core " << core << "; it is left unpinned.");
+    #endif
+}
+
+#pragma endregion
+#pragma region Executor
+
+Executor::Executor(int n_threads, ThreadPinning pinning) {
+    if (n_threads <= 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<int> cores = pinning_order(pinning);
+    for (int w = 0; !cores.empty() && w < n_threads; w++)
+        worker_cores.push_back(cores[w % cores.size()]);
+
+    for (int w = 0; w < n_threads; w++)
+        queues.emplace_back(new WorkerQueue());
+
+    for (int w = 0; w < n_threads; w++)
+        threads.emplace_back(&Executor::worker_loop, this, w);
+}
+
+Executor::~Executor() {
+    {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done.wait(lock, [this] { return detached.n_running == 0; });
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread &t : threads)
+        t.join();
+}
+
+void Executor::run(TaskGraph &graph) {
+    int n = graph.size();
+    if (n == 0)
+        return;
+
+    graph.remaining.reset(new std::atomic<int>[n]);
+    for (int i = 0; i < n; i++)
+        graph.remaining[i] = graph.tasks[i].n_deps;
+    graph.pending = n;
+    graph.error = nullptr;
+
+    // Hand out the tasks without dependencies evenly between the workers, in contiguous blocks so
+    // that each worker gets the same part of a graph every time it is run
+    int n_roots = 0;
+    for (int i = 0; i < n; i++)
+        n_roots += graph.tasks[i].n_deps == 0;
+
+    int n_queues = queues.size();
+    int root = 0;
+    for (int i = 0; i < n; i++) {
+        if (graph.tasks[i].n_deps == 0)
+            push((int64_t)root++ * n_queues / n_roots, Job { &graph, i, nullptr, nullptr });
+    }
+
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait(lock, [&graph] { return graph.pending == 0; });
+
+    if (graph.error)
+        std::rethrow_exception(graph.error);
+}
+
+void Executor::submit(std::function<void()> fn, TaskGroup &group) {
+    {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        group.n_running++;
+    }
+
+    push(next_queue++ % queues.size(), Job { nullptr, 0, fn, &group });
+}
+
+void Executor::wait(TaskGroup &group) {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done.wait(lock, [&group] { return group.n_running == 0; });
+
+    if (group.error) {
+        std::exception_ptr e = group.error;
+        group.error = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void Executor::worker_loop(int w) {
+    Tracer::set_thread_name("Worker", w);
+
+    if (!worker_cores.empty())
+        pin_thread(worker_cores[w]);
+
+    Job job;
+
+    while (true) {
+        if (pop(w, job) || steal(w, job)) {
+            execute(w, job);
+            continue;
+        }
+
+        // Nothing to do anywhere; sleep until something is pushed. n_queued is incremented before
+        // the notification is sent, so checking it under the lock means no wake-ups are missed.
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this] { return stopping || n_queued > 0; });
+
+        if (stopping && n_queued == 0)
+            return;
+    }
+}
+
+void Executor::push(int w, Job job) {
+    {
+        std::lock_guard<std::mutex> lock(queues[w]->mutex);
+        queues[w]->jobs.push_back(std::move(job));
+    }
+
+    n_queued++;
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+    }
+    wake.notify_one();
+}
+
+bool Executor::pop(int w, Job &job) {
+    // Own queue is used as a stack: the most recently readied task is likely to share data with the
+    // task that has just finished
+    std::lock_guard<std::mutex> lock(queues[w]->mutex);
+    if (queues[w]->jobs.empty())
+        return false;
+
+    job = std::move(queues[w]->jobs.back());
+    queues[w]->jobs.pop_back();
+    n_queued--;
+    return true;
+}
+
+bool Executor::steal(int w, Job &job) {
+    int n = queues.size();
+
+    for (int k = 1; k < n; k++) {
+        WorkerQueue &victim = *queues[(w + k) % n];
+
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.jobs.empty())
+            continue;
+
+        job = std::move(victim.jobs.front());
+        victim.jobs.pop_front();
+        n_queued--;
+        return true;
+    }
+
+    return false;
+}
+
+void Executor::execute(int w, Job &job) {
+    TaskGraph* graph = job.graph;
+
+    try {
+        if (graph)
+            graph->tasks[job.task].fn();
+        else
+            job.fn();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        std::exception_ptr &error = graph ? graph->error : job.group->error;
+        if (!error)
+            error = std::current_exception();
+    }
+
+    if (!graph) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        job.group->n_running--;
+        done.notify_all();
+        return;
+    }
+
+    // Release the tasks that were waiting on this one. They still run if this task failed, so that
+    // the graph always finishes and run() can report the error.
+    for (TaskGraph::TaskId next : graph->tasks[job.task].successors) {
+        if (--graph->remaining[next] == 0)
+            push(w, Job { graph, next, nullptr, nullptr });
+    }
+
+    if (--graph->pending == 0) {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done.notify_all();
+    }
+}
+
+#pragma endregion
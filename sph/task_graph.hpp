@@ -0,0 +1,152 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * task_graph.hpp defines a small task-graph (DAG) scheduler. A TaskGraph is a set of tasks, each of
+ * which may only start once the tasks it depends on have finished, and an Executor runs the tasks of
+ * a graph on a pool of worker threads. This is used to split each timestep into chunks of particles,
+ * so that e.g. the forces of one chunk can be calculated as soon as the densities of that chunk and
+ * its neighbouring chunks are known, rather than waiting for every density to be done.
+ *
+ * Each worker thread keeps its own queue of ready tasks. Tasks that become ready when a worker
+ * finishes a task go to the back of that worker's queue (as they probably use the same data), and
+ * workers that run out of tasks 'steal' from the front of the other workers' queues.
+ *
+ * The tasks a graph starts with are handed out in contiguous blocks, so that when they are chunks of
+ * particles in order, each worker gets the same range of particles every timestep (apart from any
+ * that are stolen). With pin_threads set in config.txt, the workers are also pinned to their own
+ * cores, so that range stays in the caches of one core, and in the memory of its NUMA node (see
+ * allocate_particles, which has the workers first touch the pages of the ranges they will get).
+ */
+
+#ifndef task_graph_hpp
+#define task_graph_hpp
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum ThreadPinning {
+    NoPinning, // Left to the OS scheduler
+    CompactPinning, // Worker w on the w-th core this process may run on
+    SpreadPinning // Round-robin over the NUMA nodes, for the most memory bandwidth with few threads
+};
+
+class TaskGraph {
+    public:
+        typedef int TaskId;
+
+        // Add a task which will only run after the tasks in deps have finished. Dependencies must
+        // have been added to the graph already, so graphs can't contain cycles.
+        TaskId add(std::function<void()> fn, const std::vector<TaskId> &deps = {});
+
+        // Remove all tasks, so the graph can be reused for the next timestep
+        void clear();
+
+        int size() const { return tasks.size(); }
+
+    private:
+        friend class Executor;
+
+        struct Task {
+            std::function<void()> fn;
+            std::vector<TaskId> successors;
+            int n_deps;
+        };
+
+        std::vector<Task> tasks;
+
+        // State while the graph is being run: dependencies left for each task, and tasks left
+        // overall, and the first exception thrown by a task
+        std::unique_ptr<std::atomic<int>[]> remaining;
+        std::atomic<int> pending;
+        std::exception_ptr error;
+};
+
+// Set of tasks given to Executor::submit() that can be waited for together, e.g. the dump files of
+// one simulation when several simulations share an Executor
+class TaskGroup {
+    private:
+        friend class Executor;
+
+        int n_running = 0;
+        std::exception_ptr error;
+};
+
+class Executor {
+    public:
+        // ctor. Starts n_threads worker threads, or one per hardware thread if n_threads is 0, pinned
+        // to cores as given by pinning. Only the cores this process is allowed on are used (e.g. the
+        // ones mpirun bound it to), and if there are more workers than cores they wrap around.
+        explicit Executor(int n_threads = 0, ThreadPinning pinning = NoPinning);
+        // dtor. Waits for any detached tasks, then stops the workers.
+        ~Executor();
+
+        Executor(const Executor&) = delete;
+        Executor& operator =(const Executor&) = delete;
+
+        // Run every task in the graph, and block until they have all finished. If a task threw an
+        // exception, the first one is rethrown here once the graph is done. Several threads can run
+        // graphs on the same Executor at once, in which case their tasks share the workers.
+        void run(TaskGraph &graph);
+
+        // Run fn on a worker without blocking. Can run alongside graphs.
+        void submit(std::function<void()> fn, TaskGroup &group);
+        void submit(std::function<void()> fn) { submit(fn, detached); }
+
+        // Block until every task given to submit() with this group has finished. If one of them
+        // threw an exception, the first one is rethrown.
+        void wait(TaskGroup &group);
+        void wait_detached() { wait(detached); }
+
+        int n_threads() const { return threads.size(); }
+
+    private:
+        // Unit of work in the queues: either a task of a graph, or a detached function
+        struct Job {
+            TaskGraph* graph;
+            TaskGraph::TaskId task;
+            std::function<void()> fn;
+            TaskGroup* group;
+        };
+
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<Job> jobs;
+        };
+
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
+        std::vector<std::thread> threads;
+
+        // Number of jobs in all queues, and the means for idle workers to wait for more
+        std::atomic<int> n_queued{0};
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+
+        // Used to wait for graphs and detached tasks to finish
+        std::mutex done_mutex;
+        std::condition_variable done;
+
+        // Group for detached tasks submitted without one
+        TaskGroup detached;
+
+        // Round-robin counter for handing out jobs from outside of the workers
+        std::atomic<unsigned> next_queue{0};
+
+        // Core each worker is pinned to (empty if they aren't)
+        std::vector<int> worker_cores;
+
+        void worker_loop(int w);
+        void push(int w, Job job);
+        bool pop(int w, Job &job);
+        bool steal(int w, Job &job);
+        void execute(int w, Job &job);
+};
+
+#endif
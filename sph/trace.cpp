@@ -0,0 +1,187 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * trace.cpp implements the Tracer from trace.hpp.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include "trace.hpp"
+#include "log.hpp"
+
+// Name given to the calling thread with set_thread_name, if any
+static thread_local const char* thread_name = nullptr;
+static thread_local int thread_name_index = -1;
+
+Tracer& Tracer::get() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::~Tracer() {
+    close();
+
+    for (ThreadBuffer &t : threads) {
+        Block* block = t.head;
+        while (block) {
+            Block* next = block->next.load();
+            delete block;
+            block = next;
+        }
+    }
+}
+
+void Tracer::set_thread_name(const char* name, int index) {
+    thread_name = name;
+    thread_name_index = index;
+}
+
+bool Tracer::open(const std::string &filename, int pid) {
+    std::lock_guard<std::mutex> lock(file_mutex);
+
+    file = std::fopen(filename.c_str(), "w");
+    if (!file) {
+        LOG_ERROR("Failed to open trace file " << filename << ": " << std::strerror(errno));
+        return false;
+    }
+
+    // The array form of the trace-event format, which can be appended to as we go
+    std::fputs("[\n", file);
+    first_event = true;
+
+    // Threads from an earlier trace need naming again in this file
+    {
+        std::lock_guard<std::mutex> threads_lock(threads_mutex);
+        for (ThreadBuffer &t : threads)
+            t.named = false;
+    }
+
+    this->pid = pid;
+    main_thread = std::this_thread::get_id();
+    epoch = std::chrono::steady_clock::now();
+    is_enabled = true;
+    return true;
+}
+
+Tracer::ThreadBuffer& Tracer::thread_buffer() {
+    // Only one tracer, so unlike the PhaseProfiler there's no need to check whose entry this is
+    thread_local ThreadBuffer* cached = nullptr;
+    if (cached)
+        return *cached;
+
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    threads.emplace_back();
+    cached = &threads.back();
+    cached->tid = threads.size() - 1;
+    cached->head = cached->tail = new Block;
+
+    if (std::this_thread::get_id() == main_thread)
+        cached->name = "Main";
+    else if (thread_name)
+        cached->name = thread_name_index >= 0 ? std::string(thread_name) + " " + std::to_string(thread_name_index)
+                                              : thread_name;
+    else
+        cached->name = "Thread " + std::to_string(cached->tid);
+
+    return *cached;
+}
+
+void Tracer::record(const char* name, uint64_t begin, uint64_t end, const char* arg_name, int64_t arg) {
+    ThreadBuffer &t = thread_buffer();
+
+    Block* block = t.tail;
+    int n = block->count.load(std::memory_order_relaxed);
+    if (n == TRACE_BLOCK_EVENTS) {
+        // flush() frees the full blocks once it has written them, but never the last one
+        Block* next = new Block;
+        block->next.store(next, std::memory_order_release);
+        t.tail = block = next;
+        n = 0;
+    }
+
+    block->events[n] = Event { name, arg_name, arg, begin, end };
+    // Publishes the event to flush()
+    block->count.store(n + 1, std::memory_order_release);
+}
+
+void Tracer::write_event(const char* json) {
+    std::fputs(first_event ? "" : ",\n", file);
+    std::fputs(json, file);
+    first_event = false;
+}
+
+void Tracer::flush() {
+    std::lock_guard<std::mutex> file_lock(file_mutex);
+    if (!file)
+        return;
+
+    // Threads that start recording during the flush are picked up by the next one. The deque can
+    // grow while we go through it, but the entries themselves don't move.
+    std::vector<ThreadBuffer*> buffers;
+    {
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        for (ThreadBuffer &t : threads)
+            buffers.push_back(&t);
+    }
+
+    char json[TRACE_EVENT_MAX];
+    for (ThreadBuffer* buffer : buffers) {
+        ThreadBuffer &t = *buffer;
+
+        // Metadata events can go anywhere in the file
+        if (!t.named) {
+            std::snprintf(json, sizeof(json),
+                          "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                          "\"args\": {\"name\": \"%s\"}}", pid, t.tid, t.name.c_str());
+            write_event(json);
+            t.named = true;
+        }
+
+        while (true) {
+            Block* block = t.head;
+            int n = block->count.load(std::memory_order_acquire);
+
+            for (int e = t.n_written; e < n; e++) {
+                const Event &event = block->events[e];
+                // Complete ("X") events, with the times in microseconds
+                int length = std::snprintf(json, sizeof(json),
+                    "{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                    event.name, pid, t.tid, event.begin / 1e3, (event.end - event.begin) / 1e3);
+                if (event.arg_name) {
+                    std::snprintf(json + length, sizeof(json) - length, ", \"args\": {\"%s\": %lld}}",
+                                  event.arg_name, (long long)event.arg);
+                } else {
+                    std::snprintf(json + length, sizeof(json) - length, "}");
+                }
+                write_event(json);
+            }
+            t.n_written = n;
+
+            // The thread has moved on from a full block once it has linked the next one
+            Block* next = block->next.load(std::memory_order_acquire);
+            if (n < TRACE_BLOCK_EVENTS || !next)
+                break;
+
+            delete block;
+            t.head = next;
+            t.n_written = 0;
+        }
+    }
+
+    std::fflush(file);
+}
+
+void Tracer::close() {
+    if (!enabled())
+        return;
+
+    flush();
+    is_enabled = false;
+
+    std::lock_guard<std::mutex> lock(file_mutex);
+    std::fputs("\n]\n", file);
+    std::fclose(file);
+    file = nullptr;
+}
@@ -0,0 +1,146 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * trace.hpp defines the Tracer, which is used when trace is set in config.txt to record a timeline
+ * of what every thread was doing and when. The PhaseProfiler only gives totals, which hide a worker
+ * that was left waiting at the end of a phase, or one chunk that took ten times longer than the
+ * rest; the timeline shows each of them. Each phase of the timestep (per chunk of particles), the
+ * ghost particles, the smoothing length root-finding and the dump files are recorded as spans, and
+ * written as a Chrome trace-event JSON file, dumps/trace.json (trace_rank{n}.json for each rank with
+ * MPI), which can be opened in https://ui.perfetto.dev or chrome://tracing.
+ *
+ * Each thread records its spans into its own buffer, without locks: the buffer is a list of blocks,
+ * and a span is published by storing the new count of its block. The file is written every
+ * trace_interval steps by reading whatever has been published since the last time, so the buffers
+ * don't grow for the whole run, and the file can be opened even if the run doesn't finish (the
+ * trace-event format doesn't need the closing bracket).
+ */
+
+#ifndef trace_hpp
+#define trace_hpp
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "define.hpp"
+
+class Tracer {
+    public:
+        // The tracer for the whole program. Does nothing until open() is called.
+        static Tracer& get();
+
+        bool enabled() const {
+            return is_enabled.load(std::memory_order_relaxed);
+        }
+
+        // Start recording, to be written to filename as process pid (the MPI rank). The calling
+        // thread is shown as the main thread. Returns false (after logging an error) if the file
+        // can't be made.
+        bool open(const std::string &filename, int pid);
+
+        // Write every span recorded since the last flush. Spans that are still open (e.g. a dump
+        // file still being written in the background) are written once they end.
+        void flush();
+
+        // Stop recording, and write the rest of the spans and the end of the file
+        void close();
+
+        // Nanoseconds since open()
+        uint64_t now() const {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - epoch).count();
+        }
+
+        // Record a span on the calling thread. name (and arg_name) must outlive the tracer, e.g.
+        // string literals. arg is shown with the span if arg_name isn't null.
+        void record(const char* name, uint64_t begin, uint64_t end, const char* arg_name, int64_t arg);
+
+        // Name the calling thread in the trace, e.g. "Worker 3". name must be a string literal or
+        // otherwise outlive the thread, and can be set before the tracer is opened.
+        static void set_thread_name(const char* name, int index = -1);
+
+    private:
+        struct Event {
+            const char* name;
+            const char* arg_name;
+            int64_t arg;
+            uint64_t begin;
+            uint64_t end;
+        };
+
+        // Only the thread that owns a block adds to it. count and next are what the flush reads.
+        struct Block {
+            Event events[TRACE_BLOCK_EVENTS];
+            std::atomic<int> count{0};
+            std::atomic<Block*> next{nullptr};
+        };
+
+        struct ThreadBuffer {
+            int tid;
+            std::string name;
+            bool named = false; // Whether the name has been written
+            // Oldest block that hasn't been written out yet, and how much of it has been. Only used
+            // by flush().
+            Block* head;
+            int n_written = 0;
+            // Block the thread is adding to. Only used by the thread.
+            Block* tail;
+        };
+
+        std::atomic<bool> is_enabled{false};
+        std::chrono::steady_clock::time_point epoch;
+        int pid = 0;
+        std::thread::id main_thread;
+
+        // One entry per thread that has recorded a span. A deque, so that the entries don't move.
+        std::deque<ThreadBuffer> threads;
+        std::mutex threads_mutex;
+
+        // Held while writing the file
+        std::mutex file_mutex;
+        std::FILE* file = nullptr;
+        bool first_event = true;
+
+        Tracer() = default;
+        ~Tracer();
+
+        // The calling thread's entry in threads
+        ThreadBuffer& thread_buffer();
+
+        void write_event(const char* json);
+};
+
+// Records a span from construction to destruction, if the tracer is enabled
+class TraceSpan {
+    public:
+        explicit TraceSpan(const char* name, const char* arg_name = nullptr, int64_t arg = 0)
+            : name(name), arg_name(arg_name), arg(arg)
+        {
+            if (Tracer::get().enabled())
+                begin = Tracer::get().now();
+        }
+
+        ~TraceSpan() {
+            if (begin != NOT_TRACED && Tracer::get().enabled())
+                Tracer::get().record(name, begin, Tracer::get().now(), arg_name, arg);
+        }
+
+        TraceSpan(const TraceSpan&) = delete;
+        TraceSpan& operator =(const TraceSpan&) = delete;
+
+    private:
+        static constexpr uint64_t NOT_TRACED = UINT64_MAX;
+
+        const char* name;
+        const char* arg_name;
+        int64_t arg;
+        uint64_t begin = NOT_TRACED;
+};
+
+#endif
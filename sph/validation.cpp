@@ -0,0 +1,153 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * validation.cpp implements the sanity checks from validation.hpp.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "validation.hpp"
+#include "define.hpp"
+#include "log.hpp"
+
+// std::isfinite is optimised away by -Ofast, which assumes there aren't any NaNs or infinities, so
+// look at the bits instead: an exponent of all ones is either an infinity or a NaN
+static inline bool is_finite(double x) {
+    uint64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return (bits & 0x7ff0000000000000ull) != 0x7ff0000000000000ull;
+}
+
+static inline bool is_valid(double x, bool positive) {
+    return is_finite(x) & (!positive | (x > 0));
+}
+
+// Number of particles in [first, last) for which get(p) isn't valid. No branches, so that it can be
+// vectorized.
+template <typename Get>
+static int count_invalid(const Particle* particles, int first, int last, bool positive, Get get) {
+    int n_invalid = 0;
+    for (int i = first; i < last; i++)
+        n_invalid += !is_valid(get(particles[i]), positive);
+    return n_invalid;
+}
+
+static const char* field_name(ValidatedField field) {
+    switch (field) {
+        case ValidatePosition: return "position";
+        case ValidateVelocity: return "velocity";
+        case ValidateAcceleration: return "acceleration";
+        case ValidateEnergy: return "thermal energy";
+        case ValidateEnergyRate: return "du/dt";
+        case ValidateDensity: return "density";
+        case ValidateSmoothingLength: return "smoothing length";
+        case ValidatePressure: return "pressure";
+        case ValidateOmega: return "omega";
+        case ValidateMass: return "mass";
+        default: return "unknown";
+    }
+}
+
+static bool must_be_positive(ValidatedField field) {
+    return field == ValidateDensity || field == ValidateSmoothingLength || field == ValidateMass;
+}
+
+static double field_value(const Particle &p, ValidatedField field) {
+    switch (field) {
+        case ValidatePosition: return p.pos;
+        case ValidateVelocity: return p.vel;
+        case ValidateAcceleration: return p.acc;
+        case ValidateEnergy: return p.u;
+        case ValidateEnergyRate: return p.du_dt;
+        case ValidateDensity: return p.density;
+        case ValidateSmoothingLength: return p.h;
+        case ValidatePressure: return p.pressure;
+        case ValidateOmega: return p.omega;
+        case ValidateMass: return p.mass;
+        default: return 0;
+    }
+}
+
+// The sweep for one field, with the accessor inlined into it
+static int count_invalid(const Particle* particles, int first, int last, ValidatedField field) {
+    bool positive = must_be_positive(field);
+
+    switch (field) {
+        case ValidatePosition:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.pos; });
+        case ValidateVelocity:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.vel; });
+        case ValidateAcceleration:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.acc; });
+        case ValidateEnergy:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.u; });
+        case ValidateEnergyRate:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.du_dt; });
+        case ValidateDensity:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.density; });
+        case ValidateSmoothingLength:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.h; });
+        case ValidatePressure:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.pressure; });
+        case ValidateOmega:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.omega; });
+        case ValidateMass:
+            return count_invalid(particles, first, last, positive, [](const Particle &p) { return (double)p.mass; });
+        default:
+            return 0;
+    }
+}
+
+void validate_particles(const Particle* particles, int first, int last, unsigned fields,
+                        const char* phase, int step) {
+    int n_invalid[32] = {};
+    int total_invalid = 0;
+
+    for (int f = 0; (1u << f) <= fields; f++) {
+        if (fields & (1u << f)) {
+            n_invalid[f] = count_invalid(particles, first, last, (ValidatedField)(1u << f));
+            total_invalid += n_invalid[f];
+        }
+    }
+
+    if (total_invalid == 0)
+        return;
+
+    // Something has gone wrong, so take the time to say exactly what
+    std::ostringstream summary;
+    summary << "Particles failed validation after the " << phase << " phase of step " << step << ":";
+
+    for (int f = 0; (1u << f) <= fields; f++) {
+        if (n_invalid[f] == 0)
+            continue;
+
+        ValidatedField field = (ValidatedField)(1u << f);
+        bool positive = must_be_positive(field);
+        summary << " " << field_name(field) << " of " << n_invalid[f] << " particle(s)";
+
+        int n_reported = 0;
+        for (int i = first; i < last && n_reported < VALIDATION_MAX_REPORTED; i++) {
+            const Particle &p = particles[i];
+            double value = field_value(p, field);
+            if (is_valid(value, positive))
+                continue;
+
+            LOG_ERROR("Step " << step << ", after " << phase << ": particle " << i << " (id " << p.id
+                      << ", " << ParticleTypeNames[p.type] << ", position " << p.pos << ") has "
+                      << field_name(field) << " " << value
+                      << (positive && is_finite(value) ? ", which should be positive" : ""));
+            n_reported++;
+        }
+
+        if (n_invalid[f] > n_reported) {
+            LOG_ERROR("... and " << n_invalid[f] - n_reported << " more with an invalid "
+                      << field_name(field) << ".");
+        }
+    }
+
+    LOG_ERROR(summary.str());
+    throw std::runtime_error(summary.str());
+}
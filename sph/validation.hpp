@@ -0,0 +1,51 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * validation.hpp defines the sanity checks of the particle array. These used to be done one
+ * particle at a time in the middle of the calculators (e.g. checking the density of every neighbour
+ * in the force loop), which cost time in every run and got in the way of the compiler vectorizing
+ * those loops, even though they have caught nothing since the early days. Now they are sweeps over
+ * whole chunks of the array once each phase of the timestep has finished with them, and are only
+ * compiled in to the checked build (`make checked`, which defines USE_CHECKED). In the normal build
+ * VALIDATE_PARTICLES expands to nothing, so the checks cost nothing at all.
+ *
+ * A sweep checks that the given properties of every particle are finite (not NaN or infinite), and
+ * that densities, smoothing lengths and masses are positive. Other than real numerical blow-ups,
+ * this is good at catching memory errors, since an uninitialized double is often something like
+ * 2.41255152E-315 or NaN. If any particle fails, which ones and why (along with the phase and step)
+ * are logged, and a std::runtime_error is thrown, which ends the run (or ensemble member).
+ */
+
+#ifndef validation_hpp
+#define validation_hpp
+
+#include "basictypes.hpp"
+
+// Properties of a particle that a sweep can check, to be combined with |
+enum ValidatedField : unsigned {
+    ValidatePosition = 1 << 0,
+    ValidateVelocity = 1 << 1,
+    ValidateAcceleration = 1 << 2,
+    ValidateEnergy = 1 << 3, // Thermal energy u
+    ValidateEnergyRate = 1 << 4, // du/dt
+    ValidateDensity = 1 << 5, // Must also be positive
+    ValidateSmoothingLength = 1 << 6, // Must also be positive
+    ValidatePressure = 1 << 7,
+    ValidateOmega = 1 << 8,
+    ValidateMass = 1 << 9, // Must also be positive
+    ValidateAll = (1 << 10) - 1
+};
+
+// Check the fields (a combination of ValidatedField) of particles [first, last), which have just
+// been through the given phase of the given step. Throws std::runtime_error if any fail.
+void validate_particles(const Particle* particles, int first, int last, unsigned fields,
+                        const char* phase, int step);
+
+#ifdef USE_CHECKED
+#define VALIDATE_PARTICLES(particles, first, last, fields, phase, step) \
+    validate_particles(particles, first, last, fields, phase, step)
+#else
+#define VALIDATE_PARTICLES(particles, first, last, fields, phase, step) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_analysis.cpp defines unit tests for the in-situ analysis, checking the totals and profiles
+ * against sums done by hand, and that a step in density is found as a shock front.
+ */
+
+#include <cmath>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/analysis.hpp"
+
+class AnalysisTestFixture : public ::testing::Test {
+    protected:
+        Config config;
+        Executor executor;
+
+        AnalysisTestFixture() : executor(4) {
+            config = Config();
+            config.limit = 2;
+        }
+
+        // n evenly spaced particles across the domain, with the given density either side of a
+        // step at x_step (or 1 everywhere else)
+        std::vector<Particle> lattice(int n, double x_step, double density) {
+            std::vector<Particle> particles;
+            double spacing = 2 * config.limit / n;
+
+            for (int i = 0; i < n; i++) {
+                double x = -config.limit + (i + 0.5) * spacing;
+                Particle p(x, x < 0 ? 1 : -1, 0.01);
+                p.u = 2;
+                p.density = (x > -x_step && x < x_step) ? density : 1;
+                particles.push_back(p);
+            }
+
+            return particles;
+        }
+};
+
+TEST_F(AnalysisTestFixture, SumsTotalsAndProfiles) {
+    // More particles than fit in one part, so the parts have to be combined
+    std::vector<Particle> particles = lattice(1000, 0, 1);
+    Analysis analysis(config, 10);
+    AnalysisResult result = analysis.reduce(particles.data(), particles.size(), executor);
+
+    EXPECT_NEAR(result.totals.mass, 10, 1e-10);
+    EXPECT_NEAR(result.totals.momentum, 0, 1e-10);
+    EXPECT_NEAR(result.totals.kinetic_energy, 5, 1e-10);
+    EXPECT_NEAR(result.totals.thermal_energy, 20, 1e-10);
+
+    ASSERT_EQ(result.bins.size(), 10u);
+    for (int b = 0; b < 10; b++) {
+        EXPECT_EQ(result.bins[b].count, 100);
+        EXPECT_NEAR(result.bins[b].momentum, b < 5 ? 1 : -1, 1e-10);
+    }
+
+    // Uniform density, so no shocks
+    EXPECT_TRUE(std::isnan(result.shock_left));
+    EXPECT_TRUE(std::isnan(result.shock_right));
+}
+
+TEST_F(AnalysisTestFixture, FindsShockFronts) {
+    std::vector<Particle> particles = lattice(400, 0.5, 4);
+    Analysis analysis(config, 40);
+    AnalysisResult result = analysis.reduce(particles.data(), particles.size(), executor);
+
+    EXPECT_EQ(result.peak_density, 4);
+    EXPECT_NEAR(result.shock_left, -0.5, 1e-10);
+    EXPECT_NEAR(result.shock_right, 0.5, 1e-10);
+}
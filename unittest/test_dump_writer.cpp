@@ -0,0 +1,131 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_dump_writer.cpp defines unit tests for the text dump writer, checking that its lines are byte
+ * for byte the same as the sprintf format it replaced, that the full precision lines read back
+ * exactly, and that the lines formatted in parallel come out in order.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/define.hpp"
+#include "../sph/dump_writer.hpp"
+
+// The format dumps were written with before dump_writer.cpp
+static std::string sprintf_line(const Particle &p) {
+    char buffer[DUMP_LINE_MAX];
+    snprintf(buffer, sizeof(buffer),
+             "%4d    %s    %3.5f    %3.3f    %3.3f    %+3.3f    %+3.3f    %+3.3f    %3.3f\n",
+             p.id, ParticleTypeNames[p.type], (double)p.h, (double)p.density, (double)p.pressure,
+             (double)p.acc, (double)p.vel, (double)p.pos, (double)p.u);
+    return buffer;
+}
+
+static std::string dump_line(const Particle &p, bool full_precision) {
+    char buffer[DUMP_LINE_MAX];
+    return std::string(buffer, format_dump_line(buffer, p, full_precision));
+}
+
+static void set_values(Particle &p, double value) {
+    p.h = value;
+    p.density = value;
+    p.pressure = value;
+    p.acc = value;
+    p.vel = value;
+    p.pos = value;
+    p.u = value;
+}
+
+TEST(DumpWriterTest, MatchesSprintf) {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> mantissa(-1, 1);
+    std::uniform_int_distribution<int> exponent(-8, 8);
+
+    for (int i = 0; i < 10000; i++) {
+        Particle p(i * 37 % 20000 - 100);
+        p.type = (ParticleType)(i % 3);
+        p.h = mantissa(rng) * std::pow(10, exponent(rng));
+        p.density = mantissa(rng) * std::pow(10, exponent(rng));
+        p.pressure = mantissa(rng) * std::pow(10, exponent(rng));
+        p.acc = mantissa(rng) * std::pow(10, exponent(rng));
+        p.vel = mantissa(rng) * std::pow(10, exponent(rng));
+        p.pos = mantissa(rng) * std::pow(10, exponent(rng));
+        p.u = mantissa(rng) * std::pow(10, exponent(rng));
+
+        ASSERT_EQ(dump_line(p, false), sprintf_line(p));
+    }
+}
+
+TEST(DumpWriterTest, MatchesSprintfEdgeCases) {
+    const double inf = std::numeric_limits<double>::infinity();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    // Halfway cases, signed zeros and values that round to zero, and the extremes
+    double values[] = { 0, -0.0, 0.0005, -0.0005, 0.0015, 0.0025, 2.5e-6, -1e-9, 999.9995,
+                        1e17, -1e300, std::numeric_limits<double>::max(), inf, -inf, nan, -nan };
+
+    for (double value : values) {
+        Particle p(7);
+        p.type = Alive;
+        set_values(p, value);
+        EXPECT_EQ(dump_line(p, false), sprintf_line(p)) << "value " << value;
+    }
+}
+
+TEST(DumpWriterTest, FullPrecisionReadsBackExactly) {
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> dist(-3, 3);
+
+    for (int i = 0; i < 1000; i++) {
+        Particle p(i);
+        p.type = Alive;
+        set_values(p, dist(rng));
+
+        std::istringstream line(dump_line(p, true));
+        int id;
+        std::string type;
+        double h, density, pressure, acc, vel, pos, u;
+        line >> id >> type >> h >> density >> pressure >> acc >> vel >> pos >> u;
+
+        EXPECT_EQ(id, i);
+        EXPECT_EQ(type, "Alive");
+        EXPECT_EQ(h, (double)p.h);
+        EXPECT_EQ(acc, (double)p.acc);
+        EXPECT_EQ(pos, (double)p.pos);
+        EXPECT_EQ(u, (double)p.u);
+    }
+}
+
+TEST(DumpWriterTest, ParallelLinesInOrder) {
+    // Enough particles for several chunks, the last of them partly full
+    int n = 3 * DUMP_CHUNK_SIZE + 17;
+    std::vector<Particle> particles;
+    std::string expected = format_dump_header(0.25);
+    for (int i = 0; i < n; i++) {
+        Particle &p = particles.emplace_back(i);
+        p.type = (i % 10 == 0) ? Ghost : Alive;
+        set_values(p, std::sin(i));
+        expected += sprintf_line(p);
+    }
+
+    Executor executor(4);
+    std::string text = format_dump_header(0.25);
+    format_dump_lines(particles.data(), n, false, executor, text);
+    EXPECT_EQ(text, expected);
+
+    std::string filename = "test_dump_writer.txt";
+    ASSERT_TRUE(write_dump_file(filename, text));
+    std::ifstream file(filename);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    EXPECT_EQ(contents.str(), expected);
+    std::remove(filename.c_str());
+}
@@ -0,0 +1,140 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_force_calculator.cpp defines unit tests for the ForceCalculator, checking that working out
+ * the acceleration and du/dt in one sweep gives the same results as the AccelerationCalculator and
+ * EnergyCalculator one after the other, and that the rate of change of the density it finds (which
+ * the smoothing lengths are predicted from) follows the continuity equation.
+ */
+
+#include <cmath>
+#include <gtest/gtest.h>
+
+#include "../sph/calculators.hpp"
+#include "../sph/neighbour_list.hpp"
+#include "../sph/smoothing_length.hpp"
+
+class ForceCalculatorTestFixture : public ::testing::Test {
+    protected:
+        static const int N = 41;
+
+        ParticleArrayPtr p_arr;
+        Config config;
+
+        ForceCalculatorTestFixture() {
+            // Slightly uneven lattice with two streams colliding at 0, so that the pressures,
+            // smoothing lengths and viscosity all vary from pair to pair
+            p_arr = ParticleArrayPtr(new Particle[N]);
+            for (int i = 0; i < N; i++) {
+                Particle &p = p_arr[i];
+                p.mass = 0.05;
+                p.pos = -1 + 0.05 * i + 0.01 * std::sin(i);
+                p.vel = p.pos < 0 ? 1 : -1;
+                p.acc = 0;
+                p.h = 0.1 + 0.01 * std::cos(i);
+                p.u = 1.5 + 0.1 * std::sin(2 * i);
+                p.du_dt = 0;
+                p.density = 1 + 0.2 * std::cos(3 * i);
+                p.pressure = 0;
+                p.omega = 1 + 0.05 * std::sin(i);
+                p.type = Alive;
+            }
+
+            config = Config();
+            config.n_part = N;
+            config.n_ghost = 0;
+            config.n_halo = 0;
+            config.n_alloc = N;
+            config.pressure_calc = Adiabatic;
+            config.h_factor = 2;
+            config.limit = 1.5;
+        }
+
+        // Copy of the particle array, so that each calculation starts from the same particles
+        ParticleArrayPtr copy() const {
+            ParticleArrayPtr c(new Particle[N]);
+            for (int i = 0; i < N; i++)
+                c[i] = p_arr[i];
+            return c;
+        }
+
+        void expect_same_as_separate() {
+            ParticleArrayPtr separate = copy();
+            ParticleArrayPtr fused = copy();
+
+            NeighbourList nlist(0.2);
+            nlist.build(p_arr, config);
+
+            AccelerationCalculator ac(config, separate, nlist);
+            EnergyCalculator ec(config, separate, nlist);
+            ForceCalculator fc(config, fused, nlist);
+
+            for (int i = 0; i < N; i++) {
+                ac(separate[i]);
+                ec(separate[i]);
+                fc(fused[i]);
+            }
+
+            for (int i = 0; i < N; i++) {
+                EXPECT_DOUBLE_EQ(fused[i].pressure, separate[i].pressure);
+                EXPECT_NEAR(fused[i].acc, separate[i].acc, 1e-10 * std::abs(separate[i].acc) + 1e-12);
+                EXPECT_NEAR(fused[i].du_dt, separate[i].du_dt, 1e-10 * std::abs(separate[i].du_dt) + 1e-12);
+            }
+        }
+};
+
+TEST_F(ForceCalculatorTestFixture, MatchesSeparateCalculatorsAdiabatic) {
+    expect_same_as_separate();
+}
+
+TEST_F(ForceCalculatorTestFixture, MatchesSeparateCalculatorsIsothermal) {
+    config.pressure_calc = Isothermal;
+    expect_same_as_separate();
+}
+
+TEST_F(ForceCalculatorTestFixture, SkipsGhostParticles) {
+    p_arr[0].type = Ghost;
+    p_arr[0].acc = 7;
+    p_arr[0].du_dt = 7;
+
+    NeighbourList nlist(0.2);
+    nlist.build(p_arr, config);
+    ForceCalculator fc(config, p_arr, nlist);
+    fc(p_arr[0]);
+
+    EXPECT_EQ(p_arr[0].acc, 7);
+    EXPECT_EQ(p_arr[0].du_dt, 7);
+}
+
+TEST_F(ForceCalculatorTestFixture, DensityRateFromContinuity) {
+    // Even lattice being squashed uniformly, so that div v = -1 and drho/dt = rho everywhere
+    for (int i = 0; i < N; i++) {
+        Particle &p = p_arr[i];
+        p.pos = -1 + 0.05 * i;
+        p.vel = -p.pos;
+        p.h = 0.1;
+        p.density = 1;
+        p.omega = 1;
+    }
+
+    NeighbourList nlist(0.2);
+    nlist.build(p_arr, config);
+    ForceCalculator fc(config, p_arr, nlist);
+
+    // Away from the ends, where the particles have neighbours on both sides
+    for (int i = 8; i < N - 8; i++) {
+        fc(p_arr[i]);
+        EXPECT_NEAR(p_arr[i].drho_dt, 1, 1e-3) << "particle " << i;
+    }
+}
+
+TEST(PredictHTest, FollowsDensity) {
+    // Compressing at drho/dt = rho, so h shrinks by exp(-dt)
+    EXPECT_DOUBLE_EQ(predict_h_factor(2, 2, 0.01), std::exp(-0.01));
+    // Expanding
+    EXPECT_GT(predict_h_factor(1, -0.5, 0.01), 1);
+    // Only so far in one step, and not at all without a density
+    EXPECT_DOUBLE_EQ(predict_h_factor(1, 1000, 0.01), 1 / H_PREDICT_MAX_FACTOR);
+    EXPECT_DOUBLE_EQ(predict_h_factor(1, -1000, 0.01), H_PREDICT_MAX_FACTOR);
+    EXPECT_EQ(predict_h_factor(0, 1, 0.01), 1);
+}
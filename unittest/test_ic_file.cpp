@@ -0,0 +1,76 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_ic_file.cpp defines unit tests for the binary initial conditions files, checking that
+ * particles come back out of a file the same as they went in.
+ */
+
+#include <cstdio>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "../sph/ic_file.hpp"
+
+class ICFileTestFixture : public ::testing::Test {
+    protected:
+        ParticleArrayPtr p_arr;
+        Config config;
+        std::string filename = "test_ic_file.bin";
+
+        ICFileTestFixture() {
+            p_arr = ParticleArrayPtr(new Particle[4] {
+                Particle(-1.5, 1, 0.1),
+                Particle(-0.5, 2, 0.2),
+                Particle(0.5, -3, 0.3),
+                Particle(1.5, -4, 0.4)
+            });
+
+            for (int i = 0; i < 4; i++) {
+                p_arr[i].u = 10 + i;
+                p_arr[i].h = 0.5 + i;
+            }
+
+            config = Config();
+            config.limit = 2;
+        }
+
+        ~ICFileTestFixture() {
+            std::remove(filename.c_str());
+        }
+};
+
+TEST_F(ICFileTestFixture, RoundTripsAllColumns) {
+    write_ic_file(filename, p_arr.get(), 4, IC_HAS_VEL | IC_HAS_H);
+
+    ParticleArrayPtr loaded;
+    uint32_t flags = read_ic_file(filename, config, loaded);
+
+    EXPECT_EQ(flags, IC_HAS_VEL | IC_HAS_H);
+    EXPECT_EQ(config.n_part, 4);
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(loaded[i].pos, p_arr[i].pos);
+        EXPECT_EQ(loaded[i].vel, p_arr[i].vel);
+        EXPECT_EQ(loaded[i].mass, p_arr[i].mass);
+        EXPECT_EQ(loaded[i].u, p_arr[i].u);
+        EXPECT_EQ(loaded[i].h, p_arr[i].h);
+    }
+}
+
+TEST_F(ICFileTestFixture, OptionalColumnsCanBeLeftOut) {
+    write_ic_file(filename, p_arr.get(), 4, 0);
+
+    ParticleArrayPtr loaded;
+    uint32_t flags = read_ic_file(filename, config, loaded);
+
+    EXPECT_EQ(flags, 0u);
+
+    for (int i = 0; i < 4; i++) {
+        EXPECT_EQ(loaded[i].pos, p_arr[i].pos);
+        EXPECT_EQ(loaded[i].mass, p_arr[i].mass);
+        EXPECT_EQ(loaded[i].u, p_arr[i].u);
+        // Not in the file, so left for load_particles to set up
+        EXPECT_EQ(loaded[i].vel, 0);
+        EXPECT_EQ(loaded[i].h, 0);
+    }
+}
@@ -0,0 +1,98 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_metrics.cpp defines unit tests for the metrics endpoint, checking that counters added to
+ * from many threads at once don't lose any of it, that the server answers over its socket in both
+ * formats, and that the drift is measured from the first energy and momentum it was given.
+ */
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <gtest/gtest.h>
+
+#include "../sph/metrics.hpp"
+
+// Connect to the socket at path, send request (if not empty) and read everything that comes back
+static std::string query(const std::string &path, const std::string &request) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+    if (connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        close(fd);
+        return "";
+    }
+
+    if (!request.empty())
+        send(fd, request.data(), request.size(), 0);
+
+    std::string response;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        response.append(buffer, n);
+    close(fd);
+    return response;
+}
+
+TEST(MetricsTest, CounterSumsOverThreads) {
+    MetricCounter counter;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&counter] {
+            for (int i = 0; i < 100000; i++)
+                counter.add(2);
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(counter.value(), 8u * 100000 * 2);
+}
+
+TEST(MetricsTest, ServesBothFormats) {
+    std::string path = "/tmp/test_metrics_" + std::to_string(getpid()) + ".sock";
+    MetricsServer server(path);
+    server.set_progress(42, 0.5);
+    server.set_particles(100, 10, 4);
+
+    std::string text = query(path, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_EQ(text.rfind("HTTP/1.0 200 OK\r\n", 0), 0u);
+    EXPECT_NE(text.find("text/plain"), std::string::npos);
+    EXPECT_NE(text.find("sph_steps_total 42\n"), std::string::npos);
+    EXPECT_NE(text.find("sph_particles{type=\"ghost\"} 10\n"), std::string::npos);
+    EXPECT_NE(text.find("sph_phase_seconds_total{phase=\"Density\"}"), std::string::npos);
+
+    std::string json = query(path, "GET /metrics.json HTTP/1.1\r\n\r\n");
+    EXPECT_NE(json.find("application/json"), std::string::npos);
+    EXPECT_NE(json.find("\"step\": 42"), std::string::npos);
+
+    // Without HTTP, or without asking for anything at all
+    EXPECT_EQ(query(path, "json\n").rfind("{\"time\": 0.5", 0), 0u);
+    EXPECT_EQ(query(path, "").rfind("# HELP", 0), 0u);
+}
+
+TEST(MetricsTest, RemovesSocket) {
+    std::string path = "/tmp/test_metrics_" + std::to_string(getpid()) + "_gone.sock";
+    {
+        MetricsServer server(path);
+        EXPECT_EQ(access(path.c_str(), F_OK), 0);
+    }
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+}
+
+TEST(MetricsTest, DriftFromFirstValues) {
+    MetricsServer server("/tmp/test_metrics_" + std::to_string(getpid()) + "_drift.sock");
+    server.set_conserved(2.0, 0.5);
+    server.set_conserved(2.1, 0.25);
+
+    std::string json = server.json();
+    EXPECT_NE(json.find("\"energy\": 2.1"), std::string::npos);
+    EXPECT_NE(json.find("\"energy_drift\": 0.05"), std::string::npos);
+    EXPECT_NE(json.find("\"momentum_drift\": -0.25"), std::string::npos);
+}
@@ -0,0 +1,95 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_neighbour_list.cpp defines unit tests for the Verlet neighbour lists, checking that the
+ * right particles are listed, that the lists are rebuilt when they go stale, and that they can be
+ * put in order of position.
+ */
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/neighbour_list.hpp"
+
+class NeighbourListTestFixture : public ::testing::Test {
+    protected:
+        ParticleArrayPtr p_arr;
+        Config config;
+
+        NeighbourListTestFixture() {
+            // Particles spaced 1 apart with h = 0.5, so with KERNEL_RADIUS = 2.5 each particle
+            // interacts with its nearest neighbour on either side only
+            p_arr = ParticleArrayPtr(new Particle[5] {
+                Particle(-2, 0, 1),
+                Particle(-1, 0, 1),
+                Particle(0, 0, 1),
+                Particle(1, 0, 1),
+                Particle(2, 0, 1)
+            });
+
+            for (int i = 0; i < 5; i++)
+                p_arr[i].h = 0.5;
+
+            config = Config();
+            config.n_part = 5;
+            config.n_ghost = 0;
+        }
+};
+
+TEST_F(NeighbourListTestFixture, ListsNearestNeighbours) {
+    NeighbourList nlist(0.2);
+    nlist.build(p_arr, config);
+
+    // Lists include the particle itself and are sorted by index
+    std::vector<int> middle(nlist.neighbours(2).begin(), nlist.neighbours(2).end());
+    EXPECT_EQ(middle, std::vector<int>({1, 2, 3}));
+
+    std::vector<int> edge(nlist.neighbours(0).begin(), nlist.neighbours(0).end());
+    EXPECT_EQ(edge, std::vector<int>({0, 1}));
+}
+
+TEST_F(NeighbourListTestFixture, SkinExtendsRadius) {
+    // Radius 2.5 * 0.5 * (1 + 0.7) = 2.125, so next-nearest neighbours are listed too
+    NeighbourList nlist(0.7);
+    nlist.build(p_arr, config);
+
+    EXPECT_EQ(nlist.neighbours(2).size(), 5);
+}
+
+TEST_F(NeighbourListTestFixture, RebuildWhenStale) {
+    NeighbourList nlist(0.2);
+    nlist.build(p_arr, config);
+
+    // Small displacement (less than 2.5 * 0.2 * 0.5 / 4) doesn't require a rebuild
+    p_arr[2].pos += 0.01;
+    EXPECT_FALSE(nlist.update(p_arr, config));
+
+    // Large displacement does
+    p_arr[2].pos += 0.5;
+    EXPECT_TRUE(nlist.update(p_arr, config));
+    EXPECT_EQ(nlist.n_builds(), 2);
+
+    // So does a smoothing length that outgrows the skin
+    p_arr[0].h = 0.6;
+    EXPECT_FALSE(nlist.covers(0, p_arr[0].h));
+    EXPECT_TRUE(nlist.update(p_arr, config));
+}
+
+TEST_F(NeighbourListTestFixture, SortByPosition) {
+    // Same particles, but not in order of position in the array
+    std::swap(p_arr[1].pos, p_arr[3].pos);
+
+    NeighbourList nlist(0.2);
+    nlist.build(p_arr, config);
+
+    std::vector<int> by_index(nlist.neighbours(2).begin(), nlist.neighbours(2).end());
+    EXPECT_EQ(by_index, std::vector<int>({1, 2, 3}));
+
+    nlist.sort_by_position(p_arr.get(), 2, 3);
+    std::vector<int> by_position(nlist.neighbours(2).begin(), nlist.neighbours(2).end());
+    EXPECT_EQ(by_position, std::vector<int>({3, 2, 1}));
+
+    // Only the lists asked for are sorted (particle 1 is now at 1, so would be {2, 1, 4})
+    std::vector<int> other(nlist.neighbours(1).begin(), nlist.neighbours(1).end());
+    EXPECT_EQ(other, std::vector<int>({1, 2, 4}));
+}
@@ -0,0 +1,147 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_out_of_core.cpp defines unit tests for the OutOfCoreSimulation, checking that streaming
+ * through the particles in windows much smaller than their halos gives the same particles as the
+ * normal simulation, with only a window's worth of them in memory at once. Also checks that both
+ * skip the density sweep the same way when the densities are integrated between sums.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/log.hpp"
+#include "../sph/out_of_core.hpp"
+#include "../sph/particle_array.hpp"
+#include "../sph/setup.hpp"
+#include "../sph/sph_simulation.hpp"
+
+class OutOfCoreTestFixture : public ::testing::Test {
+    protected:
+        Config config;
+        std::string filename = "test_out_of_core.bin";
+
+        OutOfCoreTestFixture() {
+            config = Config();
+            config.n_part = 201;
+            config.mass = 0.02;
+            config.pressure_calc = Adiabatic;
+            config.limit = 2;
+            config.v_0 = 1;
+            config.h_factor = 2;
+            config.t_i = 0.002;
+            config.n_threads = 2;
+            config.log_level = LogWarn;
+            config.h_activity_tol = 0;
+            config.density_sum_interval = 1;
+            config.deterministic = 0;
+            config.pin_threads = NoPinning;
+            config.huge_pages = NoHugePages;
+            config.refine_interval = 0;
+            config.analysis_bins = 1;
+            config.out_of_core_window = 8;
+            config.n_ghost = 0;
+            config.n_halo = 0;
+        }
+
+        ~OutOfCoreTestFixture() {
+            std::remove(filename.c_str());
+        }
+};
+
+// The alive particles of a normal simulation, in order of position like the out-of-core ones
+static std::vector<const Particle*> sorted_alive(const SPHSimulation &sim) {
+    const Config &c = sim.get_config();
+    int n_alive = c.n_part - c.n_ghost - c.n_halo;
+    ParticleArrayPtr p_arr = sim.get_particles();
+    std::vector<const Particle*> sorted;
+    for (int i = 0; i < n_alive; i++)
+        sorted.push_back(&p_arr[i]);
+    std::sort(sorted.begin(), sorted.end(), [](const Particle* a, const Particle* b) {
+        return a->pos < b->pos;
+    });
+    return sorted;
+}
+
+static std::unique_ptr<SPHSimulation> in_memory_simulation(Config config) {
+    ParticleArrayPtr p_arr = allocate_particles(config.n_part);
+    config.n_alloc = config.n_part;
+    init_particles(config, p_arr);
+
+    auto sim = std::make_unique<SPHSimulation>(config, p_arr);
+    sim->set_write_output(false);
+    return sim;
+}
+
+// Sums over the ghost particles are done in a slightly different order, so the two only agree to
+// rounding error
+static void expect_same_particles(const OutOfCoreSimulation &out_of_core, const SPHSimulation &in_memory) {
+    std::vector<const Particle*> expected = sorted_alive(in_memory);
+    const ParticleStore &store = out_of_core.get_particles();
+    ASSERT_EQ(store.size(), (int)expected.size());
+
+    for (int i = 0; i < store.size(); i++) {
+        EXPECT_NEAR(store[i].pos, expected[i]->pos, 1e-9);
+        EXPECT_NEAR(store[i].vel, expected[i]->vel, 1e-9);
+        EXPECT_NEAR(store[i].u, expected[i]->u, 1e-9);
+        EXPECT_NEAR(store[i].h, expected[i]->h, 1e-9);
+        EXPECT_NEAR(store[i].density, expected[i]->density, 1e-9);
+    }
+
+    EXPECT_EQ((int)out_of_core.get_ghosts().size(), in_memory.get_config().n_ghost);
+}
+
+TEST_F(OutOfCoreTestFixture, MatchesInMemorySimulation) {
+    std::unique_ptr<SPHSimulation> in_memory = in_memory_simulation(config);
+    OutOfCoreSimulation out_of_core(config, filename);
+
+    for (int step = 0; step < 3; step++) {
+        in_memory->advance(10);
+        out_of_core.advance(10);
+        expect_same_particles(out_of_core, *in_memory);
+    }
+
+    // Each window of 8 needs a few neighbours' worth of halo either side, but nowhere near all 201
+    EXPECT_LT(out_of_core.max_working_set(), 100);
+}
+
+TEST_F(OutOfCoreTestFixture, IntegratedDensities) {
+    Config summed_config = config;
+    config.density_sum_interval = 4;
+
+    std::unique_ptr<SPHSimulation> summed = in_memory_simulation(summed_config);
+    std::unique_ptr<SPHSimulation> in_memory = in_memory_simulation(config);
+    OutOfCoreSimulation out_of_core(config, filename);
+
+    // Stopping on steps with and without a sum
+    for (int n : { 3, 4, 6 }) {
+        summed->advance(n);
+        in_memory->advance(n);
+        out_of_core.advance(n);
+        expect_same_particles(out_of_core, *in_memory);
+
+        // h follows the integrated density exactly, and the density stays close to the summed one.
+        // They differ most (by a couple of percent) at the collision and next to the walls.
+        std::vector<const Particle*> expected = sorted_alive(*summed);
+        std::vector<const Particle*> integrated = sorted_alive(*in_memory);
+        for (int i = 0; i < (int)expected.size(); i++) {
+            const Particle &p = *integrated[i];
+            EXPECT_NEAR(p.density, expected[i]->density, 0.05 * expected[i]->density);
+            if (in_memory->steps_taken() % 4 != 0)
+                EXPECT_NEAR(p.h, config.h_factor * p.mass / p.density, 1e-12);
+        }
+    }
+}
+
+TEST_F(OutOfCoreTestFixture, StaysInOrderOfPosition) {
+    OutOfCoreSimulation out_of_core(config, filename);
+    out_of_core.advance(50);
+
+    const ParticleStore &store = out_of_core.get_particles();
+    for (int i = 1; i < store.size(); i++)
+        EXPECT_LE(store[i - 1].pos, store[i].pos);
+}
@@ -0,0 +1,139 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_refinement.cpp defines unit tests for the Refiner, checking that its indicator picks out
+ * converging flow, and that splitting and merging particles conserves mass, momentum and energy.
+ */
+
+#include <cmath>
+#include <gtest/gtest.h>
+
+#include "../sph/refinement.hpp"
+
+class RefinementTestFixture : public ::testing::Test {
+    protected:
+        static const int N = 41;
+
+        ParticleArrayPtr p_arr;
+        Config config;
+
+        RefinementTestFixture() {
+            // Uniform lattice of unit density spaced 0.05 apart, so h = h_factor * m / rho = 0.1
+            p_arr = ParticleArrayPtr(new Particle[N]);
+            for (int i = 0; i < N; i++) {
+                Particle &p = p_arr[i];
+                p.mass = 0.05;
+                p.pos = -1 + 0.05 * i;
+                p.vel = 0;
+                p.acc = 0;
+                p.h = 0.1;
+                p.u = 1.5;
+                p.du_dt = 0;
+                p.density = 1;
+                p.pressure = 1;
+                p.omega = 1;
+                p.type = Alive;
+            }
+
+            config = Config();
+            config.n_part = N;
+            config.n_ghost = 0;
+            config.n_halo = 0;
+            config.n_alloc = N;
+            config.pressure_calc = Adiabatic;
+            config.h_factor = 2;
+            config.limit = 1.5;
+            config.refine_threshold = 0.3;
+            config.refine_max_level = 2;
+        }
+
+        // Total mass, momentum and energy of the alive particles
+        void totals(double &mass, double &momentum, double &energy) const {
+            mass = momentum = energy = 0;
+            for (int i = 0; i < config.n_part; i++) {
+                const Particle &p = p_arr[i];
+                mass += p.mass;
+                momentum += p.mass * p.vel;
+                energy += p.mass * (0.5 * p.vel * p.vel + p.u);
+            }
+        }
+
+        RefinementCounts refine(Refiner &refiner, Executor &executor) {
+            NeighbourList nlist(0.2);
+            nlist.build(p_arr, config);
+            return refiner.refine(p_arr, config, nlist, executor);
+        }
+};
+
+TEST_F(RefinementTestFixture, IndicatorZeroInUniformFlow) {
+    for (int i = 0; i < N; i++)
+        p_arr[i].vel = 0.5;
+
+    Refiner refiner(config, p_arr.get(), N);
+    NeighbourList nlist(0.2);
+    nlist.build(p_arr, config);
+
+    for (int i = 0; i < N; i++)
+        EXPECT_NEAR(refiner.indicator(p_arr.get(), i, nlist.neighbours(i)), 0, 1e-12);
+}
+
+TEST_F(RefinementTestFixture, SplitsConvergingFlow) {
+    // Two streams colliding at 0, as in the simulation
+    for (int i = 0; i < N; i++)
+        p_arr[i].vel = p_arr[i].pos < 0 ? 1 : (p_arr[i].pos > 0 ? -1 : 0);
+
+    Refiner refiner(config, p_arr.get(), N);
+    Executor executor(2);
+
+    double mass, momentum, energy;
+    totals(mass, momentum, energy);
+
+    RefinementCounts counts = refine(refiner, executor);
+    EXPECT_GT(counts.n_split, 0);
+    EXPECT_EQ(counts.max_level, 1);
+    EXPECT_EQ(config.n_part, N + counts.n_split - counts.n_merged);
+
+    double new_mass, new_momentum, new_energy;
+    totals(new_mass, new_momentum, new_energy);
+    EXPECT_NEAR(new_mass, mass, 1e-12);
+    EXPECT_NEAR(new_momentum, momentum, 1e-12);
+    EXPECT_NEAR(new_energy, energy, 1e-12);
+
+    // The new particles are in order of position, and only the ones by the collision were split
+    for (int i = 1; i < config.n_part; i++)
+        EXPECT_LT(p_arr[i - 1].pos, p_arr[i].pos);
+    EXPECT_DOUBLE_EQ(p_arr[0].mass, 0.05);
+    EXPECT_DOUBLE_EQ(p_arr[config.n_part / 2].mass, 0.025);
+}
+
+TEST_F(RefinementTestFixture, MergesSmoothFlowBack) {
+    for (int i = 0; i < N; i++)
+        p_arr[i].vel = p_arr[i].pos < 0 ? 1 : (p_arr[i].pos > 0 ? -1 : 0);
+
+    Refiner refiner(config, p_arr.get(), N);
+    Executor executor(2);
+    RefinementCounts counts = refine(refiner, executor);
+    ASSERT_GT(counts.n_split, 0);
+
+    // Once the flow is smooth again, the split particles are merged back, with the kinetic energy of
+    // their relative motion going into their thermal energy
+    for (int i = 0; i < config.n_part; i++)
+        p_arr[i].vel = 0.1 * p_arr[i].pos;
+
+    double mass, momentum, energy;
+    totals(mass, momentum, energy);
+
+    counts = refine(refiner, executor);
+    EXPECT_GT(counts.n_merged, 0);
+    EXPECT_EQ(counts.n_split, 0);
+
+    double new_mass, new_momentum, new_energy;
+    totals(new_mass, new_momentum, new_energy);
+    EXPECT_NEAR(new_mass, mass, 1e-12);
+    EXPECT_NEAR(new_momentum, momentum, 1e-12);
+    EXPECT_NEAR(new_energy, energy, 1e-12);
+
+    // Nothing is heavier than the particles started out
+    for (int i = 0; i < config.n_part; i++)
+        EXPECT_LE(p_arr[i].mass, refiner.get_max_mass() * (1 + 1e-12));
+}
@@ -0,0 +1,93 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_snapshot_codec.cpp defines unit tests for the compressed snapshot stream, checking that
+ * every value comes back out exactly as it went in, through both keyframes and delta frames.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/snapshot_codec.hpp"
+
+TEST(SnapshotCodecTest, ZeroRunsRoundTrip) {
+    std::mt19937 rng(1);
+    std::vector<uint8_t> data;
+
+    // Runs of zeros of every length either side of the minimum, between random bytes
+    for (int run = 0; run < 300; run++) {
+        data.insert(data.end(), run % 10, 0);
+        for (int i = 0; i < run % 7 + 1; i++)
+            data.push_back(rng() % 255 + 1);
+    }
+    data.insert(data.end(), 1000, 0);
+
+    std::vector<uint8_t> compressed = compress_zero_runs(data);
+    EXPECT_LT(compressed.size(), data.size());
+
+    std::vector<uint8_t> decompressed(data.size());
+    ASSERT_TRUE(decompress_zero_runs(compressed.data(), compressed.size(), decompressed));
+    EXPECT_EQ(decompressed, data);
+
+    // Too short an output buffer means the stream doesn't match
+    std::vector<uint8_t> too_short(data.size() - 1);
+    EXPECT_FALSE(decompress_zero_runs(compressed.data(), compressed.size(), too_short));
+}
+
+TEST(SnapshotCodecTest, FramesRoundTripExactly) {
+    std::string filename = "test_snapshot_codec.sph";
+    std::mt19937 rng(2);
+    std::uniform_real_distribution<double> noise(-1e-3, 1e-3);
+
+    std::vector<Particle> particles;
+    for (int i = 0; i < 50; i++) {
+        particles.emplace_back(-1 + 0.04 * i, i < 25 ? 1 : -1, 0.01);
+        particles.back().h = 0.1;
+        particles.back().density = 1;
+        particles.back().u = 1.5;
+    }
+
+    std::vector<Snapshot> written;
+    {
+        SnapshotWriter writer(filename);
+
+        for (int step = 0; step < 60; step++) {
+            for (Particle &p : particles) {
+                p.pos += p.vel * 0.01;
+                p.density += noise(rng);
+                p.acc = noise(rng);
+            }
+
+            // Change the number of particles part of the way through, which forces a keyframe
+            if (step == 20)
+                particles.pop_back();
+            // And some values that XOR badly
+            if (step == 30)
+                particles[0].pressure = -INFINITY;
+
+            written.emplace_back(particles, step, step * 0.01);
+            writer.write(written.back());
+        }
+    }
+
+    SnapshotReader reader(filename);
+    Snapshot read;
+
+    for (const Snapshot &expected : written) {
+        ASSERT_TRUE(reader.read(read));
+        EXPECT_EQ(read.step, expected.step);
+        EXPECT_EQ(read.time, expected.time);
+        EXPECT_EQ(read.id, expected.id);
+        EXPECT_EQ(read.type, expected.type);
+
+        for (int c = 0; c < SNAPSHOT_N_COLUMNS; c++)
+            EXPECT_EQ(read.columns[c], expected.columns[c]);
+    }
+
+    EXPECT_FALSE(reader.read(read));
+    std::remove(filename.c_str());
+}
@@ -0,0 +1,112 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_task_graph.cpp defines unit tests for the task-graph scheduler, checking that tasks run after
+ * their dependencies, that exceptions thrown by tasks are passed back to the caller, and that pinned
+ * workers still run everything.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/task_graph.hpp"
+
+TEST(TaskGraphTest, RunsEveryTaskOnce) {
+    Executor executor(4);
+    TaskGraph graph;
+    std::atomic<int> counter{0};
+
+    for (int i = 0; i < 1000; i++)
+        graph.add([&counter] { counter++; });
+
+    executor.run(graph);
+    EXPECT_EQ(counter, 1000);
+
+    // Graphs can be reused after clearing
+    graph.clear();
+    graph.add([&counter] { counter++; });
+    executor.run(graph);
+    EXPECT_EQ(counter, 1001);
+}
+
+TEST(TaskGraphTest, RespectsDependencies) {
+    Executor executor(4);
+    TaskGraph graph;
+
+    // Two layers of tasks, where each task in the second layer depends on two tasks in the first
+    const int n = 64;
+    std::vector<std::atomic<int>> first_done(n);
+    std::vector<int> ok(n, 0);
+    std::vector<TaskGraph::TaskId> first(n);
+
+    for (int i = 0; i < n; i++)
+        first[i] = graph.add([&first_done, i] { first_done[i] = 1; });
+
+    for (int i = 0; i < n; i++) {
+        int j = (i + 1) % n;
+        graph.add([&first_done, &ok, i, j] { ok[i] = first_done[i] && first_done[j]; },
+                  { first[i], first[j] });
+    }
+
+    executor.run(graph);
+
+    for (int i = 0; i < n; i++)
+        EXPECT_EQ(ok[i], 1) << "Task " << i << " ran before its dependencies";
+}
+
+TEST(TaskGraphTest, RethrowsTaskException) {
+    Executor executor(2);
+    TaskGraph graph;
+    std::atomic<int> counter{0};
+
+    TaskGraph::TaskId bad = graph.add([] { throw std::runtime_error("task failed"); });
+    graph.add([&counter] { counter++; }, { bad });
+
+    EXPECT_THROW(executor.run(graph), std::runtime_error);
+    // The rest of the graph still ran, so the executor is in a usable state afterwards
+    EXPECT_EQ(counter, 1);
+}
+
+TEST(TaskGraphTest, WaitsForDetachedTasks) {
+    Executor executor(2);
+    std::atomic<int> counter{0};
+
+    for (int i = 0; i < 100; i++)
+        executor.submit([&counter] { counter++; });
+
+    executor.wait_detached();
+    EXPECT_EQ(counter, 100);
+}
+
+TEST(TaskGraphTest, TaskGroupsAreSeparate) {
+    Executor executor(2);
+    TaskGroup good, bad;
+    std::atomic<int> counter{0};
+
+    executor.submit([] { throw std::runtime_error("task failed"); }, bad);
+    for (int i = 0; i < 10; i++)
+        executor.submit([&counter] { counter++; }, good);
+
+    // Only the group that the failing task was in reports the error
+    EXPECT_NO_THROW(executor.wait(good));
+    EXPECT_EQ(counter, 10);
+    EXPECT_THROW(executor.wait(bad), std::runtime_error);
+}
+
+TEST(TaskGraphTest, PinnedWorkersRunEveryTask) {
+    // More workers than cores is fine, they just share
+    for (ThreadPinning pinning : { CompactPinning, SpreadPinning }) {
+        Executor executor(2 * std::max(1u, std::thread::hardware_concurrency()), pinning);
+        TaskGraph graph;
+        std::atomic<int> counter{0};
+
+        for (int i = 0; i < 100; i++)
+            graph.add([&counter] { counter++; });
+
+        executor.run(graph);
+        EXPECT_EQ(counter, 100);
+    }
+}
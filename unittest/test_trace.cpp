@@ -0,0 +1,104 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_trace.cpp defines unit tests for the Tracer, checking that every span recorded by several
+ * threads at once makes it into the trace file exactly once, even while it is being written out,
+ * and that the file is complete trace-event JSON.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "../sph/trace.hpp"
+
+static std::string read_file(const std::string &filename) {
+    std::ifstream file(filename);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+static int count(const std::string &text, const std::string &pattern) {
+    int n = 0;
+    for (size_t at = text.find(pattern); at != std::string::npos; at = text.find(pattern, at + 1))
+        n++;
+    return n;
+}
+
+TEST(TraceTest, EverySpanWrittenOnce) {
+    std::string filename = "test_trace.json";
+    ASSERT_TRUE(Tracer::get().open(filename, 3));
+
+    // Enough spans per thread for several blocks, flushed all the while
+    const int n_threads = 4;
+    const int n_spans = 3 * TRACE_BLOCK_EVENTS + 5;
+    std::atomic<int> n_done(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < n_threads; t++) {
+        threads.emplace_back([&n_done, t] {
+            Tracer::set_thread_name("Tester", t);
+            for (int i = 0; i < n_spans; i++)
+                TraceSpan span("Test span", "i", i);
+            n_done++;
+        });
+    }
+
+    while (n_done < n_threads)
+        Tracer::get().flush();
+    for (std::thread &thread : threads)
+        thread.join();
+
+    {
+        TraceSpan span("Main span");
+    }
+    Tracer::get().close();
+
+    std::string text = read_file(filename);
+    EXPECT_EQ(text.rfind("[\n", 0), 0u);
+    EXPECT_EQ(text.substr(text.size() - 3), "\n]\n");
+    EXPECT_EQ(count(text, "\"name\": \"Test span\""), n_threads * n_spans);
+    EXPECT_EQ(count(text, "\"args\": {\"i\": " + std::to_string(n_spans - 1) + "}"), n_threads);
+    EXPECT_EQ(count(text, "\"name\": \"Main span\""), 1);
+    EXPECT_EQ(count(text, "\"pid\": 3"), count(text, "\"pid\""));
+    for (int t = 0; t < n_threads; t++)
+        EXPECT_EQ(count(text, "\"name\": \"Tester " + std::to_string(t) + "\""), 1);
+    EXPECT_EQ(count(text, "\"name\": \"Main\""), 1);
+
+    // Every event is on its own line, separated by commas
+    EXPECT_EQ(count(text, "},\n{"), count(text, "\n{") - 1);
+
+    std::remove(filename.c_str());
+}
+
+TEST(TraceTest, NothingRecordedWhenClosed) {
+    std::string filename = "test_trace_closed.json";
+    {
+        TraceSpan span("Before");
+    }
+
+    ASSERT_TRUE(Tracer::get().open(filename, 0));
+    {
+        TraceSpan span("During");
+    }
+    Tracer::get().close();
+
+    {
+        TraceSpan span("After");
+    }
+
+    std::string text = read_file(filename);
+    EXPECT_EQ(count(text, "Before"), 0);
+    EXPECT_EQ(count(text, "\"During\""), 1);
+    EXPECT_EQ(count(text, "After"), 0);
+    // Named again in the new file
+    EXPECT_EQ(count(text, "\"name\": \"Main\""), 1);
+
+    std::remove(filename.c_str());
+}
@@ -0,0 +1,64 @@
+/*
+ * PHYM004 Project 2 / Jay Malhotra
+ *
+ * test_validation.cpp defines unit tests for the sanity sweeps of the checked build, checking that
+ * they catch NaNs and non-positive densities, and only look at the properties they are asked to.
+ */
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <gtest/gtest.h>
+
+#include "../sph/validation.hpp"
+
+class ValidationTestFixture : public ::testing::Test {
+    protected:
+        static const int N = 300;
+        ParticleArrayPtr p_arr;
+
+        ValidationTestFixture() {
+            p_arr = ParticleArrayPtr(new Particle[N]);
+            for (int i = 0; i < N; i++) {
+                Particle &p = p_arr[i];
+                p.mass = 0.01;
+                p.pos = -1 + 0.01 * i;
+                p.vel = 0;
+                p.acc = 0;
+                p.h = 0.02;
+                p.u = 1;
+                p.du_dt = 0;
+                p.density = 1;
+                p.pressure = 0.4;
+                p.omega = 1;
+            }
+        }
+};
+
+TEST_F(ValidationTestFixture, PassesValidParticles) {
+    EXPECT_NO_THROW(validate_particles(p_arr.get(), 0, N, ValidateAll, "test", 0));
+}
+
+TEST_F(ValidationTestFixture, CatchesNaNAndNonPositive) {
+    p_arr[123].vel = std::numeric_limits<double>::quiet_NaN();
+    EXPECT_THROW(validate_particles(p_arr.get(), 0, N, ValidateVelocity, "test", 0), std::runtime_error);
+
+    // Velocities can be negative, but densities can't
+    p_arr[123].vel = -1;
+    EXPECT_NO_THROW(validate_particles(p_arr.get(), 0, N, ValidateAll, "test", 0));
+
+    p_arr[200].density = 0;
+    EXPECT_THROW(validate_particles(p_arr.get(), 0, N, ValidateDensity, "test", 0), std::runtime_error);
+
+    p_arr[200].density = 1;
+    p_arr[5].acc = std::numeric_limits<double>::infinity();
+    EXPECT_THROW(validate_particles(p_arr.get(), 0, N, ValidateAll, "test", 0), std::runtime_error);
+}
+
+TEST_F(ValidationTestFixture, OnlyChecksGivenFieldsAndRange) {
+    p_arr[10].h = -0.02;
+
+    EXPECT_NO_THROW(validate_particles(p_arr.get(), 0, N, ValidateDensity | ValidatePosition, "test", 0));
+    EXPECT_NO_THROW(validate_particles(p_arr.get(), 11, N, ValidateSmoothingLength, "test", 0));
+    EXPECT_THROW(validate_particles(p_arr.get(), 0, 11, ValidateSmoothingLength, "test", 0), std::runtime_error);
+}